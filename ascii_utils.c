@@ -0,0 +1,362 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "ascii_utils.h"
+#include "bitmap_utils.h"
+#include "memory_utils.h"
+#include "worker_utils.h"
+
+//  bytes of text a chunk holds at least
+#define CHUNK_MIN_SIZE (1 << 20)
+
+//  chunks per worker thread, to even out dense and sparse parts of a file
+#define CHUNKS_PER_WORKER 4
+
+//  bytes of the buffers of a round of rows formatted at once
+#define ROUND_SIZE (32UL << 20)
+
+//  longest sample: "-2147483648 "
+#define SAMPLE_MAX_SIZE 12
+
+//  piece of the text body, parsed by one worker
+typedef struct {
+	const char *begin;
+	const char *end;
+	//  samples in the chunk
+	size_t count;
+	//  index of its first sample in the image
+	size_t first;
+} text_chunk;
+
+//  parallel decoding of a text body into the planes: samples are stored
+//  pixel by pixel, channel by channel
+typedef struct {
+	text_chunk *chunks;
+	double ***planes;
+	int channels;
+	int width;
+	//  samples of the image, the ones after them are ignored
+	size_t total;
+} text_job;
+
+//  skips white spaces and comments, returns the start of the next sample
+static const char *next_sample(const char *p, const char *end)
+{
+	while (p < end) {
+		if (*p == '#') {
+			while (p < end && *p != '\n')
+				p++;
+		} else if (isspace((unsigned char)*p)) {
+			p++;
+		} else {
+			break;
+		}
+	}
+
+	return p;
+}
+
+//  skips the sample starting at p
+static const char *skip_sample(const char *p, const char *end)
+{
+	while (p < end && !isspace((unsigned char)*p) && *p != '#')
+		p++;
+
+	return p;
+}
+
+//  worker task, counts the samples of the chunks [begin, end)
+static void count_samples(void *arg, int begin, int end, int worker)
+{
+	text_job *job = arg;
+
+	(void)worker;
+
+	for (int k = begin; k < end; ++k) {
+		text_chunk *chunk = &job->chunks[k];
+		const char *p = next_sample(chunk->begin, chunk->end);
+
+		chunk->count = 0;
+		while (p < chunk->end) {
+			chunk->count++;
+			p = next_sample(skip_sample(p, chunk->end), chunk->end);
+		}
+	}
+}
+
+//  worker task, parses the samples of the chunks [begin, end) like
+//  fscanf's "%d" and stores them in their planes
+static void parse_samples(void *arg, int begin, int end, int worker)
+{
+	text_job *job = arg;
+
+	(void)worker;
+
+	for (int k = begin; k < end; ++k) {
+		text_chunk *chunk = &job->chunks[k];
+		size_t index = chunk->first;
+		size_t pixel = index / job->channels;
+		int c = index % job->channels;
+		int i = pixel / job->width, j = pixel % job->width;
+		const char *p = next_sample(chunk->begin, chunk->end);
+
+		while (p < chunk->end && index < job->total) {
+			bool negative = *p == '-';
+			long value = 0;
+
+			if (*p == '-' || *p == '+')
+				p++;
+			while (p < chunk->end && isdigit((unsigned char)*p))
+				value = value * 10 + (*p++ - '0');
+
+			value = negative ? -value : value;
+			job->planes[c][i][j] = (double)(int)value;
+			index++;
+
+			//  next channel, then next pixel
+			if (++c == job->channels) {
+				c = 0;
+				if (++j == job->width) {
+					j = 0;
+					i++;
+				}
+			}
+
+			p = next_sample(skip_sample(p, chunk->end), chunk->end);
+		}
+	}
+}
+
+//  loads the planes of a text file (P2, P3) on the worker threads: the body
+//  is mapped and cut in chunks right after newlines (never inside a sample
+//  or a comment), every chunk counts its samples, the sums of the counts
+//  give the index of the first sample of every chunk, then all of them are
+//  parsed at once; returns false if the file can't be mapped (e.g. a pipe)
+//  or memory is exhausted, the caller should read it serially then
+bool t_parallel_load(FILE *file, double **planes[3], int channels, int n,
+					 int m)
+{
+	struct stat st;
+	off_t pos = ftello(file);
+
+	if (pos < 0 || fstat(fileno(file), &st) || !S_ISREG(st.st_mode) ||
+		st.st_size <= pos)
+		return false;
+
+	size_t size = st.st_size;
+	char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+	if (map == MAP_FAILED)
+		return false;
+
+	const char *body = map + pos, *body_end = map + size;
+	size_t length = size - pos;
+	size_t max_chunks = (size_t)workers_count() * CHUNKS_PER_WORKER;
+	size_t count = length / CHUNK_MIN_SIZE;
+
+	count = count < 1 ? 1 : count > max_chunks ? max_chunks : count;
+
+	text_chunk *chunks = mem_alloc(sizeof(text_chunk) * count, MEM_IO);
+	if (!chunks) {
+		munmap(map, size);
+		return false;
+	}
+
+	const char *start = body;
+	for (size_t k = 0; k < count; ++k) {
+		const char *cut = body + length * (k + 1) / count;
+
+		if (k == count - 1 || cut <= start) {
+			cut = k == count - 1 ? body_end : start;
+		} else {
+			cut = memchr(cut, '\n', body_end - cut);
+			cut = cut ? cut + 1 : body_end;
+		}
+
+		chunks[k].begin = start;
+		chunks[k].end = cut;
+		start = cut;
+	}
+
+	text_job job = {chunks, planes, channels, m, (size_t)n * m * channels};
+
+	workers_run(count, count_samples, &job);
+
+	size_t first = 0;
+	for (size_t k = 0; k < count; ++k) {
+		chunks[k].first = first;
+		first += chunks[k].count;
+	}
+
+	workers_run(count, parse_samples, &job);
+
+	mem_free(chunks);
+	munmap(map, size);
+
+	//  the whole body was read
+	fseeko(file, 0, SEEK_END);
+	return true;
+}
+
+//  parallel formatting of a round of rows: the band of rows starting at
+//  row i of the round is formatted at out + i * row_size, lengths[i] bytes
+//  long (0 if no band starts there)
+typedef struct {
+	double **planes[3];
+	//  0 for black & white images
+	int channels;
+	uint64_t **bits;
+	int width;
+	//  first row of the round
+	int first;
+	//  bytes a row takes at most
+	size_t row_size;
+	char *out;
+	size_t *lengths;
+} print_job;
+
+//  formats a sample like fprintf's "%d ", returns the end of its text
+static inline char *put_sample(char *p, int value)
+{
+	char digits[SAMPLE_MAX_SIZE];
+	unsigned int v = value < 0 ? 0U - (unsigned int)value :
+					 (unsigned int)value;
+	int len = 0;
+
+	do {
+		digits[len++] = '0' + v % 10;
+		v /= 10;
+	} while (v);
+
+	if (value < 0)
+		*p++ = '-';
+	while (len)
+		*p++ = digits[--len];
+	*p++ = ' ';
+
+	return p;
+}
+
+//  worker task, formats the rows [begin, end) of the round
+static void print_band(void *arg, int begin, int end, int worker)
+{
+	print_job *job = arg;
+	char *out = job->out + (size_t)begin * job->row_size, *p = out;
+
+	(void)worker;
+
+	for (int i = job->first + begin; i < job->first + end; ++i) {
+		if (!job->channels) {
+			for (int j = 0; j < job->width; ++j) {
+				*p++ = '0' + BIT_GET(job->bits[i], j);
+				*p++ = ' ';
+			}
+		} else {
+			for (int j = 0; j < job->width; ++j)
+				for (int c = 0; c < job->channels; ++c)
+					p = put_sample(p, round(job->planes[c][i][j]));
+		}
+
+		*p++ = '\n';
+	}
+
+	job->lengths[begin] = p - out;
+}
+
+//  writes the buffers in order, resuming after partial writes
+static bool write_buffers(int fd, struct iovec *iov, int count)
+{
+	while (count) {
+		ssize_t written = writev(fd, iov, count);
+
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+
+		while (count && (size_t)written >= iov->iov_len) {
+			written -= iov->iov_len;
+			iov++;
+			count--;
+		}
+
+		if (count) {
+			iov->iov_base = (char *)iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+
+	return true;
+}
+
+//  prints the pixels of an image to a text file, the same bytes as
+//  t_print, t_3_print and t_bits_print: rounds of rows are formatted by
+//  the worker threads, every band in its own part of a buffer, then the
+//  parts are written in order with one writev; returns PRINT_NO_MEMORY
+//  before writing anything if the buffers can't be allocated
+enum print_status t_parallel_print(FILE *file, my_image *image)
+{
+	print_job job;
+	int width = image->width, height = image->height;
+
+	job.channels = image_planes(image, job.planes);
+	job.bits = job.channels ? NULL : ((bit_img *)image->img)->rows;
+	job.width = width;
+	job.row_size = (size_t)width * (job.channels ?
+				   job.channels * SAMPLE_MAX_SIZE : 2) + 1;
+
+	size_t rows = ROUND_SIZE / job.row_size;
+	rows = rows < 1 ? 1 : rows > (size_t)height ? (size_t)height : rows;
+
+	int bands = workers_count();
+	job.out = mem_alloc(rows * job.row_size, MEM_IO);
+	job.lengths = mem_alloc(sizeof(size_t) * rows, MEM_IO);
+	struct iovec *iov = mem_alloc(sizeof(struct iovec) * bands, MEM_IO);
+
+	if (!job.out || !job.lengths || !iov) {
+		mem_free(job.out);
+		mem_free(job.lengths);
+		mem_free(iov);
+		return PRINT_NO_MEMORY;
+	}
+
+	//  the header is still in the stream's buffer
+	bool written = !fflush(file);
+
+	for (job.first = 0; job.first < height && written;
+		 job.first += rows) {
+		int count = height - job.first < (int)rows ?
+					height - job.first : (int)rows;
+		int parts = 0;
+
+		memset(job.lengths, 0, sizeof(size_t) * count);
+		workers_run(count, print_band, &job);
+
+		//  bands in the order of their rows
+		for (int i = 0; i < count; ++i) {
+			if (!job.lengths[i])
+				continue;
+
+			iov[parts].iov_base = job.out + (size_t)i * job.row_size;
+			iov[parts].iov_len = job.lengths[i];
+			parts++;
+		}
+
+		written = write_buffers(fileno(file), iov, parts);
+	}
+
+	mem_free(job.out);
+	mem_free(job.lengths);
+	mem_free(iov);
+
+	return written ? PRINT_OK : PRINT_FAILED;
+}
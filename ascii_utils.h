@@ -0,0 +1,16 @@
+#ifndef ASCII_UTTILS_
+#define ASCII_UTTILS_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "image_utils.h"
+
+//  result of writing the pixels of a text file
+enum print_status {PRINT_OK = 0, PRINT_NO_MEMORY = 1, PRINT_FAILED = 2};
+
+bool t_parallel_load(FILE *file, double **planes[3], int channels, int n,
+					 int m);
+
+enum print_status t_parallel_print(FILE *file, my_image *image);
+
+#endif /* ASCII_UTTILS_ */
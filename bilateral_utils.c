@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <math.h>
+#include "bilateral_utils.h"
+#include "memory_utils.h"
+#include "worker_utils.h"
+#include "utils.h"
+
+//  cells of zeros around the grid, as wide as half the blur's kernel
+#define PAD 2
+
+//  reach of the filter around the selection, in spatial sigmas
+#define REACH 3
+
+//  longest text of the two sigmas of APPLY BILATERAL
+#define SIGMAS_MAX_SIZE 64
+
+//  bilateral grid of a plane: pixel (x, y) of value v adds (v, 1) to the
+//  cell nearest to (x / sigma_s, y / sigma_s, v / sigma_r), blurring the
+//  cells blurs the pixels that are close both in space and in value
+typedef struct {
+	double **plane;
+	my_select *select;
+	//  pixels splatted: [left, right) x [top, bottom)
+	int left;
+	int top;
+	int right;
+	int bottom;
+	double sigma_s;
+	double sigma_r;
+	double max;
+	//  cells along x, y and v, with the padding
+	int nx;
+	int ny;
+	int nz;
+	//  grid row of every splatted row, grid column of every column
+	int *cell_row;
+	int *cell_col;
+	//  2 grids of (sum, weight) pairs, a blur reads from and writes to
+	//  (floats halve the memory the blurs sweep through)
+	float *grid;
+	float *blurred;
+	float *from;
+	float *to;
+	//  distance between neighbours along the blurred axis, in floats
+	size_t stride;
+} bilateral_job;
+
+//  checks the parameters of APPLY BILATERAL <sigma_s> <sigma_r>, the
+//  spatial one in pixels and the range one in pixel values (both at least 1)
+bool get_bilateral_params(char *args, double *sigma_s, double *sigma_r)
+{
+	char words[SIGMAS_MAX_SIZE], *space;
+
+	if (strncmp(args, "BILATERAL ", sizeof("BILATERAL ") - 1))
+		return false;
+
+	args += sizeof("BILATERAL ") - 1;
+	if (strlen(args) >= sizeof(words))
+		return false;
+
+	//  the sigmas are separated by a single space
+	strcpy(words, args);
+	space = strchr(words, ' ');
+	if (!space)
+		return false;
+	*space = '\0';
+
+	return parse_decimal(words, sigma_s) && parse_decimal(space + 1, sigma_r) &&
+		   *sigma_s >= 1 && *sigma_r >= 1;
+}
+
+//  index of the pair of cell (x, y, z) of the grid
+static inline size_t cell(bilateral_job *job, int x, int y, int z)
+{
+	return (((size_t)y * job->nx + x) * job->nz + z) * 2;
+}
+
+//  worker task, splats the pixels of the grid rows [begin, end) (every
+//  worker adds to its own cells)
+static void splat_rows(void *arg, int begin, int end, int worker)
+{
+	bilateral_job *job = arg;
+
+	(void)worker;
+
+	for (int y = job->top; y < job->bottom; ++y) {
+		int gy = job->cell_row[y - job->top];
+
+		if (gy < begin || gy >= end)
+			continue;
+
+		for (int x = job->left; x < job->right; ++x) {
+			double v = job->plane[y][x];
+
+			v = v < 0 ? 0 : v > job->max ? job->max : v;
+
+			int gz = (int)(v / job->sigma_r + 0.5);
+			float *c = job->grid + cell(job, job->cell_col[x - job->left] +
+										 PAD, gy + PAD, gz + PAD);
+
+			c[0] += v;
+			c[1] += 1;
+		}
+	}
+}
+
+//  worker task, blurs the grid rows [begin, end) along an axis by
+//  (1 4 6 4 1) / 16, whose variance is one cell: a run of cells along v is
+//  contiguous, so every axis is a plain loop over it
+static void blur_rows(void *arg, int begin, int end, int worker)
+{
+	bilateral_job *job = arg;
+	ptrdiff_t s = job->stride;
+	ptrdiff_t length = 2 * (ptrdiff_t)(job->nz - 2 * PAD);
+
+	(void)worker;
+
+	for (int gy = begin + PAD; gy < end + PAD; ++gy) {
+		for (int gx = PAD; gx < job->nx - PAD; ++gx) {
+			size_t c = cell(job, gx, gy, PAD);
+			float *restrict to = job->to + c;
+			float *restrict from = job->from + c;
+
+			for (ptrdiff_t k = 0; k < length; ++k)
+				to[k] = (from[k - 2 * s] + from[k + 2 * s] +
+						 4 * (from[k - s] + from[k + s]) + 6 * from[k]) / 16.0f;
+		}
+	}
+}
+
+//  worker task, slices the blurred grid at the selected pixels of a band of
+//  rows: the sums and weights of the 8 cells around (x, y, v) are
+//  interpolated, their ratio is the filtered pixel
+static void slice_rows(void *arg, int begin, int end, int worker)
+{
+	bilateral_job *job = arg;
+	my_select *s = job->select;
+
+	(void)worker;
+
+	for (int y = s->y1 + begin; y < s->y1 + end; ++y) {
+		double fy = (y - job->top) / job->sigma_s + PAD;
+		int y0 = (int)fy;
+		double ty = fy - y0;
+
+		for (int x = s->x1; x < s->x2; ++x) {
+			double v = job->plane[y][x];
+
+			v = v < 0 ? 0 : v > job->max ? job->max : v;
+
+			double fx = (x - job->left) / job->sigma_s + PAD;
+			double fz = v / job->sigma_r + PAD;
+			int x0 = (int)fx, z0 = (int)fz;
+			double tx = fx - x0, tz = fz - z0;
+			double sum = 0, weight = 0;
+
+			for (int k = 0; k < 8; ++k) {
+				int dx = k & 1, dy = (k >> 1) & 1, dz = k >> 2;
+				double w = (dx ? tx : 1 - tx) * (dy ? ty : 1 - ty) *
+						   (dz ? tz : 1 - tz);
+				float *c = job->blurred + cell(job, x0 + dx, y0 + dy,
+												z0 + dz);
+
+				sum += w * c[0];
+				weight += w * c[1];
+			}
+
+			if (weight > 0)
+				job->plane[y][x] = sum / weight;
+		}
+	}
+}
+
+//  filters a plane: splat, blur along x, y and v, slice
+static void bilateral_plane(bilateral_job *job, double **plane)
+{
+	size_t size = sizeof(float) * 2 * job->nx * job->ny * job->nz;
+	int rows = job->ny - 2 * PAD;
+
+	//  the blurs only write the cells inside the padding
+	job->plane = plane;
+	memset(job->grid, 0, size);
+
+	workers_run(rows, splat_rows, job);
+
+	size_t strides[3] = {2 * (size_t)job->nz,
+						 2 * (size_t)job->nz * job->nx, 2};
+	float *buffers[2] = {job->grid, job->blurred};
+
+	for (int axis = 0; axis < 3; ++axis) {
+		job->from = buffers[axis & 1];
+		job->to = buffers[!(axis & 1)];
+		job->stride = strides[axis];
+		workers_run(rows, blur_rows, job);
+	}
+
+	workers_run(job->select->y2 - job->select->y1, slice_rows, job);
+}
+
+//  edge-preserving blur of the selection of a color or grayscale image by
+//  a bilateral grid: a cell covers sigma_s x sigma_s pixels and sigma_r
+//  values, so the cost shrinks as sigma_s grows,
+//  returns false if memory is exhausted
+bool apply_bilateral(my_image *image, double sigma_s, double sigma_r)
+{
+	bilateral_job job;
+	my_select *s = image->select;
+	double **planes[3];
+	int channels = image_planes(image, planes);
+	int reach = (int)ceil(REACH * sigma_s);
+
+	job.select = s;
+	job.sigma_s = sigma_s;
+	job.sigma_r = sigma_r;
+	job.max = image->pixel_value;
+
+	//  pixels further than the reach barely change the selection
+	job.left = s->x1 - reach < 0 ? 0 : s->x1 - reach;
+	job.top = s->y1 - reach < 0 ? 0 : s->y1 - reach;
+	job.right = s->x2 + reach > image->width ? image->width : s->x2 + reach;
+	job.bottom = s->y2 + reach > image->height ?
+				 image->height : s->y2 + reach;
+
+	job.nx = (int)((job.right - job.left - 1) / sigma_s + 0.5) + 1 + 2 * PAD;
+	job.ny = (int)((job.bottom - job.top - 1) / sigma_s + 0.5) + 1 + 2 * PAD;
+	job.nz = (int)(job.max / sigma_r + 0.5) + 1 + 2 * PAD;
+
+	size_t size = sizeof(float) * 2 * job.nx * job.ny * job.nz;
+
+	job.cell_row = mem_alloc(sizeof(int) * (job.bottom - job.top),
+							 MEM_SCRATCH);
+	job.cell_col = mem_alloc(sizeof(int) * (job.right - job.left),
+							 MEM_SCRATCH);
+	job.grid = mem_alloc(size, MEM_SCRATCH);
+	job.blurred = mem_alloc(size, MEM_SCRATCH);
+
+	if (!job.cell_row || !job.cell_col || !job.grid || !job.blurred) {
+		mem_free(job.cell_row);
+		mem_free(job.cell_col);
+		mem_free(job.grid);
+		mem_free(job.blurred);
+		return false;
+	}
+
+	for (int y = job.top; y < job.bottom; ++y)
+		job.cell_row[y - job.top] = (int)((y - job.top) / sigma_s + 0.5);
+	for (int x = job.left; x < job.right; ++x)
+		job.cell_col[x - job.left] = (int)((x - job.left) / sigma_s + 0.5);
+
+	memset(job.blurred, 0, size);
+	for (int c = 0; c < channels; ++c)
+		bilateral_plane(&job, planes[c]);
+
+	mem_free(job.cell_row);
+	mem_free(job.cell_col);
+	mem_free(job.grid);
+	mem_free(job.blurred);
+	return true;
+}
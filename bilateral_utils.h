@@ -0,0 +1,11 @@
+#ifndef BILATERAL_UTTILS_
+#define BILATERAL_UTTILS_
+
+#include <stdbool.h>
+#include "image_utils.h"
+
+bool get_bilateral_params(char *args, double *sigma_s, double *sigma_r);
+
+bool apply_bilateral(my_image *image, double sigma_s, double sigma_r);
+
+#endif /* BILATERAL_UTTILS_ */
@@ -0,0 +1,504 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include "bitmap_utils.h"
+#include "matrix_utils.h"
+#include "numa_utils.h"
+
+//  mask of the first len bits of a word (counted from the MSB)
+static uint64_t head_mask(int len)
+{
+	return len >= 64 ? ~0ULL : ~(~0ULL >> len);
+}
+
+//  allocs a zeroed bitmap of n rows of m pixels as one block:
+//  the row pointers followed by the rows stored contiguously
+uint64_t **alloc_bitmap(int n, int m)
+{
+	//  keep the first row aligned to a cache line
+	size_t rows_size = (sizeof(uint64_t *) * n + 63) & ~(size_t)63;
+	size_t words = BITMAP_WORDS(m);
+	size_t data_size = sizeof(uint64_t) * n * words;
+
+	uint64_t **a = mem_alloc(rows_size + data_size, MEM_PLANES);
+	if (!a)
+		return NULL;
+
+	uint64_t *data = (uint64_t *)((char *)a + rows_size);
+	for (int i = 0; i < n; ++i)
+		a[i] = data + i * words;
+
+	//  the bits after the last pixel of a row must stay 0, rows are zeroed
+	//  by the workers that will work on them
+	numa_touch_rows((char *)data, n, sizeof(uint64_t) * words, true);
+
+	return a;
+}
+
+//  copies a bitmap in a new one of the given category
+uint64_t **copy_bitmap(uint64_t **a, int n, int m, enum mem_category category)
+{
+	size_t rows_size = (sizeof(uint64_t *) * n + 63) & ~(size_t)63;
+	size_t words = BITMAP_WORDS(m);
+
+	uint64_t **copy = mem_alloc(rows_size + sizeof(uint64_t) * n * words,
+								category);
+	if (!copy)
+		return NULL;
+
+	uint64_t *data = (uint64_t *)((char *)copy + rows_size);
+	for (int i = 0; i < n; ++i)
+		copy[i] = data + i * words;
+
+	//  rows are stored contiguously
+	memcpy(copy[0], a[0], sizeof(uint64_t) * n * words);
+
+	return copy;
+}
+
+//  bytes of the block of a bitmap of n rows of m pixels
+size_t bitmap_block_size(int n, int m)
+{
+	return ((sizeof(uint64_t *) * n + 63) & ~(size_t)63) +
+		   sizeof(uint64_t) * n * BITMAP_WORDS(m);
+}
+
+//  maps the block of a bitmap stored in a file (see mem_map), only the row
+//  pointers are rewritten, returns NULL if it can't be mapped
+uint64_t **map_bitmap(int fd, off_t offset, int n, int m)
+{
+	size_t rows_size = (sizeof(uint64_t *) * n + 63) & ~(size_t)63;
+	size_t words = BITMAP_WORDS(m);
+
+	uint64_t **a = mem_map(fd, offset, bitmap_block_size(n, m), MEM_PLANES);
+	if (!a)
+		return NULL;
+
+	uint64_t *data = (uint64_t *)((char *)a + rows_size);
+	for (int i = 0; i < n; ++i)
+		a[i] = data + i * words;
+
+	return a;
+}
+
+//  frees the memory allocated for a bitmap
+void free_bitmap(uint64_t **a)
+{
+	mem_free(a);
+}
+
+//  loads a bitmap from a binary (P4) file: 8 pixels per byte, MSB first,
+//  returns LOAD_NO_FILE if the file ends before the last row
+enum load_status b_bits_load(FILE *file, uint64_t **a, int n, int m)
+{
+	int row_bytes = (m + 7) / 8;
+	int words = BITMAP_WORDS(m);
+
+	unsigned char *buffer = mem_alloc(words * 8, MEM_IO);
+	if (!buffer)
+		return LOAD_NO_MEMORY;
+
+	for (int i = 0; i < n; ++i) {
+		//  padding bytes of the last word stay 0
+		memset(buffer, 0, words * 8);
+		if (fread(buffer, 1, row_bytes, file) != (size_t)row_bytes) {
+			mem_free(buffer);
+			return LOAD_NO_FILE;
+		}
+
+		//  assemble the words big endian, like the pixels are stored
+		for (int k = 0; k < words; ++k) {
+			uint64_t word = 0;
+			for (int b = 0; b < 8; ++b)
+				word = (word << 8) | buffer[k * 8 + b];
+			a[i][k] = word;
+		}
+
+		//  clear the padding bits of the last byte
+		if (m % 64)
+			a[i][words - 1] &= head_mask(m % 64);
+	}
+
+	mem_free(buffer);
+	return LOAD_OK;
+}
+
+//  loads a bitmap from a text (P1) file, one '0' or '1' per pixel
+void t_bits_load(FILE *file, uint64_t **a, int n, int m)
+{
+	for (int i = 0; i < n; ++i) {
+		for (int j = 0; j < m; ++j) {
+			int c = fgetc(file);
+
+			//  skip white spaces and comments
+			while (c != EOF && (isspace(c) || c == '#')) {
+				if (c == '#')
+					while (c != EOF && c != '\n')
+						c = fgetc(file);
+				c = fgetc(file);
+			}
+
+			if (c == '1')
+				a[i][j >> 6] |= 1ULL << (63 - (j & 63));
+		}
+	}
+}
+
+//  encodes a row of m pixels as a binary (P4) file stores it, in
+//  (m + 7) / 8 bytes
+void b_bits_encode_row(uint64_t *row, int m, unsigned char *buffer)
+{
+	int row_bytes = (m + 7) / 8;
+
+	for (int b = 0; b < row_bytes; ++b)
+		buffer[b] = row[b >> 3] >> (56 - 8 * (b & 7));
+}
+
+//  prints a bitmap to a binary (P4) file, returns false if memory is
+//  exhausted or a row can't be written
+bool b_bits_print(FILE *file, uint64_t **a, int n, int m)
+{
+	int row_bytes = (m + 7) / 8;
+	int words = BITMAP_WORDS(m);
+
+	unsigned char *buffer = mem_alloc(words * 8, MEM_IO);
+	if (!buffer)
+		return false;
+
+	bool written = true;
+	for (int i = 0; i < n && written; ++i) {
+		b_bits_encode_row(a[i], m, buffer);
+		written = fwrite(buffer, 1, row_bytes, file) == (size_t)row_bytes;
+	}
+
+	mem_free(buffer);
+	return written;
+}
+
+//  prints a bitmap to a text (P1) file
+void t_bits_print(FILE *file, uint64_t **a, int n, int m)
+{
+	for (int i = 0; i < n; ++i) {
+		for (int j = 0; j < m; ++j)
+			fprintf(file, "%d ", (int)BIT_GET(a[i], j));
+		fprintf(file, "\n");
+	}
+}
+
+//  gets the 64 pixels of a row starting at pixel x (0 past the row's end)
+static uint64_t get_word(uint64_t *row, int words, int x)
+{
+	int q = x >> 6;
+	int s = x & 63;
+
+	uint64_t word = q < words ? row[q] << s : 0;
+
+	if (s && q + 1 < words)
+		word |= row[q + 1] >> (64 - s);
+
+	return word;
+}
+
+//  stores and computes the cropped bitmap by the given selection
+uint64_t **crop_bitmap(uint64_t **a, int x1, int y1, int x2, int y2)
+{
+	int m = x2 - x1;
+	int src_words = BITMAP_WORDS(x2);
+	int words = BITMAP_WORDS(m);
+
+	uint64_t **crop = alloc_bitmap(y2 - y1, m);
+	if (!crop)
+		return NULL;
+
+	//  shift whole words of every row in place
+	for (int i = 0; i < y2 - y1; ++i) {
+		for (int k = 0; k < words; ++k)
+			crop[i][k] = get_word(a[i + y1], src_words, x1 + 64 * k);
+
+		if (m % 64)
+			crop[i][words - 1] &= head_mask(m % 64);
+	}
+
+	return crop;
+}
+
+//  sets the pixels selected by mask in word to the ones of value
+static void put_bits(uint64_t *word, uint64_t mask, uint64_t value)
+{
+	*word = (*word & ~mask) | (value & mask);
+}
+
+//  copies a bitmap of n x m pixels in dst (of width dst_m) at x1, y1
+void paste_bitmap(uint64_t **dst, int dst_m, uint64_t **src,
+				  int x1, int y1, int n, int m)
+{
+	int dst_words = BITMAP_WORDS(dst_m);
+	int words = BITMAP_WORDS(m);
+	int s = x1 & 63;
+
+	for (int i = 0; i < n; ++i) {
+		uint64_t *row = dst[i + y1];
+
+		for (int k = 0; k < words; ++k) {
+			int len = k == words - 1 && m % 64 ? m % 64 : 64;
+			uint64_t mask = head_mask(len);
+			int q = (x1 >> 6) + k;
+
+			//  the word may span two words of the destination row
+			put_bits(&row[q], mask >> s, src[i][k] >> s);
+
+			if (s && q + 1 < dst_words)
+				put_bits(&row[q + 1], mask << (64 - s),
+						 src[i][k] << (64 - s));
+		}
+	}
+}
+
+//  sets every pixel of the selection to bit, a word at a time
+void fill_bitmap(uint64_t **a, int x1, int y1, int x2, int y2, int bit)
+{
+	uint64_t value = bit ? ~0ULL : 0;
+	int first = x1 >> 6;
+	int last = (x2 - 1) >> 6;
+
+	//  masks of the selected pixels in the first and last words
+	uint64_t first_mask = ~0ULL >> (x1 & 63);
+	uint64_t last_mask = head_mask(((x2 - 1) & 63) + 1);
+
+	for (int i = y1; i < y2; ++i) {
+		if (first == last) {
+			put_bits(&a[i][first], first_mask & last_mask, value);
+			continue;
+		}
+
+		put_bits(&a[i][first], first_mask, value);
+		for (int k = first + 1; k < last; ++k)
+			a[i][k] = value;
+		put_bits(&a[i][last], last_mask, value);
+	}
+}
+
+//  flips every pixel of the selection, a word at a time
+void invert_bitmap(uint64_t **a, int x1, int y1, int x2, int y2)
+{
+	int first = x1 >> 6;
+	int last = (x2 - 1) >> 6;
+
+	//  masks of the selected pixels in the first and last words
+	uint64_t first_mask = ~0ULL >> (x1 & 63);
+	uint64_t last_mask = head_mask(((x2 - 1) & 63) + 1);
+
+	for (int i = y1; i < y2; ++i) {
+		if (first == last) {
+			a[i][first] ^= first_mask & last_mask;
+			continue;
+		}
+
+		a[i][first] ^= first_mask;
+		for (int k = first + 1; k < last; ++k)
+			a[i][k] = ~a[i][k];
+		a[i][last] ^= last_mask;
+	}
+}
+
+//  copies the pixels of the selection from src, which holds rows y1 to
+//  y2 - 1 of a bitmap as wide as a, a word at a time
+void blend_bitmap(uint64_t **a, uint64_t **src, int x1, int y1, int x2, int y2)
+{
+	int first = x1 >> 6;
+	int last = (x2 - 1) >> 6;
+
+	//  masks of the selected pixels in the first and last words
+	uint64_t first_mask = ~0ULL >> (x1 & 63);
+	uint64_t last_mask = head_mask(((x2 - 1) & 63) + 1);
+
+	for (int i = y1; i < y2; ++i) {
+		uint64_t *row = src[i - y1];
+
+		if (first == last) {
+			put_bits(&a[i][first], first_mask & last_mask, row[first]);
+			continue;
+		}
+
+		put_bits(&a[i][first], first_mask, row[first]);
+		for (int k = first + 1; k < last; ++k)
+			a[i][k] = row[k];
+		put_bits(&a[i][last], last_mask, row[last]);
+	}
+}
+
+//  transposes a 64 x 64 block of bits (row i is word i, MSB first)
+static void transpose_block(uint64_t block[64])
+{
+	uint64_t mask = 0x00000000FFFFFFFFULL;
+
+	for (int j = 32; j; j >>= 1, mask ^= mask << j) {
+		for (int k = 0; k < 64; k = ((k | j) + 1) & ~j) {
+			uint64_t t = (block[k] ^ (block[k | j] >> j)) & mask;
+			block[k] ^= t;
+			block[k | j] ^= t << j;
+		}
+	}
+}
+
+//  reverses the order of the bits of a word
+static uint64_t reverse_word(uint64_t x)
+{
+	x = ((x >> 1) & 0x5555555555555555ULL) | ((x & 0x5555555555555555ULL) << 1);
+	x = ((x >> 2) & 0x3333333333333333ULL) | ((x & 0x3333333333333333ULL) << 2);
+	x = ((x >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((x & 0x0F0F0F0F0F0F0F0FULL) << 4);
+	x = ((x >> 8) & 0x00FF00FF00FF00FFULL) | ((x & 0x00FF00FF00FF00FFULL) << 8);
+	x = ((x >> 16) & 0x0000FFFF0000FFFFULL) |
+		((x & 0x0000FFFF0000FFFFULL) << 16);
+	return (x >> 32) | (x << 32);
+}
+
+//  mirrors a row of m pixels into dst (pixel j goes to m - 1 - j)
+static void reverse_row(uint64_t *dst, uint64_t *src, int m)
+{
+	int words = BITMAP_WORDS(m);
+	int shift = words * 64 - m;
+
+	//  mirror the whole words, the padding ends up in front
+	for (int k = 0; k < words; ++k)
+		dst[k] = reverse_word(src[words - 1 - k]);
+
+	//  drop the padding in front
+	if (shift) {
+		for (int k = 0; k < words; ++k) {
+			dst[k] <<= shift;
+			if (k + 1 < words)
+				dst[k] |= dst[k + 1] >> (64 - shift);
+		}
+	}
+}
+
+//  computes the m x n transpose of a n x m bitmap, 64 x 64 blocks at a time
+static uint64_t **transpose_bitmap(uint64_t **a, int n, int m)
+{
+	uint64_t block[64];
+
+	uint64_t **t = alloc_bitmap(m, n);
+	if (!t)
+		return NULL;
+
+	for (int bi = 0; bi < n; bi += 64) {
+		for (int bj = 0; bj < m; bj += 64) {
+			//  rows past the end are 0, like the padding bits
+			for (int k = 0; k < 64; ++k)
+				block[k] = bi + k < n ? a[bi + k][bj >> 6] : 0;
+
+			transpose_block(block);
+
+			for (int k = 0; k < 64 && bj + k < m; ++k)
+				t[bj + k][bi >> 6] = block[k];
+		}
+	}
+
+	return t;
+}
+
+//  copies a bitmap and rotates the copy 90 degrees clockwise
+uint64_t **rotate_bitmap_90(uint64_t **a, int n, int m)
+{
+	uint64_t **t = transpose_bitmap(a, n, m);
+	if (!t)
+		return NULL;
+
+	//  mirror every row of the transpose
+	uint64_t *row = mem_alloc(sizeof(uint64_t) * BITMAP_WORDS(n), MEM_SCRATCH);
+	if (!row) {
+		free_bitmap(t);
+		return NULL;
+	}
+
+	for (int i = 0; i < m; ++i) {
+		reverse_row(row, t[i], n);
+		memcpy(t[i], row, sizeof(uint64_t) * BITMAP_WORDS(n));
+	}
+
+	mem_free(row);
+
+	return t;
+}
+
+//  copies a bitmap and rotates the copy 180 degrees clockwise
+uint64_t **rotate_bitmap_180(uint64_t **a, int n, int m)
+{
+	uint64_t **rotate = alloc_bitmap(n, m);
+	if (!rotate)
+		return NULL;
+
+	//  mirror the rows and their order
+	for (int i = 0; i < n; ++i)
+		reverse_row(rotate[i], a[n - 1 - i], m);
+
+	return rotate;
+}
+
+//  copies a bitmap and rotates the copy 270 degrees clockwise
+uint64_t **rotate_bitmap_270(uint64_t **a, int n, int m)
+{
+	uint64_t **t = transpose_bitmap(a, n, m);
+	if (!t)
+		return NULL;
+
+	//  mirror the order of the transpose's rows (rows stay contiguous)
+	size_t row_size = sizeof(uint64_t) * BITMAP_WORDS(n);
+	uint64_t *row = mem_alloc(row_size, MEM_SCRATCH);
+	if (!row) {
+		free_bitmap(t);
+		return NULL;
+	}
+
+	for (int i = 0; i < m / 2; ++i) {
+		memcpy(row, t[i], row_size);
+		memcpy(t[i], t[m - 1 - i], row_size);
+		memcpy(t[m - 1 - i], row, row_size);
+	}
+
+	mem_free(row);
+
+	return t;
+}
+
+//  expands a bitmap to a double matrix (0 or 1 per pixel)
+double **unpack_bitmap(uint64_t **a, int n, int m, enum mem_category category)
+{
+	double **pixels = alloc_matrix_in(n, m, category);
+	if (!pixels)
+		return NULL;
+
+	for (int i = 0; i < n; ++i)
+		for (int j = 0; j < m; ++j)
+			pixels[i][j] = (double)BIT_GET(a[i], j);
+
+	return pixels;
+}
+
+//  packs a row of m doubles in a bitmap row (values of at least 0.5 become 1)
+void pack_bitmap_row(double *a, uint64_t *bits, int m)
+{
+	int words = BITMAP_WORDS(m);
+
+	for (int k = 0; k < words; ++k) {
+		uint64_t word = 0;
+
+		for (int b = 0; b < 64; ++b) {
+			int j = k * 64 + b;
+			word = (word << 1) | (j < m && a[j] >= 0.5);
+		}
+
+		bits[k] = word;
+	}
+}
+
+//  packs a double matrix in a bitmap (values of at least 0.5 become 1)
+void pack_bitmap(double **a, uint64_t **bits, int n, int m)
+{
+	for (int i = 0; i < n; ++i)
+		pack_bitmap_row(a[i], bits[i], m);
+}
@@ -0,0 +1,59 @@
+#ifndef BITMAP_UTTILS_
+#define BITMAP_UTTILS_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "memory_utils.h"
+#include "image_utils.h"
+
+//  number of 64 bit words needed for a row of m pixels
+#define BITMAP_WORDS(m) (((m) + 63) / 64)
+
+//  pixel j of a row is bit 63 - j % 64 of word j / 64 (like P4's bytes)
+#define BIT_GET(row, j) (((row)[(j) >> 6] >> (63 - ((j) & 63))) & 1)
+
+uint64_t **alloc_bitmap(int n, int m);
+
+uint64_t **copy_bitmap(uint64_t **a, int n, int m, enum mem_category category);
+
+size_t bitmap_block_size(int n, int m);
+
+uint64_t **map_bitmap(int fd, off_t offset, int n, int m);
+
+void free_bitmap(uint64_t **a);
+
+enum load_status b_bits_load(FILE *file, uint64_t **a, int n, int m);
+
+void t_bits_load(FILE *file, uint64_t **a, int n, int m);
+
+void b_bits_encode_row(uint64_t *row, int m, unsigned char *buffer);
+
+bool b_bits_print(FILE *file, uint64_t **a, int n, int m);
+
+void t_bits_print(FILE *file, uint64_t **a, int n, int m);
+
+uint64_t **crop_bitmap(uint64_t **a, int x1, int y1, int x2, int y2);
+
+void paste_bitmap(uint64_t **dst, int dst_m, uint64_t **src,
+				  int x1, int y1, int n, int m);
+
+void fill_bitmap(uint64_t **a, int x1, int y1, int x2, int y2, int bit);
+
+void invert_bitmap(uint64_t **a, int x1, int y1, int x2, int y2);
+
+void blend_bitmap(uint64_t **a, uint64_t **src, int x1, int y1, int x2, int y2);
+
+uint64_t **rotate_bitmap_90(uint64_t **a, int n, int m);
+
+uint64_t **rotate_bitmap_180(uint64_t **a, int n, int m);
+
+uint64_t **rotate_bitmap_270(uint64_t **a, int n, int m);
+
+double **unpack_bitmap(uint64_t **a, int n, int m, enum mem_category category);
+
+void pack_bitmap_row(double *a, uint64_t *bits, int m);
+
+void pack_bitmap(double **a, uint64_t **bits, int n, int m);
+
+#endif /* BITMAP_UTTILS_ */
@@ -0,0 +1,310 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "cache_utils.h"
+#include "memory_utils.h"
+#include "utils.h"
+
+//  most files remembered, decoded or not
+#define CACHE_MAX_ENTRIES 256
+
+//  decoded image kept for later LOADs of the same, unchanged file
+typedef struct cache_entry {
+	char *path;
+	//  file's identity when it was decoded
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	//  decoded copy of the image, NULL if the file was loaded only once
+	my_image *image;
+	//  bytes used by the copy's pixels
+	size_t bytes;
+	//  neighbours in the LRU list (head is the most recently used)
+	struct cache_entry *prev;
+	struct cache_entry *next;
+} cache_entry;
+
+//  most and least recently used entries
+static cache_entry *head;
+static cache_entry *tail;
+
+//  bytes used by all entries
+static size_t used;
+
+//  number of entries
+static int entries;
+
+//  max bytes used by all entries (0 disables the cache)
+static size_t budget = CACHE_DEFAULT_BUDGET;
+
+//  LOADs may run on the I/O thread and on the editor at the same time
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_once_t registered = PTHREAD_ONCE_INIT;
+
+//  bytes used by an image's pixels
+static size_t image_bytes(my_image *image)
+{
+	size_t channels = image->img_type == COLOR ? 3 : 1;
+
+	//  black & white images are packed 64 pixels per word
+	if (image->img_type == BLACK_WHITE)
+		return image->height * ((image->width + 63) / 64) * sizeof(uint64_t);
+
+	return channels * image->height * image->width * sizeof(double);
+}
+
+//  takes an entry out of the LRU list
+static void unlink_entry(cache_entry *entry)
+{
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		head = entry->next;
+
+	if (entry->next)
+		entry->next->prev = entry->prev;
+	else
+		tail = entry->prev;
+
+	entry->prev = NULL;
+	entry->next = NULL;
+}
+
+//  puts an entry in front of the LRU list
+static void push_front(cache_entry *entry)
+{
+	entry->prev = NULL;
+	entry->next = head;
+
+	if (head)
+		head->prev = entry;
+	else
+		tail = entry;
+
+	head = entry;
+}
+
+//  removes an entry and frees its image
+static void drop_entry(cache_entry *entry)
+{
+	unlink_entry(entry);
+	used -= entry->bytes;
+	entries--;
+
+	if (entry->image) {
+		free_image_data(entry->image);
+		free(entry->image);
+	}
+	free(entry->path);
+	free(entry);
+}
+
+//  evicts the least recently used entries until at most keep bytes are used
+static void evict(size_t keep)
+{
+	while (tail && (used > keep || entries > CACHE_MAX_ENTRIES))
+		drop_entry(tail);
+}
+
+//  evicts the least recently used images to give their memory to an
+//  allocation over the limit (see mem_set_reclaimer), returns the bytes
+//  freed; a LOAD copying a cached image holds the lock, nothing is evicted
+//  then and the LOAD decodes the file instead
+static size_t reclaim(size_t bytes)
+{
+	size_t freed = 0;
+
+	if (pthread_mutex_trylock(&lock))
+		return 0;
+
+	cache_entry *entry = tail;
+	while (entry && freed < bytes) {
+		cache_entry *prev = entry->prev;
+
+		//  files loaded once hold no memory
+		if (entry->image) {
+			freed += entry->bytes;
+			drop_entry(entry);
+		}
+
+		entry = prev;
+	}
+
+	pthread_mutex_unlock(&lock);
+
+	return freed;
+}
+
+//  lets the memory layer evict images once there are any
+static void register_reclaimer(void)
+{
+	mem_set_reclaimer(reclaim);
+}
+
+//  finds the entry of a file
+static cache_entry *find_entry(char *path)
+{
+	for (cache_entry *entry = head; entry; entry = entry->next)
+		if (!strcmp(entry->path, path))
+			return entry;
+
+	return NULL;
+}
+
+//  checks if an entry was decoded from the file in its current state
+static bool is_fresh(cache_entry *entry, struct stat *st)
+{
+	return entry->dev == st->st_dev && entry->ino == st->st_ino &&
+		   entry->size == st->st_size &&
+		   entry->mtime.tv_sec == st->st_mtim.tv_sec &&
+		   entry->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+//  copies the cached image of an unchanged file in image
+static bool lookup(char *path, struct stat *st, my_image *image)
+{
+	pthread_mutex_lock(&lock);
+
+	cache_entry *entry = find_entry(path);
+
+	//  file changed since it was cached
+	if (entry && !is_fresh(entry, st)) {
+		drop_entry(entry);
+		entry = NULL;
+	}
+
+	my_image *copy = NULL;
+	if (entry && entry->image) {
+		unlink_entry(entry);
+		push_front(entry);
+		copy = copy_image(entry->image, MEM_PLANES);
+	}
+
+	pthread_mutex_unlock(&lock);
+
+	if (!copy)
+		return false;
+
+	move_image_data(image, copy);
+	free(copy);
+
+	return true;
+}
+
+//  puts a new entry for a file in front of the list (lock held), replacing
+//  the old one
+static void add_entry(char *path, struct stat *st, my_image *copy,
+					  size_t bytes)
+{
+	cache_entry *entry = malloc(sizeof(cache_entry));
+	DIE(!entry, "malloc entry");
+
+	entry->path = strdup(path);
+	DIE(!entry->path, "strdup path");
+	entry->dev = st->st_dev;
+	entry->ino = st->st_ino;
+	entry->size = st->st_size;
+	entry->mtime = st->st_mtim;
+	entry->image = copy;
+	entry->bytes = bytes;
+
+	//  another LOAD of the same file may have been faster
+	cache_entry *old = find_entry(path);
+	if (old)
+		drop_entry(old);
+
+	push_front(entry);
+	used += bytes;
+	entries++;
+	evict(budget);
+}
+
+//  keeps a copy of a decoded image for later LOADs of the same file; the
+//  first LOAD of a file only remembers it, files loaded once never pay for
+//  the copy
+static void insert(char *path, struct stat *st, my_image *image)
+{
+	size_t bytes = image_bytes(image);
+
+	//  image would evict everything else, don't cache it
+	if (bytes > budget / 2)
+		return;
+
+	pthread_mutex_lock(&lock);
+
+	cache_entry *seen = find_entry(path);
+	if (!seen || !is_fresh(seen, st)) {
+		add_entry(path, st, NULL, 0);
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+
+	pthread_mutex_unlock(&lock);
+
+	pthread_once(&registered, register_reclaimer);
+
+	my_image *copy = copy_image(image, MEM_CACHE);
+	if (!copy)
+		return;
+
+	pthread_mutex_lock(&lock);
+	add_entry(path, st, copy, bytes);
+	pthread_mutex_unlock(&lock);
+}
+
+//  loads an image file, reusing the decoded image if the file didn't change
+enum load_status cache_load(char *path, my_image *image)
+{
+	FILE *file = fopen(path, "r+");
+	if (!file)
+		return LOAD_NO_FILE;
+
+	struct stat st;
+	bool known = budget && !fstat(fileno(file), &st);
+
+	//  same file decoded before => copy it
+	if (known && lookup(path, &st, image)) {
+		fclose(file);
+		return LOAD_OK;
+	}
+
+	enum load_status status = load_image(file, image);
+	fclose(file);
+
+	if (status != LOAD_OK)
+		return status;
+
+	if (known)
+		insert(path, &st, image);
+
+	return LOAD_OK;
+}
+
+//  forgets the decoded image of a file that is being rewritten
+void cache_invalidate(char *path)
+{
+	pthread_mutex_lock(&lock);
+
+	cache_entry *entry = find_entry(path);
+	if (entry)
+		drop_entry(entry);
+
+	pthread_mutex_unlock(&lock);
+}
+
+//  sets the max number of bytes used by cached images (0 disables the cache)
+void cache_set_budget(size_t bytes)
+{
+	pthread_mutex_lock(&lock);
+
+	budget = bytes;
+	evict(bytes);
+
+	pthread_mutex_unlock(&lock);
+}
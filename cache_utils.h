@@ -0,0 +1,15 @@
+#ifndef CACHE_UTTILS_
+#define CACHE_UTTILS_
+
+#include <stddef.h>
+#include "image_utils.h"
+
+#define CACHE_DEFAULT_BUDGET (256UL << 20)
+
+enum load_status cache_load(char *path, my_image *image);
+
+void cache_invalidate(char *path);
+
+void cache_set_budget(size_t bytes);
+
+#endif /* CACHE_UTTILS_ */
@@ -1,9 +1,34 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <math.h>
 #include "editor_utils.h"
 #include "matrix_utils.h"
+#include "bitmap_utils.h"
+#include "memory_utils.h"
+#include "pipeline_utils.h"
+#include "writer_utils.h"
+#include "cache_utils.h"
+#include "slot_utils.h"
+#include "rotate_utils.h"
+#include "resize_utils.h"
+#include "pyramid_utils.h"
+#include "histogram_utils.h"
+#include "point_utils.h"
+#include "median_utils.h"
+#include "bilateral_utils.h"
+#include "kernel_utils.h"
+#include "morph_utils.h"
+#include "label_utils.h"
+#include "qoi_utils.h"
+#include "snapshot_utils.h"
+#include "patch_utils.h"
+#include "session_utils.h"
+#include "optimize_utils.h"
+#include "numa_utils.h"
+#include "worker_utils.h"
 #include "utils.h"
 
 //  checks if there is only one argument in the given string
@@ -84,13 +109,13 @@ bool args_are_4_integers(char *args)
 	if (!args)
 		return false;
 
-	char *n1, *n2, *n3, *n4;
+	char *n1, *n2, *n3, *n4, *save;
 
 	//  parse string into 4 strings
-	n1 = strtok(args, " ");
-	n2 = strtok(NULL, " ");
-	n3 = strtok(NULL, " ");
-	n4 = strtok(NULL, "\n");
+	n1 = strtok_r(args, " ", &save);
+	n2 = strtok_r(NULL, " ", &save);
+	n3 = strtok_r(NULL, " ", &save);
+	n4 = strtok_r(NULL, "\n", &save);
 
 	//  less arguments than required
 	if (!n2 || !n3 || !n4)
@@ -108,45 +133,155 @@ bool args_are_4_integers(char *args)
 	return true;
 }
 
-//  loads an image from a given file
-void editor_load(my_image *image, char *args)
+//  uses the image the I/O thread decoded ahead of the LOAD command,
+//  returns false if it couldn't and the file has to be loaded now
+bool load_prefetched(my_image *image, char *file_name, prefetch *load)
 {
-	//  more than one argument
-	if (!arg_is_one_word(args)) {
-		printf("Invalid command\n");
+	enum prefetch_state state = prefetch_wait(load);
+
+	//  given filename doesn't exist or isn't a valid image
+	if (state == PREFETCH_NO_FILE) {
+		reply("Failed to load %s\n", file_name);
+
+		//  free previous image
+		free_image_data(image);
+		init_image_data(image);
+	}
+
+	//  replace the previous image with the decoded one
+	if (state == PREFETCH_LOADED) {
+		move_image_data(image, load->image);
+		free(load->image);
+		load->image = NULL;
+
+		reply("Loaded %s\n", file_name);
+	}
+
+	prefetch_release(load);
+
+	return state != PREFETCH_FAILED;
+}
+
+//  commands matched by the start of their name, in order (no name of a
+//  point or morphological operation starts with one of them)
+static const struct {
+	const char *name;
+	enum command_kind kind;
+} prefixes[] = {
+	{"LOAD", COMMAND_LOAD},
+	{"USE", COMMAND_USE},
+	{"SELECT", COMMAND_SELECT},
+	{"ROTATE", COMMAND_ROTATE},
+	{"CROP", COMMAND_CROP},
+	{"RESIZE", COMMAND_RESIZE},
+	{"APPLY", COMMAND_APPLY},
+	{"HISTOGRAM", COMMAND_HISTOGRAM},
+	{"EQUALIZE", COMMAND_EQUALIZE},
+	{"LABEL", COMMAND_LABEL},
+	{"SAVE", COMMAND_SAVE},
+	{"SNAPSHOT", COMMAND_SNAPSHOT},
+	{"RESTORE", COMMAND_RESTORE},
+	{"THUMBNAIL", COMMAND_THUMBNAIL},
+	{"MEMORY", COMMAND_MEMORY},
+	{"EXIT", COMMAND_EXIT},
+};
+
+//  gets the command a line starting with the given word runs
+enum command_kind get_command_kind(char *command)
+{
+	enum point_op op;
+	enum morph_op morph;
+
+	if (get_point_op(command, &op))
+		return COMMAND_POINT_OP;
+
+	if (get_morph_op(command, &morph))
+		return COMMAND_MORPH;
+
+	for (int i = 0; i < (int)(sizeof(prefixes) / sizeof(prefixes[0])); ++i)
+		if (!strncmp(command, prefixes[i].name, strlen(prefixes[i].name)))
+			return prefixes[i].kind;
+
+	return COMMAND_UNKNOWN;
+}
+
+//  loads an image from a given file (LOAD [<slot>] <file>),
+//  load is the background read of the file, if any
+void editor_load(my_image *image, char *args, prefetch *load)
+{
+	//  no arguments
+	if (!args) {
+		reply("Invalid command\n");
+		return;
+	}
+
+	char *save;
+	char *file_name = strtok_r(args, " ", &save);
+	char *slot_file = strtok_r(NULL, " ", &save);
+
+	//  more than two arguments
+	if (strtok_r(NULL, " ", &save)) {
+		reply("Invalid command\n");
 		return;
 	}
 
-	//  open file
-	FILE * file = fopen(args, "r+");
+	//  load in a named slot and work on it from now on
+	if (slot_file) {
+		image = slot_use(file_name, true);
+		file_name = slot_file;
+	}
 
-	//  given filename doesn't exist
-	if (!file) {
-		//  can't load image
-		printf("Failed to load %s\n", args);
+	//  image was already read by the I/O thread
+	if (load && load_prefetched(image, file_name, load))
+		return;
 
-		//  free previous image
-		free_image_data(image);
+	//  an earlier SAVE may still be writing this file
+	writer_wait_path(file_name);
 
-		//  initialize data for a potential upcoming image
+	//  free previous image, the new one replaces it even if loading fails
+	free_image_data(image);
+	init_image_data(image);
+
+	//  load new image, possibly from the decoded image cache
+	enum load_status status = cache_load(file_name, image);
+
+	//  given filename doesn't exist or isn't a valid image
+	if (status == LOAD_NO_FILE) {
+		reply("Failed to load %s\n", file_name);
+
+		//  drop the partially read image
+		free_image_data(image);
 		init_image_data(image);
 		return;
 	}
 
-	//  there is an image already loaded
-	if (!is_empty(image)) {
-		//  free previous image's data
+	if (status == LOAD_NO_MEMORY) {
+		reply("Memory limit exceeded\n");
+
+		//  drop the partially loaded image
 		free_image_data(image);
 		init_image_data(image);
+		return;
 	}
 
-	//  load new image
-	load_image(file, image);
+	reply("Loaded %s\n", file_name);
+}
+
+//  makes a named image slot the one commands work on
+void editor_use(char *args)
+{
+	//  slot name must be one word
+	if (!arg_is_one_word(args)) {
+		reply("Invalid command\n");
+		return;
+	}
 
-	printf("Loaded %s\n", args);
+	if (!slot_use(args, false)) {
+		reply("No image slot %s\n", args);
+		return;
+	}
 
-	//  close file
-	fclose(file);
+	reply("Using %s\n", args);
 }
 
 //  selects the entire current loaded image
@@ -154,14 +289,14 @@ void editor_select_all(my_image *image)
 {
 	//  no image is loaded
 	if (is_empty(image)) {
-		printf("No image loaded\n");
+		reply("No image loaded\n");
 		return;
 	}
 
 	//  select all image
 	set_selection(image->select, 0, 0, image->width, image->height);
 
-	printf("Selected ALL\n");
+	reply("Selected ALL\n");
 }
 
 //  selects a section of the current loaded image
@@ -169,58 +304,62 @@ void editor_select(my_image *image, char *args)
 {
 	//  no image is loaded
 	if (is_empty(image)) {
-		printf("No image loaded\n");
+		reply("No image loaded\n");
 		return;
 	}
 
 	//  select command has no arguments
 	if (!args) {
-		printf("Invalid command\n");
+		reply("Invalid command\n");
 		return;
 	}
 
 	//  make copy of given arguments
-	char *args_copy = malloc(strlen(args) + 1);
-	DIE(!args_copy, "malloc args_copy");
+	char *args_copy = mem_alloc(strlen(args) + 1, MEM_IO);
+	if (!args_copy) {
+		reply("Memory limit exceeded\n");
+		return;
+	}
 
 	memcpy(args_copy, args, strlen(args) + 1);
 
 	//  check if given arguments meet the specified conditions
 	if (!args_are_4_integers(args)) {
-		printf("Invalid command\n");
-		free(args_copy);
+		reply("Invalid command\n");
+		mem_free(args_copy);
 		return;
 	}
 
 	//  check if the given arguments are negative numbers
 	if (args_are_negative(args)) {
-		printf("Invalid set of coordinates\n");
-		free(args_copy);
+		reply("Invalid set of coordinates\n");
+		mem_free(args_copy);
 		return;
 	}
 
 	//  arguments are 4 pozitive integers
 	//  get selection
 	int x1, y1, x2, y2;
-	x1 = atoi(strtok(args_copy, " "));
-	y1 = atoi(strtok(NULL, " "));
-	x2 = atoi(strtok(NULL, " "));
-	y2 = atoi(strtok(NULL, "\n"));
+	char *save;
+	x1 = atoi(strtok_r(args_copy, " ", &save));
+	y1 = atoi(strtok_r(NULL, " ", &save));
+	x2 = atoi(strtok_r(NULL, " ", &save));
+	y2 = atoi(strtok_r(NULL, "\n", &save));
 
 	//  free allocated memory for string copy
-	free(args_copy);
+	mem_free(args_copy);
 
 	//  check if given selection is valid
 	if (invalid_selection(image, x1, y1, x2, y2)) {
-		printf("Invalid set of coordinates\n");
+		reply("Invalid set of coordinates\n");
 		return;
 	}
 
 	//  store new image selection
 	set_selection(image->select, x1, y1, x2, y2);
 
-	printf("Selected %d %d ", image->select->x1, image->select->y1);
-	printf("%d %d\n", image->select->x2, image->select->y2);
+	reply("Selected %d %d ", image->select->x1, image->select->y1);
+	reply("%d %d\n", image->select->x2, image->select->y2);
 }
 
 //  checks if the entire image is selected
@@ -266,60 +405,120 @@ bool angle_is_unsupported(int ang)
 	return false;
 }
 
+//  tells the image's pyramid and the record of its last SAVE which pixels
+//  a command changed: the region, or every pixel (the size may have
+//  changed too)
+void mark_changed(my_image *image, my_select *region, bool entire)
+{
+	if (entire) {
+		invalidate_pyramid(image);
+		forget_save(image);
+	} else {
+		mark_dirty(image, region->x1, region->y1, region->x2, region->y2);
+		mark_rows_changed(image, region->y1, region->y2);
+	}
+}
+
+//  rotates the selection (or the entire image) by an angle that is not a
+//  multiple of 90, returns false if memory is exhausted
+bool rotate_angle(my_image *image, double angle, enum interpolation method)
+{
+	if (is_selected_all(image))
+		return rotate_entire_image_angle(image, angle, method);
+
+	return rotate_image_selection_angle(image, angle, method);
+}
+
 //  rotates the current loaded image
-void editor_rotate(my_image *image, char *args)
+void editor_rotate(my_image *image, char *args, script_step *step)
 {
 	//  no image is loaded
 	if (is_empty(image)) {
-		printf("No image loaded\n");
+		reply("No image loaded\n");
 		return;
 	}
 
 	//  rotate command has no arguments
 	if (!args) {
-		printf("Invalid command\n");
+		reply("Invalid command\n");
 		return;
 	}
 
 	//  copy the given argument
-	char *rotation = malloc(strlen(args) + 1);
-	DIE(!rotation, "malloc rotation");
+	char *rotation = mem_alloc(strlen(args) + 1, MEM_IO);
+	if (!rotation) {
+		reply("Memory limit exceeded\n");
+		return;
+	}
 
 	memcpy(rotation, args, strlen(args) + 1);
 
-	//  get sign
-	char sign;
+	char *save;
+	//  get the angle and the optional interpolation method
+	char *str_angle = strtok_r(args, " ", &save);
+	char *str_method = strtok_r(NULL, " ", &save);
+	enum interpolation method = BILINEAR;
+	double angle;
+
+	//  check if the angle is a number and the method is known
+	if (!str_angle || !parse_decimal(str_angle, &angle) ||
+		(str_method && !get_interpolation(str_method, &method)) ||
+		strtok_r(NULL, " ", &save)) {
+		reply("Invalid command\n");
+		mem_free(rotation);
+		return;
+	}
 
-	//  given argument contains "-" sign
-	if (args_are_negative(args)) {
-		//  set sign
-		sign = '-';
-		//  point to the start of the number
-		args++;
-	} else {
-		//  sign is plus
-		//  set sign
-		sign = '+';
+	//  angle is out of range
+	if (fabs(angle) > 360) {
+		reply("Unsupported rotation angle\n");
+		mem_free(rotation);
+		return;
+	}
+
+	//  the first ROTATE of the run already turned the entire image
+	if (step && step->leader && step->leader->turned) {
+		reply("Rotated %s\n", rotation);
+		mem_free(rotation);
+		return;
 	}
 
-	//  get string value of the given angle
-	char *str_angle = strtok(args, "\n");
+	//  pixels changed by the rotation
+	my_select region = *image->select;
+	bool entire = is_selected_all(image);
+
+	//  multiples of 90 degrees move pixels exactly, any other angle
+	//  resamples the image
+	if (angle != (int)angle || angle_is_unsupported(abs((int)angle))) {
+		if (!rotate_angle(image, angle, method)) {
+			reply("Memory limit exceeded\n");
+		} else {
+			mark_changed(image, &region, entire);
+			reply("Rotated %s\n", rotation);
+		}
 
-	//  check if string value of angle meets conditions
-	//  check if string represents a number
-	if (not_a_num(str_angle)) {
-		printf("Invalid command\n");
-		free(rotation);
+		mem_free(rotation);
 		return;
 	}
 
-	//  get integer value of the rotation angle
-	int angle = atoi(str_angle);
+	//  get sign and integer value of the rotation angle
+	char sign = angle < 0 ? '-' : '+';
+	int right_angle = abs((int)angle);
+
+	//  turn the entire image by the angles of the whole run at once
+	if (step && step->turn >= 0 && entire) {
+		if (step->turn && !rotate_entire_image(image, '+', step->turn)) {
+			reply("Memory limit exceeded\n");
+			mem_free(rotation);
+			return;
+		}
+
+		if (step->turn)
+			mark_changed(image, &region, entire);
 
-	//  angle is not a specified value
-	if (angle_is_unsupported(angle)) {
-		printf("Unsupported rotation angle\n");
-		free(rotation);
+		step->turned = true;
+		reply("Rotated %s\n", rotation);
+		mem_free(rotation);
 		return;
 	}
 
@@ -327,23 +526,30 @@ void editor_rotate(my_image *image, char *args)
 	if (!is_selected_all(image)) {
 		//  selection is not square
 		if (!selection_is_square(image)) {
-			printf("The selection must be square\n");
-			free(rotation);
+			reply("The selection must be square\n");
+			mem_free(rotation);
 			return;
 		}
 
 		//  rotate selection of the image
-		rotate_image_selection(image, sign, angle);
+		if (!rotate_image_selection(image, sign, right_angle)) {
+			reply("Memory limit exceeded\n");
+			mem_free(rotation);
+			return;
+		}
 
-	} else {
-		//  rotate the entire image
-		rotate_entire_image(image, sign, angle);
+	} else if (!rotate_entire_image(image, sign, right_angle)) {
+		//  not enough memory to rotate the entire image
+		reply("Memory limit exceeded\n");
+		mem_free(rotation);
+		return;
 	}
 
-	printf("Rotated %s\n", rotation);
+	mark_changed(image, &region, entire);
+	reply("Rotated %s\n", rotation);
 
 	//  free allocated memory for string
-	free(rotation);
+	mem_free(rotation);
 }
 
 //  crops the current loaded image
@@ -351,136 +557,813 @@ void editor_crop(my_image *image, char *args)
 {
 	//  no image is loaded
 	if (is_empty(image)) {
-		printf("No image loaded\n");
+		reply("No image loaded\n");
 		return;
 	}
 
 	// crop command has arguments
 	if (args) {
-		printf("Invalid command\n");
+		reply("Invalid command\n");
 		return;
 	}
 
 	//  entire image is selected => no need to crop
 	if (is_selected_all(image)) {
-		printf("Image cropped\n");
+		reply("Image cropped\n");
 		return;
 	}
 
 	// crop image
-	crop_image(image);
+	if (!crop_image(image)) {
+		reply("Memory limit exceeded\n");
+		return;
+	}
+
+	mark_changed(image, NULL, true);
+
+	reply("Image cropped\n");
+}
+
+//  resizes the current loaded image
+void editor_resize(my_image *image, char *args)
+{
+	//  no image is loaded
+	if (is_empty(image)) {
+		reply("No image loaded\n");
+		return;
+	}
+
+	//  resize command has no arguments
+	if (!args) {
+		reply("Invalid command\n");
+		return;
+	}
+
+	char *save;
+	//  get the new dimensions and the optional filter
+	char *str_width = strtok_r(args, " ", &save);
+	char *str_height = strtok_r(NULL, " ", &save);
+	char *str_filter = strtok_r(NULL, " ", &save);
+	enum resize_filter filter = TRIANGLE;
+
+	if (!str_width || !str_height || not_a_num(str_width) ||
+		not_a_num(str_height) || strtok_r(NULL, " ", &save) ||
+		(str_filter && !get_resize_filter(str_filter, &filter))) {
+		reply("Invalid command\n");
+		return;
+	}
+
+	int width = atoi(str_width);
+	int height = atoi(str_height);
+
+	//  the image can't be empty
+	if (width <= 0 || height <= 0) {
+		reply("Invalid command\n");
+		return;
+	}
+
+	//  resize image
+	if (!resize_image(image, width, height, filter)) {
+		reply("Memory limit exceeded\n");
+		return;
+	}
 
-	printf("Image cropped\n");
+	mark_changed(image, NULL, true);
+
+	reply("Resized %d %d\n", width, height);
 }
 
 //  checks if the given filter is invalid
 bool apply_filter_is_invalid(char *args)
 {
-	if (!strncmp(args, "EDGE", sizeof("EDGE") - 1))
+	if (find_fixed_kernel(args))
 		return false;
 
-	if (!strncmp(args, "SHARPEN", sizeof("SHARPEN") - 1))
+	int radius;
+	if (get_median_radius(args, &radius))
 		return false;
 
-	if (!strncmp(args, "BLUR", sizeof("BLUR") - 1))
+	double sigma_s, sigma_r;
+	if (get_bilateral_params(args, &sigma_s, &sigma_r))
 		return false;
 
-	if (!strncmp(args, "GAUSSIAN_BLUR", sizeof("GAUSSIAN_BLUR") - 1))
+	return true;
+}
+
+//  checks if the given filter only works on color images
+bool apply_filter_needs_color(char *args)
+{
+	//  the median filter works on every kind of image
+	if (!strncmp(args, "MEDIAN", sizeof("MEDIAN") - 1))
+		return false;
+
+	//  the bilateral filter works on grayscale images too
+	if (!strncmp(args, "BILATERAL", sizeof("BILATERAL") - 1))
 		return false;
 
 	return true;
 }
 
-void editor_apply(my_image *image, char *args)
+//  checks if the given filter needs pixels with more than 2 values
+bool apply_filter_needs_levels(char *args)
+{
+	return !strncmp(args, "BILATERAL", sizeof("BILATERAL") - 1);
+}
+
+void editor_apply(my_image *image, char *args, script_step *step)
 {
 	//  no image is loaded
 	if (is_empty(image)) {
-		printf("No image loaded\n");
+		reply("No image loaded\n");
 		return;
 	}
 
 	//  no paramter given
 	if (!args) {
-		printf("Invalid command\n");
+		reply("Invalid command\n");
 		return;
 	}
 
 	//  given filter is invalid
 	if (apply_filter_is_invalid(args)) {
-		printf("APPLY parameter invalid\n");
+		reply("APPLY parameter invalid\n");
 		return;
 	}
 
-	if (image->img_type == GRAYSCALE) {
-		printf("Easy, Charlie Chaplin\n");
+	//  the 3x3 filters are only applied on color images
+	if (apply_filter_needs_color(args) &&
+		(image->img_type == GRAYSCALE || image->img_type == BLACK_WHITE)) {
+		reply("Easy, Charlie Chaplin\n");
 		return;
 	}
 
-	//  aplly filter
-	apply(image, args);
+	//  black & white pixels have no levels to blur between
+	if (apply_filter_needs_levels(args) && image->img_type == BLACK_WHITE) {
+		reply("Black and white image not supported\n");
+		return;
+	}
+
+	//  aplly filter, unless the pixels are never read
+	if (!(step && step->dead) && !apply(image, args)) {
+		reply("Memory limit exceeded\n");
+		return;
+	}
+
+	mark_changed(image, image->select, false);
+
+	reply("APPLY %s done\n", args);
+}
+
+//  gets a file ready to be written by a command: an earlier SAVE may
+//  still be writing it, and its patch record won't describe it anymore
+static void prepare_output(char *path)
+{
+	writer_wait_path(path);
+	release_path(path);
+}
+
+//  the command is done writing the file, its decoded image can't be
+//  reused; replies and returns false if it wasn't written
+static bool finish_output(char *path, bool written)
+{
+	cache_invalidate(path);
+
+	if (!written)
+		reply("Failed to save %s\n", path);
 
-	printf("APPLY %s done\n", args);
+	return written;
+}
+
+//  opens a file written by a command, replies and returns NULL if it
+//  can't be opened
+static FILE *open_command_output(char *path, const char *mode)
+{
+	prepare_output(path);
+
+	FILE *output = open_output(path, mode);
+	if (!output)
+		reply("Failed to save %s\n", path);
+
+	return output;
+}
+
+//  closes a file opened by open_command_output, replies and returns
+//  false if it couldn't be written
+static bool close_command_output(FILE *output, char *path)
+{
+	bool written = !ferror(output);
+
+	if (fclose(output))
+		written = false;
+
+	return finish_output(path, written);
+}
+
+//  prints the histogram of the selection, or writes it to a file
+//  (HISTOGRAM [<bins>] [<file>])
+void editor_histogram(my_image *image, char *args)
+{
+	//  no image is loaded
+	if (is_empty(image)) {
+		reply("No image loaded\n");
+		return;
+	}
+
+	char *save;
+	char *str_bins = args ? strtok_r(args, " ", &save) : NULL;
+	char *file_name = str_bins ? strtok_r(NULL, " ", &save) : NULL;
+	int size = image->pixel_value + 1;
+	int bins = size < 256 ? size : 256;
+
+	//  the number of bins is optional
+	if (str_bins && not_a_num(str_bins)) {
+		file_name = str_bins;
+		str_bins = NULL;
+	}
+
+	if (str_bins)
+		bins = atoi(str_bins);
+
+	//  too many arguments, or more bins than values
+	if ((file_name && strtok_r(NULL, " ", &save)) || bins <= 0 || bins > size) {
+		reply("Invalid command\n");
+		return;
+	}
+
+	histogram h;
+	if (!compute_histogram(image, &h)) {
+		reply("Memory limit exceeded\n");
+		return;
+	}
+
+	if (!file_name) {
+		print_histogram(session_output(), image, &h, bins);
+		free_histogram(&h);
+		return;
+	}
+
+	FILE *output = open_command_output(file_name, "w");
+	if (!output) {
+		free_histogram(&h);
+		return;
+	}
+
+	print_histogram(output, image, &h, bins);
+	free_histogram(&h);
+
+	if (!close_command_output(output, file_name))
+		return;
+
+	reply("Saved histogram %s\n", file_name);
+}
+
+//  equalizes the histogram of the selection
+void editor_equalize(my_image *image, char *args, script_step *step)
+{
+	//  no image is loaded
+	if (is_empty(image)) {
+		reply("No image loaded\n");
+		return;
+	}
+
+	//  equalize command has no arguments
+	if (args) {
+		reply("Invalid command\n");
+		return;
+	}
+
+	//  black & white pixels have no levels to spread
+	if (image->img_type == BLACK_WHITE) {
+		reply("Black and white image not supported\n");
+		return;
+	}
+
+	if (!(step && step->dead) && !equalize(image)) {
+		reply("Memory limit exceeded\n");
+		return;
+	}
+
+	mark_changed(image, image->select, false);
+	reply("Equalize done\n");
+}
+
+//  composes a point operation (BRIGHTNESS, CONTRAST, GAMMA, LEVELS, INVERT,
+//  THRESHOLD) with the ones waiting to be applied to the selection
+void editor_point_op(my_image *image, char *command, char *args,
+					 script_step *step)
+{
+	//  no image is loaded
+	if (is_empty(image)) {
+		reply("No image loaded\n");
+		return;
+	}
+
+	enum point_op op;
+	double params[4];
+	int count = 0;
+	bool valid = get_point_op(command, &op);
+
+	//  copy the arguments to report them
+	char *given = mem_alloc(args ? strlen(args) + 1 : 1, MEM_IO);
+	if (!given) {
+		reply("Memory limit exceeded\n");
+		return;
+	}
+	strcpy(given, args ? args : "");
+
+	char *save;
+	//  get up to 4 numbers
+	for (char *s = args ? strtok_r(args, " ", &save) : NULL; s && valid;
+		 s = strtok_r(NULL, " ", &save))
+		valid = count < 4 && parse_decimal(s, &params[count++]);
+
+	if (!valid || point_params_are_invalid(op, params, count)) {
+		reply("Invalid command\n");
+		mem_free(given);
+		return;
+	}
+
+	if (!(step && step->dead) && !add_point_op(image, op, params, count)) {
+		reply("Memory limit exceeded\n");
+		mem_free(given);
+		return;
+	}
+
+	if (count)
+		reply("%s %s done\n", point_op_name(op), given);
+	else
+		reply("%s done\n", point_op_name(op));
+
+	mem_free(given);
+}
+
+//  erodes, dilates, opens or closes the selection with a rectangle
+//  (ERODE / DILATE / OPEN / CLOSE <width> <height>)
+void editor_morph(my_image *image, char *command, char *args,
+				  script_step *step)
+{
+	//  no image is loaded
+	if (is_empty(image)) {
+		reply("No image loaded\n");
+		return;
+	}
+
+	//  the size of the rectangle is needed
+	if (!args) {
+		reply("Invalid command\n");
+		return;
+	}
+
+	enum morph_op op;
+	char *save;
+	char *str_width = strtok_r(args, " ", &save);
+	char *str_height = strtok_r(NULL, " ", &save);
+
+	if (!get_morph_op(command, &op) || !str_width || !str_height ||
+		not_a_num(str_width) || not_a_num(str_height) ||
+		strtok_r(NULL, " ", &save)) {
+		reply("Invalid command\n");
+		return;
+	}
+
+	int width = atoi(str_width);
+	int height = atoi(str_height);
+
+	if (width <= 0 || height <= 0) {
+		reply("Invalid command\n");
+		return;
+	}
+
+	if (!(step && step->dead) && !morph_image(image, op, width, height)) {
+		reply("Memory limit exceeded\n");
+		return;
+	}
+
+	mark_changed(image, image->select, false);
+
+	reply("%s %d %d done\n", morph_op_name(op), width, height);
+}
+
+//  prints the connected components of the selection of a black & white
+//  image as CSV, or writes them to a file (LABEL [4 | 8] [<file>])
+void editor_label(my_image *image, char *args)
+{
+	//  no image is loaded
+	if (is_empty(image)) {
+		reply("No image loaded\n");
+		return;
+	}
+
+	char *save;
+	char *str_connectivity = args ? strtok_r(args, " ", &save) : NULL;
+	char *file_name = str_connectivity ? strtok_r(NULL, " ", &save) : NULL;
+	int connectivity = 8;
+
+	//  the connectivity is optional
+	if (str_connectivity && not_a_num(str_connectivity)) {
+		file_name = str_connectivity;
+		str_connectivity = NULL;
+	}
+
+	if (str_connectivity)
+		connectivity = atoi(str_connectivity);
+
+	//  too many arguments, or pixels can only touch by edges or corners
+	if ((file_name && strtok_r(NULL, " ", &save)) ||
+		(connectivity != 4 && connectivity != 8)) {
+		reply("Invalid command\n");
+		return;
+	}
+
+	//  components are made of set bits
+	if (image->img_type != BLACK_WHITE) {
+		reply("Only black and white images supported\n");
+		return;
+	}
+
+	components c;
+	if (!label_components(image, connectivity, &c)) {
+		reply("Memory limit exceeded\n");
+		return;
+	}
+
+	if (!file_name) {
+		print_components(session_output(), &c);
+		free_components(&c);
+		return;
+	}
+
+	FILE *output = open_command_output(file_name, "w");
+	if (!output) {
+		free_components(&c);
+		return;
+	}
+
+	print_components(output, &c);
+	free_components(&c);
+
+	if (!close_command_output(output, file_name))
+		return;
+
+	reply("Saved labels %s\n", file_name);
 }
 
 //  saves current loaded image to a specified output file
-void editor_save(my_image *image, char *args)
+void editor_save(my_image *image, char *args, script_step *step)
 {
 	//  no image is loaded
 	if (is_empty(image)) {
-		printf("No image loaded\n");
+		reply("No image loaded\n");
 		return;
 	}
 
+	char *save;
 	//  get given file name
-	char *file_name = strtok(args, " ");
+	char *file_name = args ? strtok_r(args, " ", &save) : NULL;
 
 	//  get file formatv(e.g. ascii)
-	char *format = strtok(NULL, "\n");
+	char *format = file_name ? strtok_r(NULL, "\n", &save) : NULL;
 
-	FILE *output;
+	//  no file name given
+	if (!file_name) {
+		reply("Invalid command\n");
+		return;
+	}
 
-	//  output file fotmat is not specified
-	if (!format) {
-		//  output file is binary
-		output = fopen(file_name, "wb+");
+	//  QOI files are binary only
+	if (format && is_qoi_path(file_name)) {
+		reply("Invalid command\n");
+		return;
+	}
 
-		//  save loaded image
-		save_image_binary(output, image);
+	enum save_format save_format = is_qoi_path(file_name) ? SAVE_QOI :
+								   format ? SAVE_TEXT : SAVE_BINARY;
 
-		//  close file
-		fclose(output);
+	//  an earlier SAVE may still be writing this file
+	writer_wait_path(file_name);
 
-		printf("Saved %s\n", args);
+	//  the file holds the image of its last SAVE, only write the rows
+	//  changed since
+	if (save_format == SAVE_BINARY && patch_save(image, file_name)) {
+		finish_output(file_name, true);
+		step_saved(step, file_name);
+		reply("Saved %s\n", args);
 		return;
 	}
 
-	//  output file is text / ASCII
-	output = fopen(file_name, "w+");
-	DIE(!output, "fopen output");
+	//  output file is binary if the format is not specified, text otherwise
+	FILE *output = open_command_output(file_name, format ? "w+" : "wb+");
+	if (!output)
+		return;
 
-	//  save loaded image
-	save_image_text(output, image);
+	//  record the changes made from now on for the next binary SAVE
+	if (save_format == SAVE_BINARY)
+		track_save(image, output);
 
-	//  close file
-	fclose(output);
+	//  an earlier SAVE of the script wrote the same bytes, copy its file
+	if (step && step->source && step->source->path) {
+		writer_submit_copy(output, file_name, step->source->path);
+		reply("Saved %s\n", args);
+		return;
+	}
 
-	printf("Saved %s\n", args);
+	//  freeze the image and let the writer thread encode it
+	my_image *snapshot = copy_image(image, MEM_IO);
+	if (snapshot) {
+		writer_submit(output, file_name, snapshot, save_format);
+		step_saved(step, file_name);
+		reply("Saved %s\n", args);
+		return;
+	}
+
+	//  not enough memory for a snapshot, save the image now
+	bool saved = save_image(output, image, save_format);
+
+	if (saved && !ferror(output))
+		stamp_save(output);
+
+	//  a write error is reported before a lack of memory
+	if (!close_command_output(output, file_name)) {
+		forget_save(image);
+		return;
+	}
+
+	if (!saved) {
+		forget_save(image);
+		reply("Memory limit exceeded\n");
+		return;
+	}
+
+	step_saved(step, file_name);
+	reply("Saved %s\n", args);
 }
 
-//  frees allocated memory and quits application
-void editor_exit(my_image *image)
+//  saves the current loaded image, its selection included, to a snapshot
+//  file that RESTORE maps back (SNAPSHOT <file>)
+void editor_snapshot(my_image *image, char *args)
 {
 	//  no image is loaded
-	if (is_empty(image))
-		printf("No image loaded\n");
+	if (is_empty(image)) {
+		reply("No image loaded\n");
+		return;
+	}
+
+	//  file name must be one word
+	if (!arg_is_one_word(args)) {
+		reply("Invalid command\n");
+		return;
+	}
+
+	//  the snapshot is written under another name, then renamed
+	prepare_output(args);
+
+	if (!finish_output(args, save_snapshot(args, image)))
+		return;
+
+	reply("Saved snapshot %s\n", args);
+}
+
+//  replaces the current image with the one of a snapshot file
+//  (RESTORE <file>)
+void editor_restore(my_image *image, char *args)
+{
+	//  file name must be one word
+	if (!arg_is_one_word(args)) {
+		reply("Invalid command\n");
+		return;
+	}
 
-	//  free pixel matrix and image selection
+	//  an earlier SAVE may still be writing this file
+	writer_wait_path(args);
+
+	//  free previous image, the restored one replaces it even on failure
 	free_image_data(image);
+	init_image_data(image);
+
+	enum load_status status = restore_snapshot(args, image);
+
+	if (status == LOAD_NO_FILE) {
+		reply("Failed to restore %s\n", args);
+		return;
+	}
+
+	if (status == LOAD_NO_MEMORY) {
+		reply("Memory limit exceeded\n");
+
+		//  drop the partially restored image
+		free_image_data(image);
+		init_image_data(image);
+		return;
+	}
+
+	reply("Restored %s\n", args);
+}
+
+//  saves a small preview of the current loaded image (THUMBNAIL <max> <file>)
+void editor_thumbnail(my_image *image, char *args)
+{
+	//  no image is loaded
+	if (is_empty(image)) {
+		reply("No image loaded\n");
+		return;
+	}
+
+	//  thumbnail command has no arguments
+	if (!args) {
+		reply("Invalid command\n");
+		return;
+	}
+
+	char *save;
+	char *str_max = strtok_r(args, " ", &save);
+	char *file_name = strtok_r(NULL, " ", &save);
+
+	//  the max dimension must be a positive number, followed by a file
+	if (!file_name || strtok_r(NULL, " ", &save) || not_a_num(str_max) ||
+		atoi(str_max) <= 0) {
+		reply("Invalid command\n");
+		return;
+	}
+
+	//  the preview is made first, the file is left alone if it can't be
+	my_image *preview = make_thumbnail(image, atoi(str_max));
+	if (!preview) {
+		reply("Memory limit exceeded\n");
+		return;
+	}
+
+	FILE *output = open_command_output(file_name, "wb");
+	if (!output) {
+		free_image_data(preview);
+		free(preview);
+		return;
+	}
+
+	bool saved = save_image_binary(output, preview);
+
+	free_image_data(preview);
+	free(preview);
+
+	if (!close_command_output(output, file_name))
+		return;
+
+	//  the preview's rows are encoded through a buffer
+	if (!saved) {
+		reply("Memory limit exceeded\n");
+		return;
+	}
+
+	reply("Saved thumbnail %s\n", file_name);
+}
+
+//  reports where the pages of the image's planes are, on machines with
+//  more than one NUMA node
+static void report_numa(my_image *image)
+{
+	size_t remote = 0, total = 0, known;
+	int nodes = numa_nodes();
+
+	if (nodes < 2)
+		return;
+
+	if (!is_empty(image) && image->img_type == BLACK_WHITE) {
+		uint64_t **rows = ((bit_img *)image->img)->rows;
+
+		remote = numa_remote_pages((char *)rows[0], image->height,
+								   sizeof(uint64_t) *
+								   BITMAP_WORDS(image->width), &total);
+	} else if (!is_empty(image)) {
+		double **planes[3];
+		int channels = image_planes(image, planes);
+
+		for (int c = 0; c < channels; ++c) {
+			remote += numa_remote_pages((char *)planes[c][0], image->height,
+										sizeof(double) * image->width,
+										&known);
+			total += known;
+		}
+	}
+
+	reply("numa: nodes %d, remote plane pages %zu of %zu\n", nodes, remote,
+		  total);
+}
+
+//  pins the worker threads to the CPUs of a list like "0-3,8-11", or lets
+//  them run anywhere again (MEMORY PIN OFF)
+static void pin_workers(char *value)
+{
+	int cpus[MAX_CPU_IDS];
+
+	if (!strcmp(value, "OFF")) {
+		workers_pin(NULL, 0);
+		reply("Workers unpinned\n");
+		return;
+	}
+
+	int count = parse_id_list(value, cpus, MAX_CPU_IDS);
+	if (count < 0) {
+		reply("Invalid command\n");
+		return;
+	}
+
+	if (!workers_pin(cpus, count)) {
+		reply("Failed to pin workers to %s\n", value);
+		return;
+	}
+
+	reply("Workers pinned to %s\n", value);
+}
+
+//  reports memory usage or configures the memory layer
+//  (MEMORY [LIMIT <bytes> | POOL <bytes> | CACHE <bytes> | HUGEPAGES ON/OFF |
+//  PIN <cpus>/OFF])
+void editor_memory(my_image *image, char *args)
+{
+	//  no parameter => print the usage report
+	if (!args) {
+		mem_report(session_output());
+		report_numa(image);
+		return;
+	}
+
+	char *save;
+	char *option = strtok_r(args, " ", &save);
+	char *value = strtok_r(NULL, "\n", &save);
+
+	//  every option takes exactly one value
+	if (!arg_is_one_word(value)) {
+		reply("Invalid command\n");
+		return;
+	}
+
+	//  huge page backing of the plane pool
+	if (!strcmp(option, "HUGEPAGES")) {
+		if (strcmp(value, "ON") && strcmp(value, "OFF")) {
+			reply("Invalid command\n");
+			return;
+		}
+
+		mem_set_huge_pages(!strcmp(value, "ON"));
+		reply("Huge pages %s\n", !strcmp(value, "ON") ? "on" : "off");
+		return;
+	}
+
+	//  CPUs of the worker threads
+	if (!strcmp(option, "PIN")) {
+		pin_workers(value);
+		return;
+	}
+
+	//  the remaining options take a number of bytes
+	if (not_a_num(value) || args_are_negative(value)) {
+		reply("Invalid command\n");
+		return;
+	}
+
+	size_t bytes = strtoull(value, NULL, 10);
+
+	//  max number of bytes used by the decoded image cache
+	if (!strcmp(option, "CACHE")) {
+		cache_set_budget(bytes);
+		reply("Image cache budget set to %zu B\n", bytes);
+		return;
+	}
+
+	//  max number of bytes kept by the plane pool
+	if (!strcmp(option, "POOL")) {
+		mem_set_pool_capacity(bytes);
+		reply("Memory pool capacity set to %zu B\n", bytes);
+		return;
+	}
+
+	if (strcmp(option, "LIMIT")) {
+		reply("Invalid command\n");
+		return;
+	}
+
+	mem_set_limit(bytes);
+
+	//  read once, another session may change it in between
+	size_t limit = mem_get_limit();
+
+	if (limit)
+		reply("Memory limit set to %zu B\n", limit);
+	else
+		reply("Memory limit disabled\n");
+}
+
+//  frees the images of the session, the commands after EXIT are ignored
+void editor_exit(my_image *image)
+{
+	//  no image is loaded
+	if (is_empty(image))
+		reply("No image loaded\n");
 
-	//  free image
-	free(image);
+	//  free every image slot (pixel matrix and image selection)
+	slots_free();
 	image = NULL;
 
-	//  exit application
-	exit(0);
+	//  wait for the background SAVEs to reach the disk, the caller ends
+	//  the session
+	writer_wait_all();
 }
@@ -5,19 +5,73 @@
 
 #define MAX_INPUT_LINE_SIZE 100
 
-void editor_load(my_image *image, char *args);
+//  commands, in the order their names are matched
+enum command_kind {
+	COMMAND_POINT_OP = 0,
+	COMMAND_LOAD,
+	COMMAND_USE,
+	COMMAND_SELECT,
+	COMMAND_ROTATE,
+	COMMAND_CROP,
+	COMMAND_RESIZE,
+	COMMAND_APPLY,
+	COMMAND_HISTOGRAM,
+	COMMAND_EQUALIZE,
+	COMMAND_LABEL,
+	COMMAND_MORPH,
+	COMMAND_SAVE,
+	COMMAND_SNAPSHOT,
+	COMMAND_RESTORE,
+	COMMAND_THUMBNAIL,
+	COMMAND_MEMORY,
+	COMMAND_EXIT,
+	COMMAND_UNKNOWN
+};
+
+struct prefetch;
+struct script_step;
+
+enum command_kind get_command_kind(char *command);
+
+bool not_a_num(char *string);
+
+void editor_load(my_image *image, char *args, struct prefetch *load);
+
+void editor_use(char *args);
 
 void editor_select_all(my_image *image);
 
 void editor_select(my_image *image, char *args);
 
-void editor_rotate(my_image *image, char *args);
+void editor_rotate(my_image *image, char *args, struct script_step *step);
 
 void editor_crop(my_image *image, char *args);
 
-void editor_apply(my_image *image, char *args);
+void editor_resize(my_image *image, char *args);
+
+void editor_apply(my_image *image, char *args, struct script_step *step);
+
+void editor_histogram(my_image *image, char *args);
+
+void editor_equalize(my_image *image, char *args, struct script_step *step);
+
+void editor_point_op(my_image *image, char *command, char *args,
+					 struct script_step *step);
+
+void editor_label(my_image *image, char *args);
+
+void editor_morph(my_image *image, char *command, char *args,
+				  struct script_step *step);
+
+void editor_save(my_image *image, char *args, struct script_step *step);
+
+void editor_snapshot(my_image *image, char *args);
+
+void editor_restore(my_image *image, char *args);
+
+void editor_thumbnail(my_image *image, char *args);
 
-void editor_save(my_image *image, char *args);
+void editor_memory(my_image *image, char *args);
 
 void editor_exit(my_image *image);
 
@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <math.h>
+#include "histogram_utils.h"
+#include "bitmap_utils.h"
+#include "memory_utils.h"
+#include "worker_utils.h"
+#include "lut_utils.h"
+
+//  counters kept by each copy for each channel: consecutive pixels go to
+//  different banks, so runs of equal pixels don't wait on the same counter
+#define HISTOGRAM_BANKS 4
+
+//  most values counted in banks, the counters of 16 bit images don't fit
+//  in the cache anyway and get a single bank
+#define HISTOGRAM_BANKED_SIZE 256
+
+//  bytes of the counters of all copies, 16 bit images are counted in
+//  fewer copies than there are workers
+#define HISTOGRAM_MAX_COUNTERS (4 << 20)
+
+//  histogram of the selection, counted by the worker threads: the rows are
+//  split in parts, each counted in its own copy of the counters
+typedef struct {
+	my_image *image;
+	double **planes[3];
+	int channels;
+	int size;
+	//  banks of each copy, HISTOGRAM_BANKS or 1
+	int banks;
+	int copies;
+	//  counters of copy k, channel c, bank b start at
+	//  ((k * channels + c) * banks + b) * size
+	uint32_t *counters;
+} histogram_job;
+
+//  value of a pixel, rounded like when saved
+static inline int pixel_index(double v, int last)
+{
+	int i = (int)(v + 0.5);
+
+	return i < 0 ? 0 : i > last ? last : i;
+}
+
+//  counts the selected pixels of the rows of part k in copy k
+static void histogram_part(histogram_job *job, int k)
+{
+	my_select *s = job->image->select;
+	int size = job->size, last = job->size - 1;
+	int rows = s->y2 - s->y1;
+	int begin = (int)((long long)rows * k / job->copies);
+	int end = (int)((long long)rows * (k + 1) / job->copies);
+
+	//  with a single bank, the unrolled loop counts in it 4 times
+	size_t step = job->banks > 1 ? (size_t)size : 0;
+
+	for (int c = 0; c < job->channels; ++c) {
+		uint32_t *bank = job->counters + ((size_t)k * job->channels + c) *
+										   job->banks * size;
+		uint32_t *b0 = bank, *b1 = bank + step;
+		uint32_t *b2 = bank + 2 * step, *b3 = bank + 3 * step;
+
+		for (int i = s->y1 + begin; i < s->y1 + end; ++i) {
+			int j = s->x1;
+
+			//  count the pixels of a black & white image straight from bits,
+			//  by intensity (a set bit is black, 0)
+			if (job->image->img_type == BLACK_WHITE) {
+				uint64_t *row = ((bit_img *)job->image->img)->rows[i];
+
+				for (; j < s->x2; ++j)
+					bank[!BIT_GET(row, j)]++;
+				continue;
+			}
+
+			double *row = job->planes[c][i];
+
+			for (; j + 3 < s->x2; j += 4) {
+				b0[pixel_index(row[j], last)]++;
+				b1[pixel_index(row[j + 1], last)]++;
+				b2[pixel_index(row[j + 2], last)]++;
+				b3[pixel_index(row[j + 3], last)]++;
+			}
+
+			for (; j < s->x2; ++j)
+				b0[pixel_index(row[j], last)]++;
+		}
+	}
+}
+
+//  worker task, counts the parts of a band
+static void histogram_band(void *arg, int begin, int end, int worker)
+{
+	(void)worker;
+
+	for (int k = begin; k < end; ++k)
+		histogram_part(arg, k);
+}
+
+//  counts the pixels of every value of the selection, returns false if
+//  memory is exhausted
+bool compute_histogram(my_image *image, histogram *h)
+{
+	histogram_job job;
+	int rows = image->select->y2 - image->select->y1;
+
+	job.image = image;
+	job.channels = image_planes(image, job.planes);
+	job.size = image->pixel_value + 1;
+
+	//  the bits of a black & white image are counted as one channel
+	if (!job.channels)
+		job.channels = 1;
+
+	h->channels = job.channels;
+	h->size = job.size;
+
+	for (int c = 0; c < 3; ++c)
+		h->counts[c] = NULL;
+
+	job.banks = job.size <= HISTOGRAM_BANKED_SIZE ? HISTOGRAM_BANKS : 1;
+
+	//  a copy for every worker, as long as they fit
+	size_t copy_size = sizeof(uint32_t) * job.channels * job.banks * job.size;
+	size_t fit = HISTOGRAM_MAX_COUNTERS / copy_size;
+
+	job.copies = workers_count();
+	if ((size_t)job.copies > fit)
+		job.copies = fit ? (int)fit : 1;
+	if (job.copies > rows)
+		job.copies = rows > 0 ? rows : 1;
+
+	size_t counters_size = copy_size * job.copies;
+	job.counters = mem_alloc(counters_size, MEM_SCRATCH);
+	if (!job.counters)
+		return false;
+
+	for (int c = 0; c < h->channels; ++c) {
+		h->counts[c] = mem_alloc(sizeof(uint64_t) * h->size, MEM_SCRATCH);
+		if (!h->counts[c]) {
+			free_histogram(h);
+			mem_free(job.counters);
+			return false;
+		}
+	}
+
+	memset(job.counters, 0, counters_size);
+	workers_run(job.copies, histogram_band, &job);
+
+	//  merge the banks of every copy
+	for (int c = 0; c < h->channels; ++c) {
+		memset(h->counts[c], 0, sizeof(uint64_t) * h->size);
+
+		for (int k = 0; k < job.copies; ++k) {
+			uint32_t *bank = job.counters + ((size_t)k * job.channels + c) *
+											  job.banks * job.size;
+
+			for (int b = 0; b < job.banks; ++b)
+				for (int v = 0; v < h->size; ++v)
+					h->counts[c][v] += bank[(size_t)b * h->size + v];
+		}
+	}
+
+	mem_free(job.counters);
+	return true;
+}
+
+//  frees the counters
+void free_histogram(histogram *h)
+{
+	for (int c = 0; c < 3; ++c) {
+		mem_free(h->counts[c]);
+		h->counts[c] = NULL;
+	}
+}
+
+//  prints the histogram as CSV, values grouped in the given number of bins:
+//  the first and last value of the bin, then its count for every channel
+void print_histogram(FILE *file, my_image *image, histogram *h, int bins)
+{
+	static char *names[] = {"red", "green", "blue"};
+
+	fprintf(file, "from,to");
+	for (int c = 0; c < h->channels; ++c)
+		fprintf(file, ",%s", image->img_type == COLOR ? names[c] : "value");
+	fprintf(file, "\n");
+
+	for (int b = 0; b < bins; ++b) {
+		//  values v with v * bins / size == b
+		int from = (int)(((int64_t)b * h->size + bins - 1) / bins);
+		int to = (int)(((int64_t)(b + 1) * h->size + bins - 1) / bins) - 1;
+
+		fprintf(file, "%d,%d", from, to);
+
+		for (int c = 0; c < h->channels; ++c) {
+			uint64_t count = 0;
+
+			for (int v = from; v <= to; ++v)
+				count += h->counts[c][v];
+
+			fprintf(file, ",%" PRIu64, count);
+		}
+
+		fprintf(file, "\n");
+	}
+}
+
+//  equalizes every channel of the selection: each value becomes the share
+//  of selected pixels that are not brighter, scaled to the max value,
+//  returns false if memory is exhausted
+bool equalize(my_image *image)
+{
+	histogram h;
+	lut t;
+
+	if (!compute_histogram(image, &h))
+		return false;
+
+	if (!lut_init(&t, image)) {
+		free_histogram(&h);
+		return false;
+	}
+
+	my_select *s = image->select;
+	double area = (double)(s->x2 - s->x1) * (s->y2 - s->y1);
+	double max = image->pixel_value;
+
+	for (int c = 0; c < t.channels; ++c) {
+		uint64_t sum = 0;
+
+		for (int v = 0; v < t.size; ++v) {
+			sum += h.counts[c][v];
+			t.table[c][v] = round(max * sum / area);
+		}
+	}
+
+	lut_apply(image, &t);
+
+	lut_free(&t);
+	free_histogram(&h);
+	return true;
+}
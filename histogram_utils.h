@@ -0,0 +1,25 @@
+#ifndef HISTOGRAM_UTTILS_
+#define HISTOGRAM_UTTILS_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "image_utils.h"
+
+//  number of pixels of every value (0 to the image's max pixel value) of
+//  every channel, over the image's selection
+typedef struct {
+	int channels;
+	int size;
+	uint64_t *counts[3];
+} histogram;
+
+bool compute_histogram(my_image *image, histogram *h);
+
+void free_histogram(histogram *h);
+
+void print_histogram(FILE *file, my_image *image, histogram *h, int bins);
+
+bool equalize(my_image *image);
+
+#endif /* HISTOGRAM_UTTILS_ */
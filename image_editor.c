@@ -1,74 +1,244 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include "editor_utils.h"
+#include "pipeline_utils.h"
+#include "writer_utils.h"
+#include "slot_utils.h"
+#include "point_utils.h"
+#include "morph_utils.h"
+#include "session_utils.h"
+#include "server_utils.h"
+#include "optimize_utils.h"
 #include "utils.h"
 
-int main(void)
+//  runs an input line on the image of the session's current slot (load is
+//  its background LOAD, if any, step its plan in an optimized script),
+//  returns false after EXIT
+static bool run_command(char *line, prefetch *load, script_step *step)
 {
-	char input_line[MAX_INPUT_LINE_SIZE];
-	char *command;
-	char *args;
-	my_image *image;
-
-	//  alloc image data and initilize it
-	image = malloc(sizeof(my_image));
-	init_image_data(image);
-
-	do {
-		//  get input line
-		fgets(input_line, MAX_INPUT_LINE_SIZE, stdin);
-
-		//  get command name
-		command = strtok(input_line, " ");
-
-		//  get possible parameter
-		args = strtok(NULL, "\n");
-
-		if (!strncmp(command, "LOAD", sizeof("LOAD") - 1)) {
-			//  load image
-			editor_load(image, args);
-
-		} else if (!strncmp(command, "SELECT", sizeof("SELECT") - 1)) {
-			//  select command has no argument
-			if (!args) {
-				printf("Invalid command\n");
-				continue;
-			}
-
-			if (!strncmp(args, "ALL", sizeof("ALL") - 1)) {
-				//  select all image
-				editor_select_all(image);
-			} else {
-				//  select a section of the image
-				editor_select(image, args);
-			}
-		} else if (!strncmp(command, "ROTATE", sizeof("ROTATE") - 1)) {
-			//  rotate image
-			editor_rotate(image, args);
-
-		} else if (!strncmp(command, "CROP", sizeof("CROP") - 1)) {
-			//  crop image
-			editor_crop(image, args);
-
-		} else if (!strncmp(command, "APPLY", sizeof("APPLY") - 1)) {
-			//  apply filter on image
-			editor_apply(image, args);
-
-		} else if (!strncmp(command, "SAVE", sizeof("SAVE") - 1)) {
-			//  save image
-			editor_save(image, args);
-
-		} else if (!strncmp(command, "EXIT", sizeof("EXIT") - 1)) {
-			//  free resources and exit application
-			editor_exit(image);
+	char *save;
+
+	//  get the image of the current slot
+	my_image *image = slot_current();
+
+	//  get command name
+	char *command = strtok_r(line, " ", &save);
+
+	//  get possible parameter
+	char *args = strtok_r(NULL, "\n", &save);
+
+	//  a line of spaces
+	if (!command) {
+		reply("Invalid command\n");
+		return true;
+	}
+
+	enum command_kind kind = get_command_kind(command);
+
+	//  point operations wait to be composed, any other command needs
+	//  the image's pixels (LOAD, RESTORE and EXIT discard them)
+	if (kind != COMMAND_POINT_OP && kind != COMMAND_LOAD &&
+		kind != COMMAND_RESTORE && kind != COMMAND_EXIT)
+		flush_point_ops(image);
+
+	if (kind == COMMAND_POINT_OP) {
+		//  compose a point operation with the pending ones
+		editor_point_op(image, command, args, step);
+
+	} else if (kind == COMMAND_LOAD) {
+		//  load image
+		editor_load(image, args, load);
+
+	} else if (kind == COMMAND_USE) {
+		//  work on another image slot
+		editor_use(args);
+
+	} else if (kind == COMMAND_SELECT) {
+		//  select command has no argument
+		if (!args) {
+			reply("Invalid command\n");
+			return true;
+		}
+
+		if (!strncmp(args, "ALL", sizeof("ALL") - 1)) {
+			//  select all image
+			editor_select_all(image);
 		} else {
-			//  given command is unknown
-			printf("Invalid command\n");
+			//  select a section of the image
+			editor_select(image, args);
+		}
+	} else if (kind == COMMAND_ROTATE) {
+		//  rotate image
+		editor_rotate(image, args, step);
+
+	} else if (kind == COMMAND_CROP) {
+		//  crop image
+		editor_crop(image, args);
+
+	} else if (kind == COMMAND_RESIZE) {
+		//  scale image
+		editor_resize(image, args);
+
+	} else if (kind == COMMAND_APPLY) {
+		//  apply filter on image
+		editor_apply(image, args, step);
+
+	} else if (kind == COMMAND_HISTOGRAM) {
+		//  print the histogram of the selection
+		editor_histogram(image, args);
+
+	} else if (kind == COMMAND_EQUALIZE) {
+		//  equalize the histogram of the selection
+		editor_equalize(image, args, step);
+
+	} else if (kind == COMMAND_LABEL) {
+		//  measure the components of a black & white selection
+		editor_label(image, args);
+
+	} else if (kind == COMMAND_MORPH) {
+		//  erode, dilate, open or close the selection
+		editor_morph(image, command, args, step);
+
+	} else if (kind == COMMAND_SAVE) {
+		//  save image
+		editor_save(image, args, step);
+
+	} else if (kind == COMMAND_SNAPSHOT) {
+		//  save the image and its selection as they are in memory
+		editor_snapshot(image, args);
+
+	} else if (kind == COMMAND_RESTORE) {
+		//  map a snapshot back
+		editor_restore(image, args);
+
+	} else if (kind == COMMAND_THUMBNAIL) {
+		//  save a small preview of the image
+		editor_thumbnail(image, args);
+
+	} else if (kind == COMMAND_MEMORY) {
+		//  report memory usage or configure the memory layer
+		editor_memory(image, args);
+
+	} else if (kind == COMMAND_EXIT) {
+		//  free resources and exit application
+		editor_exit(image);
+	} else {
+		//  given command is unknown
+		reply("Invalid command\n");
+	}
+
+	return kind != COMMAND_EXIT;
+}
+
+//  runs the commands of a server's client until it leaves or sends EXIT,
+//  replying to each one at once
+static void serve_client(FILE *input)
+{
+	char line[MAX_INPUT_LINE_SIZE];
+	bool running = true;
+
+	while (running && fgets(line, MAX_INPUT_LINE_SIZE, input)) {
+		//  background SAVEs that failed since the last command
+		session_report_failures();
+
+		running = run_command(line, NULL, NULL);
+		fflush(session_output());
+	}
+
+	//  the client may read the files it saved once it's disconnected, the
+	//  session must outlive its SAVEs
+	writer_wait_all();
+
+	session_report_failures();
+	fflush(session_output());
+}
+
+//  reads the whole script, plans it (see optimize_script), then runs it;
+//  its lines are read again by the pipeline, so LOADs are still decoded
+//  ahead
+static void run_optimized(FILE *input)
+{
+	char line[MAX_INPUT_LINE_SIZE];
+	char **lines = NULL;
+	int count = 0, capacity = 0;
+	char *text = NULL;
+	size_t size = 0;
+
+	FILE *copy = open_memstream(&text, &size);
+	DIE(!copy, "open_memstream");
+
+	while (fgets(line, MAX_INPUT_LINE_SIZE, input)) {
+		if (count == capacity) {
+			capacity = capacity ? 2 * capacity : 64;
+			char **grown = realloc(lines, sizeof(char *) * capacity);
+			DIE(!grown, "realloc lines");
+			lines = grown;
+		}
+
+		lines[count] = strdup(line);
+		DIE(!lines[count], "strdup line");
+		count++;
+
+		fputs(line, copy);
+	}
+
+	DIE(fclose(copy), "fclose copy");
+
+	script_step *steps = optimize_script(lines, count);
+
+	for (int i = 0; i < count; ++i)
+		free(lines[i]);
+	free(lines);
+
+	//  the text stays with the pipeline's reader thread
+	if (size) {
+		FILE *script = fmemopen(text, size, "r");
+		DIE(!script, "fmemopen script");
+
+		command_entry entry;
+		pipeline_start(script);
+
+		for (int i = 0; pipeline_next(&entry); ++i)
+			if (!run_command(entry.line, entry.load,
+							 i < count ? &steps[i] : NULL))
+				break;
+	}
+
+	free_script(steps, count);
+}
+
+int main(int argc, char **argv)
+{
+	command_entry entry;
+
+	//  serve clients on a Unix domain socket instead of the standard input
+	if (argc == 3 && !strcmp(argv[1], "--serve")) {
+		if (!server_run(argv[2], serve_client)) {
+			fprintf(stderr, "Failed to listen on %s\n", argv[2]);
+			return 1;
 		}
+	}
+
+	//  plan the whole script before running any of it
+	if (argc == 2 && !strcmp(argv[1], "--optimize")) {
+		run_optimized(stdin);
+		writer_wait_all();
+		return 0;
+	}
+
+	//  read commands ahead and decode upcoming LOADs in the background
+	pipeline_start(stdin);
+
+	//  get input lines until EXIT or the end of the input
+	while (pipeline_next(&entry) &&
+		   run_command(entry.line, entry.load, NULL))
+		;
 
-	} while (strncmp(command, "EXIT", sizeof("EXIT") - 1) != 0);
+	//  input ended, wait for the background SAVEs
+	writer_wait_all();
 
 	return 0;
 }
@@ -1,10 +1,23 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <ctype.h>
+#include <limits.h>
 #include <math.h>
 #include "image_utils.h"
 #include "matrix_utils.h"
+#include "bitmap_utils.h"
+#include "pyramid_utils.h"
+#include "point_utils.h"
+#include "median_utils.h"
+#include "bilateral_utils.h"
+#include "kernel_utils.h"
+#include "qoi_utils.h"
+#include "ascii_utils.h"
+#include "patch_utils.h"
+#include "memory_utils.h"
 #include "utils.h"
 
 //  no image is loaded
@@ -27,7 +40,9 @@ void handle_comments(FILE *file, char *input_line)
 	   cursor = ftell(file);
 	}
 
-	fgets(input_line, MAX_LINE_SIZE, file);
+	//  the file ends before the line
+	if (!fgets(input_line, MAX_LINE_SIZE, file))
+		input_line[0] = '\0';
 }
 
 //  swaps 2 integers
@@ -63,6 +78,9 @@ void init_image_data(my_image *image)
 
 	image->img = NULL;
 	image->select = malloc(sizeof(my_select));
+	image->pyramid = NULL;
+	image->pending = NULL;
+	image->saved = NULL;
 }
 
 //  frees image's data (slection & pixel matrix)
@@ -74,6 +92,12 @@ void free_image_data(my_image *image)
 		image->select = NULL;
 	}
 
+	//  free the reduced copies, the point operations not applied and the
+	//  record of the last SAVE
+	invalidate_pyramid(image);
+	drop_point_ops(image);
+	forget_save(image);
+
 	//  free pixel matrix / matrices
 	if (!is_empty(image)) {
 		if (image->img_type == COLOR) {
@@ -84,6 +108,9 @@ void free_image_data(my_image *image)
 			free_matrix(color->red, image->height);
 			free_matrix(color->green, image->height);
 			free_matrix(color->blue, image->height);
+		} else if (image->img_type == BLACK_WHITE) {
+			//  free image's packed pixels
+			free_bitmap(((bit_img *)image->img)->rows);
 		} else {
 			//  get basic image
 			basic_img *basic = (basic_img *)image->img;
@@ -92,11 +119,25 @@ void free_image_data(my_image *image)
 			free_matrix(basic->pixels, image->height);
 		}
 
-		free(image->img);
+		mem_free(image->img);
 		image->img = NULL;
 	}
 }
 
+//  moves src's data (selection & pixels) to dst, src is left without data
+void move_image_data(my_image *dst, my_image *src)
+{
+	free_image_data(dst);
+
+	*dst = *src;
+
+	src->img = NULL;
+	src->select = NULL;
+	src->pyramid = NULL;
+	src->pending = NULL;
+	src->saved = NULL;
+}
+
 //  sets the type (e.g grayscale) and the file type of the given image
 void set_image_attributes(my_image *image, int number)
 {
@@ -129,16 +170,113 @@ void set_image_attributes(my_image *image, int number)
 }
 
 //  stores pixels data
-void set_pixel_matrix(my_image *image, void *data, int data_size)
+bool set_pixel_matrix(my_image *image, void *data, int data_size)
 {
-	image->img = malloc(data_size);
-	DIE(!image->img, "malloc image->img");
+	image->img = mem_alloc(data_size, MEM_PLANES);
+	if (!image->img)
+		return false;
 
 	memcpy(image->img, data, data_size);
+	return true;
+}
+
+//  frees the 3 color channels of a color image
+void free_color_channels(color_img *color, int height)
+{
+	free_matrix(color->red, height);
+	free_matrix(color->green, height);
+	free_matrix(color->blue, height);
+}
+
+//  gets the pixel matrices of a color or grayscale image, returns their
+//  number (0 for black & white images, their pixels are packed)
+int image_planes(my_image *image, double **planes[3])
+{
+	if (image->img_type == COLOR) {
+		color_img *color = (color_img *)image->img;
+
+		planes[0] = color->red;
+		planes[1] = color->green;
+		planes[2] = color->blue;
+		return 3;
+	}
+
+	if (image->img_type == GRAYSCALE) {
+		planes[0] = ((basic_img *)image->img)->pixels;
+		return 1;
+	}
+
+	return 0;
+}
+
+//  copies image's data (selection & pixels) in the given memory category,
+//  returns NULL if memory is exhausted
+my_image *copy_image(my_image *image, enum mem_category category)
+{
+	my_image *copy = malloc(sizeof(my_image));
+	DIE(!copy, "malloc copy");
+
+	*copy = *image;
+	copy->img = NULL;
+	copy->pyramid = NULL;
+	copy->pending = NULL;
+	copy->saved = NULL;
+
+	copy->select = malloc(sizeof(my_select));
+	DIE(!copy->select, "malloc copy->select");
+	*copy->select = *image->select;
+
+	if (image->img_type == COLOR) {
+		color_img *color = (color_img *)image->img;
+		color_img channels;
+
+		//  copy every color channel
+		channels.red = copy_matrix(color->red, image->height,
+								   image->width, category);
+		channels.green = copy_matrix(color->green, image->height,
+									 image->width, category);
+		channels.blue = copy_matrix(color->blue, image->height,
+									image->width, category);
+
+		if (channels.red && channels.green && channels.blue &&
+			set_pixel_matrix(copy, &channels, sizeof(color_img)))
+			return copy;
+
+		free_color_channels(&channels, image->height);
+	} else if (image->img_type == BLACK_WHITE) {
+		bit_img *bits = (bit_img *)image->img;
+		bit_img packed;
+
+		//  copy the packed pixels
+		packed.rows = copy_bitmap(bits->rows, image->height,
+								  image->width, category);
+
+		if (packed.rows && set_pixel_matrix(copy, &packed, sizeof(bit_img)))
+			return copy;
+
+		free_bitmap(packed.rows);
+	} else {
+		basic_img *basic = (basic_img *)image->img;
+		basic_img pixels;
+
+		//  copy the pixel matrix
+		pixels.pixels = copy_matrix(basic->pixels, image->height,
+									image->width, category);
+
+		if (pixels.pixels &&
+			set_pixel_matrix(copy, &pixels, sizeof(basic_img)))
+			return copy;
+
+		free_matrix(pixels.pixels, image->height);
+	}
+
+	free_image_data(copy);
+	free(copy);
+	return NULL;
 }
 
 //  loads color image's pixel matrix from given file
-void load_color_image(FILE *file, my_image *image)
+static enum load_status load_color_image(FILE *file, my_image *image)
 {
 	color_img color;
 	int height, width;
@@ -152,20 +290,40 @@ void load_color_image(FILE *file, my_image *image)
 	color.green = alloc_matrix(height, width);
 	color.blue = alloc_matrix(height, width);
 
-	//  load pixel matrices from binary file
+	//  not enough memory for the color channels
+	if (!color.red || !color.green || !color.blue) {
+		free_color_channels(&color, height);
+		return LOAD_NO_MEMORY;
+	}
+
+	enum load_status status = LOAD_OK;
+
+	//  load pixel matrices from binary file (1 or 2 bytes per sample)
 	if (image->file_type == BINARY) {
-		b_3_load(file, color.red, color.green, color.blue, height, width);
+		status = b_3_load(file, color.red, color.green, color.blue, height,
+						  width, image->pixel_value);
 	} else {
-		//  load pixel matrices from text file
-		t_3_load(file, color.red, color.green, color.blue, height, width);
+		double **planes[3] = {color.red, color.green, color.blue};
+
+		//  load pixel matrices from text file, on the worker threads if
+		//  the file can be mapped
+		if (!t_parallel_load(file, planes, 3, height, width))
+			t_3_load(file, color.red, color.green, color.blue, height,
+					 width);
 	}
 
 	//  store pixel matrix
-	set_pixel_matrix(image, &color, sizeof(color_img));
+	if (status == LOAD_OK &&
+		!set_pixel_matrix(image, &color, sizeof(color_img)))
+		status = LOAD_NO_MEMORY;
+
+	if (status != LOAD_OK)
+		free_color_channels(&color, height);
+	return status;
 }
 
 //  loads basic image's pixel matrix from given file
-void load_basic_image(FILE *file, my_image *image)
+static enum load_status load_basic_image(FILE *file, my_image *image)
 {
 	basic_img basic;
 	int height, width;
@@ -175,38 +333,118 @@ void load_basic_image(FILE *file, my_image *image)
 	width = image->width;
 
 	basic.pixels = alloc_matrix(height, width);
+	if (!basic.pixels)
+		return LOAD_NO_MEMORY;
 
-	//  load pixel matrix from binary file
+	enum load_status status = LOAD_OK;
+
+	//  load pixel matrix from binary file (1 or 2 bytes per sample)
 	if (image->file_type == BINARY) {
-		b_load(file, basic.pixels, height, width);
+		status = b_load(file, basic.pixels, height, width,
+						image->pixel_value);
 	} else {
-		//  load pixel matrices from text file
-		t_load(file, basic.pixels, height, width);
+		double **planes[3] = {basic.pixels};
+
+		//  load pixel matrix from text file, on the worker threads if the
+		//  file can be mapped
+		if (!t_parallel_load(file, planes, 1, height, width))
+			t_load(file, basic.pixels, height, width);
 	}
 
 	//  store pixel matrix
-	set_pixel_matrix(image, &basic, sizeof(basic_img));
+	if (status == LOAD_OK &&
+		!set_pixel_matrix(image, &basic, sizeof(basic_img)))
+		status = LOAD_NO_MEMORY;
+
+	if (status != LOAD_OK)
+		free_matrix(basic.pixels, height);
+	return status;
+}
+
+//  loads black & white image's packed pixels from given file
+static enum load_status load_bit_image(FILE *file, my_image *image)
+{
+	bit_img bits;
+
+	bits.rows = alloc_bitmap(image->height, image->width);
+	if (!bits.rows)
+		return LOAD_NO_MEMORY;
+
+	enum load_status status = LOAD_OK;
+
+	//  load 8 pixels per byte from binary file, one per digit from text file
+	if (image->file_type == BINARY)
+		status = b_bits_load(file, bits.rows, image->height, image->width);
+	else
+		t_bits_load(file, bits.rows, image->height, image->width);
+
+	//  store packed pixels
+	if (status == LOAD_OK && !set_pixel_matrix(image, &bits, sizeof(bit_img)))
+		status = LOAD_NO_MEMORY;
+
+	if (status != LOAD_OK)
+		free_bitmap(bits.rows);
+	return status;
+}
+
+//  reads a header number from a token, returns false if it is missing,
+//  isn't a number or isn't between 1 and max
+static bool header_number(char *token, long max, int *number)
+{
+	if (!token)
+		return false;
+
+	char *end;
+	errno = 0;
+	long value = strtol(token, &end, 10);
+
+	//  the line may end with spaces or a carriage return
+	while (isspace((unsigned char)*end))
+		end++;
+
+	if (end == token || *end || errno == ERANGE || value < 1 || value > max)
+		return false;
+
+	*number = (int)value;
+	return true;
 }
 
 //  loads image's data from given file
-void load_image(FILE *file, my_image *image)
+enum load_status load_image(FILE *file, my_image *image)
 {
 	char input_line[MAX_LINE_SIZE];
-	char *p;
+	char *p, *save;
+
+	//  QOI files have no text header
+	int first = fgetc(file);
+	ungetc(first, file);
+	if (first == QOI_MAGIC[0])
+		return load_qoi_image(file, image);
 
 	//  ignore possible comments
 	handle_comments(file, input_line);
 
-	//  get magic number
-	p = strtok(input_line, "\n");
-	set_image_attributes(image, atoi(&p[1]));
+	//  get magic number, P1 to P6
+	p = strtok_r(input_line, "\n", &save);
+	if (!p || p[0] != 'P' || p[1] < '1' || p[1] > '6' ||
+		(p[2] && !isspace((unsigned char)p[2])))
+		return LOAD_NO_FILE;
+	set_image_attributes(image, p[1] - '0');
 
 	///  ignore possible comments
 	handle_comments(file, input_line);
 
 	//  set image dimensions
-	image->width = atoi(strtok(input_line, " "));
-	image->height = atoi(strtok(NULL, "\n"));
+	int width, height;
+	char *str_width = strtok_r(input_line, " ", &save);
+	char *str_height = str_width ? strtok_r(NULL, "\n", &save) : NULL;
+
+	if (!header_number(str_width, INT_MAX, &width) ||
+		!header_number(str_height, INT_MAX, &height))
+		return LOAD_NO_FILE;
+
+	image->width = width;
+	image->height = height;
 
 	//  set initial image selection (selects all)
 	set_selection(image->select, 0, 0, image->width, image->height);
@@ -217,23 +455,31 @@ void load_image(FILE *file, my_image *image)
 	} else {
 		//  ignore possible comments
 		handle_comments(file, input_line);
-		image->pixel_value = atoi(strtok(input_line, "\n"));
+
+		int max;
+		if (!header_number(strtok_r(input_line, "\n", &save), 65535, &max))
+			return LOAD_NO_FILE;
+		image->pixel_value = max;
 	}
 
-	//  ignore possible comments
-	handle_comments(file, input_line);
+	//  binary pixels start right after the header, they may contain any byte
+	if (image->file_type == TEXT) {
+		//  ignore possible comments
+		handle_comments(file, input_line);
 
-	//  move to the start of the pixel matrix
-	long cursor = ftell(file);
-	fseek(file, cursor - strlen(input_line), SEEK_SET);
+		//  move to the start of the pixel matrix
+		long cursor = ftell(file);
+		fseek(file, cursor - strlen(input_line), SEEK_SET);
+	}
 
 	//  load pixel matrix
-	if (image->img_type == COLOR) {
-		load_color_image(file, image);
-		return;
-	}
+	if (image->img_type == COLOR)
+		return load_color_image(file, image);
 
-	load_basic_image(file, image);
+	if (image->img_type == BLACK_WHITE)
+		return load_bit_image(file, image);
+
+	return load_basic_image(file, image);
 }
 
 //  rotates inplace a square section of the given color image
@@ -316,32 +562,96 @@ void rotate_basic_image_selection(my_image *image, char sign, int angle)
 	}
 }
 
-//  rotates inplace a square section of the loaded image
-void rotate_image_selection(my_image *image, char sign, int angle)
+//  copies a packed bitmap rotated clockwise by the given angle,
+//  returns NULL if there is no rotation or memory is exhausted
+uint64_t **rotate_bitmap(uint64_t **a, int n, int m, char sign, int angle)
+{
+	//  rotate 180 degrees clockwise
+	if (angle == 180)
+		return rotate_bitmap_180(a, n, m);
+
+	//  rotate 270 degrees clockwise
+	if ((sign == '-' && angle == 90) || (sign == '+' && angle == 270))
+		return rotate_bitmap_270(a, n, m);
+
+	//  rotate 90 degrees clockwise
+	if ((sign == '+' && angle == 90) || (sign == '-' && angle == 270))
+		return rotate_bitmap_90(a, n, m);
+
+	return NULL;
+}
+
+//  rotates a square section of the given black & white image
+bool rotate_bit_image_selection(my_image *image, char sign, int angle)
+{
+	int x1, x2, y1, y2;
+
+	//  no need to rotate
+	if (angle == 0 || angle == 360)
+		return true;
+
+	//  get packed pixels
+	bit_img *bits = (bit_img *)image->img;
+
+	//  get selection
+	x1 = image->select->x1;
+	y1 = image->select->y1;
+	x2 = image->select->x2;
+	y2 = image->select->y2;
+
+	//  rotate a copy of the section and put it back, a word at a time
+	uint64_t **section = crop_bitmap(bits->rows, x1, y1, x2, y2);
+	if (!section)
+		return false;
+
+	uint64_t **rotate = rotate_bitmap(section, y2 - y1, x2 - x1, sign, angle);
+	free_bitmap(section);
+
+	if (!rotate)
+		return false;
+
+	paste_bitmap(bits->rows, image->width, rotate, x1, y1, y2 - y1, x2 - x1);
+	free_bitmap(rotate);
+
+	//  update picture selection, like for the other basic images
+	if (angle != 180)
+		set_selection(image->select, y1, x1, y2, x2);
+
+	return true;
+}
+
+//  rotates inplace a square section of the loaded image,
+//  returns false if memory is exhausted
+bool rotate_image_selection(my_image *image, char sign, int angle)
 {
 	//  rotate selection of color image
 	if (image->img_type == COLOR) {
 		rotate_color_image_selection(image, sign, angle);
-		return;
+		return true;
 	}
 
+	//  rotate selection of black & white image
+	if (image->img_type == BLACK_WHITE)
+		return rotate_bit_image_selection(image, sign, angle);
+
 	//  rotate selection of basic image
 	rotate_basic_image_selection(image, sign, angle);
+	return true;
 }
 
 //  rotates a full basic image
-void rotate_entire_basic_image(my_image *image, char sign, int angle)
+bool rotate_entire_basic_image(my_image *image, char sign, int angle)
 {
-	double **rotate;
-	int new_height, new_width;
+	double **rotate = NULL;
+	int new_height = 0, new_width = 0;
 
 	//  no neeed to rotate
 	if (angle == 0)
-		return;
+		return true;
 
 	//  no neeed to rotate
 	if ((sign == '-' && angle == 360) || (sign == '+' && angle == 360))
-		return;
+		return true;
 
 	//  get basic image
 	basic_img *basic = (basic_img *)image->img;
@@ -376,6 +686,10 @@ void rotate_entire_basic_image(my_image *image, char sign, int angle)
 		new_width = image->height;
 	}
 
+	//  not enough memory for the rotated image
+	if (!rotate)
+		return false;
+
 	//  free the previous image
 	free_matrix(basic->pixels, image->height);
 
@@ -388,23 +702,24 @@ void rotate_entire_basic_image(my_image *image, char sign, int angle)
 
 	//  set image's updated selection
 	set_selection(image->select, 0, 0, new_width, new_height);
+	return true;
 }
 
 //  rotates a full basic image
-void rotate_entire_color_image(my_image *image, char sign, int angle)
+bool rotate_entire_color_image(my_image *image, char sign, int angle)
 {
-	double **rotate_r;
-	double **rotate_g;
-	double **rotate_b;
-	int new_height, new_width;
+	double **rotate_r = NULL;
+	double **rotate_g = NULL;
+	double **rotate_b = NULL;
+	int new_height = 0, new_width = 0;
 
 	//  no neeed to rotate
 	if (angle == 0)
-		return;
+		return true;
 
 	//  no neeed to rotate
 	if ((sign == '-' && angle == 360) || (sign == '+' && angle == 360))
-		return;
+		return true;
 
 	//  get color image
 	color_img *color = (color_img *)image->img;
@@ -445,6 +760,14 @@ void rotate_entire_color_image(my_image *image, char sign, int angle)
 		new_width = image->height;
 	}
 
+	//  not enough memory for the rotated color channels
+	if (!rotate_r || !rotate_g || !rotate_b) {
+		free_matrix(rotate_r, image->width);
+		free_matrix(rotate_g, image->width);
+		free_matrix(rotate_b, image->width);
+		return false;
+	}
+
 	//  free previos color channels
 	free_matrix(color->red, image->height);
 	free_matrix(color->green, image->height);
@@ -461,23 +784,59 @@ void rotate_entire_color_image(my_image *image, char sign, int angle)
 
 	//  set image's updated selection
 	set_selection(image->select, 0, 0, new_width, new_height);
+	return true;
+}
+
+//  rotates a full black & white image
+bool rotate_entire_bit_image(my_image *image, char sign, int angle)
+{
+	//  no neeed to rotate
+	if (angle == 0 || angle == 360)
+		return true;
+
+	//  get packed pixels
+	bit_img *bits = (bit_img *)image->img;
+
+	uint64_t **rotate = rotate_bitmap(bits->rows, image->height,
+									  image->width, sign, angle);
+
+	//  not enough memory for the rotated image
+	if (!rotate)
+		return false;
+
+	//  free the previous image and store the rotated one
+	free_bitmap(bits->rows);
+	bits->rows = rotate;
+
+	//  set image's updated dimmensions
+	if (angle != 180) {
+		int height = image->height;
+		image->height = image->width;
+		image->width = height;
+	}
+
+	//  set image's updated selection
+	set_selection(image->select, 0, 0, image->width, image->height);
+	return true;
 }
 
 //  rotates an entire given image by the given parameter
-void rotate_entire_image(my_image *image, char sign, int angle)
+bool rotate_entire_image(my_image *image, char sign, int angle)
 {
 	//  rotate color image
-	if (image->img_type == COLOR) {
-		rotate_entire_color_image(image, sign, angle);
-		return;
-	}
+	if (image->img_type == COLOR)
+		return rotate_entire_color_image(image, sign, angle);
+
+	//  rotate black & white image
+	if (image->img_type == BLACK_WHITE)
+		return rotate_entire_bit_image(image, sign, angle);
 
 	//  rotate basic image
-	rotate_entire_basic_image(image, sign, angle);
+	return rotate_entire_basic_image(image, sign, angle);
 }
 
 //  crops a basic image
-void crop_basic_image(my_image *image)
+bool crop_basic_image(my_image *image)
 {
 	int x1, x2, y1, y2;
 	double **crop;
@@ -493,16 +852,38 @@ void crop_basic_image(my_image *image)
 
 	//  compute cropped image
 	crop = crop_matrix(basic->pixels, x1, y1, x2, y2);
+	if (!crop)
+		return false;
 
 	//  free previous basic image pixels
 	free_matrix(basic->pixels, image->height);
 
 	//  store cropped image
 	basic->pixels = crop;
+	return true;
+}
+
+//  crops a black & white image
+bool crop_bit_image(my_image *image)
+{
+	//  get packed pixels
+	bit_img *bits = (bit_img *)image->img;
+
+	//  compute cropped image, shifting whole words
+	uint64_t **crop = crop_bitmap(bits->rows, image->select->x1,
+								  image->select->y1, image->select->x2,
+								  image->select->y2);
+	if (!crop)
+		return false;
+
+	//  free previous packed pixels and store cropped ones
+	free_bitmap(bits->rows);
+	bits->rows = crop;
+	return true;
 }
 
 //  crops a color image
-void crop_color_image(my_image *image)
+bool crop_color_image(my_image *image)
 {
 	int x1, x2, y1, y2;
 	double **crop_r;
@@ -525,6 +906,14 @@ void crop_color_image(my_image *image)
 
 	crop_b = crop_matrix(color->blue, x1, y1, x2, y2);
 
+	//  not enough memory for the cropped color channels
+	if (!crop_r || !crop_g || !crop_b) {
+		free_matrix(crop_r, y2 - y1);
+		free_matrix(crop_g, y2 - y1);
+		free_matrix(crop_b, y2 - y1);
+		return false;
+	}
+
 	//  free previous color channels
 	free_matrix(color->red, image->height);
 	free_matrix(color->green, image->height);
@@ -534,61 +923,39 @@ void crop_color_image(my_image *image)
 	color->red = crop_r;
 	color->green = crop_g;
 	color->blue = crop_b;
+	return true;
 }
 
-//  crops the loaded image
-void crop_image(my_image *image)
+//  crops the loaded image, returns false if memory is exhausted
+bool crop_image(my_image *image)
 {
+	bool cropped;
+
 	if (image->img_type == COLOR) {
 		//  crop color image
-		crop_color_image(image);
+		cropped = crop_color_image(image);
+	} else if (image->img_type == BLACK_WHITE) {
+		//  crop black & white image
+		cropped = crop_bit_image(image);
 	} else {
 		//  crop basic image
-		crop_basic_image(image);
+		cropped = crop_basic_image(image);
 	}
 
+	if (!cropped)
+		return false;
+
 	//  update cropped image's dimensions
 	image->height = image->select->y2 - image->select->y1;
 	image->width = image->select->x2 - image->select->x1;
 
 	//  update cropped image's selection
 	set_selection(image->select, 0, 0, image->width, image->height);
+	return true;
 }
 
-//  handles values outside the desired [min, max] interval
-double clamp(double x, double min, double max)
-{
-	if (x < min)
-		return min;
-
-	if (x > max)
-		return max;
-
-	return x;
-}
-
-//  computes filtered pixel
-double get_pixel(double **p, int i, int j, double kernel[3][3])
-{
-	double s = 0;
-
-	s += ((double)p[i - 1][j - 1] * (kernel[0][0]));
-	s += ((double)p[i - 1][j] * (kernel[0][1]));
-	s += ((double)p[i - 1][j + 1] * (kernel[0][2]));
-
-	s += ((double)p[i][j - 1] * (kernel[1][0]));
-	s += ((double)p[i][j] * (kernel[1][1]));
-	s += ((double)p[i][j + 1] * (kernel[1][2]));
-
-	s += ((double)p[i + 1][j - 1] * (kernel[2][0]));
-	s += ((double)p[i + 1][j] * (kernel[2][1]));
-	s += ((double)p[i + 1][j + 1] * (kernel[2][2]));
-
-	return clamp(s, 0, 255);
-}
-
-//  applies a certain filter on a color image using a given kernel matrix
-void apply_filter(my_image *image, double kernel[3][3])
+//  applies a fixed filter on a color image using its kernel
+static bool apply_filter(my_image *image, kernel_row kernel)
 {
 	//  get color channels
 	double **red = ((color_img *)image->img)->red;
@@ -596,9 +963,17 @@ void apply_filter(my_image *image, double kernel[3][3])
 	double **blue = ((color_img *)image->img)->blue;
 
 	//  alloc memory for the copies of the color channels
-	double **copy_red = alloc_matrix(image->height, image->width);
-	double **copy_green = alloc_matrix(image->height, image->width);
-	double **copy_blue = alloc_matrix(image->height, image->width);
+	double **copy_red = alloc_scratch_matrix(image->height, image->width);
+	double **copy_green = alloc_scratch_matrix(image->height, image->width);
+	double **copy_blue = alloc_scratch_matrix(image->height, image->width);
+
+	//  not enough memory for the copies
+	if (!copy_red || !copy_green || !copy_blue) {
+		free_matrix(copy_red, image->height);
+		free_matrix(copy_green, image->height);
+		free_matrix(copy_blue, image->height);
+		return false;
+	}
 
 	//  copy the image's color channels
 	for (int i = 0; i < image->height; ++i) {
@@ -634,71 +1009,53 @@ void apply_filter(my_image *image, double kernel[3][3])
 	if (end_j == image->width)
 		end_j--;
 
-	//  iterate trough all selected pixels
+	//  filtered pixels can't go over the image's max value (255 or 65535)
+	double max = image->pixel_value;
+
+	//  iterate trough all selected rows
 	for (int i = start_i; i < end_i; ++i) {
-		for (int j = start_j; j < end_j; ++j) {
-			//  compute & store filtered pixel for each color channel
-			red[i][j] = get_pixel(copy_red, i, j, kernel);
-			green[i][j] = get_pixel(copy_green, i, j, kernel);
-			blue[i][j] = get_pixel(copy_blue, i, j, kernel);
-		}
+		//  compute & store filtered pixels for each color channel
+		kernel(red[i], copy_red, i, start_j, end_j, max);
+		kernel(green[i], copy_green, i, start_j, end_j, max);
+		kernel(blue[i], copy_blue, i, start_j, end_j, max);
 	}
 
 	//  free copied color channels
 	free_matrix(copy_red, image->height);
 	free_matrix(copy_green, image->height);
 	free_matrix(copy_blue, image->height);
+	return true;
 }
 
-//  creates kernel matrices with double values
-void create_kernel(double kernel[3][3], double div)
+//  filters the loaded image, returns false if memory is exhausted
+bool apply(my_image *image, char *param)
 {
-	for (int i = 0; i < 3; ++i)
-		for (int j = 0; j < 3; ++j)
-			kernel[i][j] = (double)(kernel[i][j] / div);
-}
-
-//  filters the loaded image
-void apply(my_image *image, char *param)
-{
-	//  apply edge filter
-	if (!strncmp(param, "EDGE", sizeof("EDGE") - 1)) {
-		double kernel[3][3] = {{-1, -1, -1}, {-1, 8, -1}, {-1, -1, -1}};
-		apply_filter(image, kernel);
-		return;
-	}
-
-	//  apply sharpen filter
-	if (!strncmp(param, "SHARPEN", sizeof("SHARPEN") - 1)) {
-		double kernel[3][3] = {{0, -1, 0}, {-1, 5, -1}, {0, -1, 0}};
-		apply_filter(image, kernel);
-		return;
-	}
-
-	//  apply blur filter
-	if (!strncmp(param, "BLUR", sizeof("BLUR") - 1)) {
-		double kernel[3][3] = {{1, 1, 1}, {1, 1, 1}, {1, 1, 1}};
-		create_kernel(kernel, 9);
-		apply_filter(image, kernel);
-		return;
-	}
-
-	//  apply gaussian blur filter
-	if (!strncmp(param, "GAUSSIAN_BLUR", sizeof("GAUSSIAN_BLUR") - 1)) {
-		double kernel[3][3] = {{1, 2, 1}, {2, 4, 2}, {1, 2, 1}};
-		create_kernel(kernel, 16);
-		apply_filter(image, kernel);
-		return;
-	}
+	//  apply one of the fixed filters (EDGE, SHARPEN, BLUR, GAUSSIAN_BLUR)
+	kernel_row kernel = find_fixed_kernel(param);
+	if (kernel)
+		return apply_filter(image, kernel);
+
+	//  apply median filter of the given radius
+	int radius;
+	if (get_median_radius(param, &radius))
+		return apply_median(image, radius);
+
+	//  apply edge-preserving blur
+	double sigma_s, sigma_r;
+	if (get_bilateral_params(param, &sigma_s, &sigma_r))
+		return apply_bilateral(image, sigma_s, sigma_r);
+
+	return true;
 }
 
 //  saves loaded image to a text file
-void save_image_text(FILE *file, my_image *image)
+bool save_image_text(FILE *file, my_image *image)
 {
 	int height, width;
 
-	char *p = malloc(3);
-	DIE(!p, "malloc p");
+	char *p = mem_alloc(3, MEM_IO);
+	if (!p)
+		return false;
 
 	//  get image's magic word
 
@@ -725,12 +1082,23 @@ void save_image_text(FILE *file, my_image *image)
 	height = image->height;
 	width = image->width;
 
+	//  format the pixels on the worker threads, if there is memory for it
+	enum print_status status = t_parallel_print(file, image);
+
+	if (status != PRINT_NO_MEMORY) {
+		mem_free(p);
+		return status == PRINT_OK;
+	}
+
 	if (image->img_type == COLOR) {
 		//  get color image
 		color_img *color = (color_img *)image->img;
 
 		//  print color channels to file
 		t_3_print(file, color->red, color->green, color->blue, height, width);
+	} else if (image->img_type == BLACK_WHITE) {
+		//  print packed pixels to file
+		t_bits_print(file, ((bit_img *)image->img)->rows, height, width);
 	} else {
 		//  get basic image
 		basic_img *basic = (basic_img *)image->img;
@@ -739,55 +1107,72 @@ void save_image_text(FILE *file, my_image *image)
 		t_print(file, basic->pixels, height, width);
 	}
 
-	free(p);
+	mem_free(p);
+	return true;
 }
 
-//  saves loaded image to a binary file
-void save_image_binary(FILE *file, my_image *image)
+//  formats the header of a binary file of the image (magic word,
+//  dimensions, max value), returns its length
+int binary_header(my_image *image, char *header, size_t size)
 {
-	int height, width;
-
-	char *p = malloc(3);
-	DIE(!p, "malloc p");
-
-	//  get image's magic word
+	int magic = image->img_type == BLACK_WHITE ? 4 :
+				image->img_type == GRAYSCALE ? 5 : 6;
 
 	if (image->img_type == BLACK_WHITE)
-		memcpy(p, "P4", strlen("P4") + 1);
-
-	if (image->img_type == GRAYSCALE)
-		memcpy(p, "P5", strlen("P5") + 1);
+		return snprintf(header, size, "P%d\n%d %d\n", magic, image->width,
+						image->height);
 
-	if (image->img_type == COLOR)
-		memcpy(p, "P6", strlen("P6") + 1);
-
-	//  print image's magic word to file
-	fprintf(file, "%s\n", p);
+	return snprintf(header, size, "P%d\n%d %d\n%d\n", magic, image->width,
+					image->height, image->pixel_value);
+}
 
-	//  print image's dimensions to file
-	fprintf(file, "%d %d\n", image->width, image->height);
+//  saves loaded image to a binary file
+bool save_image_binary(FILE *file, my_image *image)
+{
+	int height, width;
+	char header[MAX_LINE_SIZE];
 
-	//  print image's pixel's max value
-	if (image->img_type != BLACK_WHITE)
-		fprintf(file, "%d\n", image->pixel_value);
+	//  print image's magic word, dimensions and max value to file
+	binary_header(image, header, sizeof(header));
+	fputs(header, file);
 
 	//  get image's dimensions
 	height = image->height;
 	width = image->width;
 
+	bool saved;
+
 	if (image->img_type == COLOR) {
 		//  get color image
 		color_img *color = (color_img *)image->img;
 
-		//  print color channels to file
-		b_3_print(file, color->red, color->green, color->blue, height, width);
+		//  print color channels to file (1 or 2 bytes per sample)
+		saved = b_3_print(file, color->red, color->green, color->blue,
+						  height, width, image->pixel_value);
+	} else if (image->img_type == BLACK_WHITE) {
+		//  print packed pixels to file, 8 per byte
+		saved = b_bits_print(file, ((bit_img *)image->img)->rows,
+							 height, width);
 	} else {
 		//  get basic image
 		basic_img *basic = (basic_img *)image->img;
 
-		//  print pixel matrix to file
-		b_print(file, basic->pixels, height, width);
+		//  print pixel matrix to file (1 or 2 bytes per sample)
+		saved = b_print(file, basic->pixels, height, width,
+						image->pixel_value);
 	}
 
-	free(p);
+	return saved;
+}
+
+//  saves loaded image in the given format
+bool save_image(FILE *file, my_image *image, enum save_format format)
+{
+	if (format == SAVE_QOI)
+		return save_image_qoi(file, image);
+
+	if (format == SAVE_TEXT)
+		return save_image_text(file, image);
+
+	return save_image_binary(file, image);
 }
@@ -1,11 +1,23 @@
 #ifndef IMAGE_UTTILS_
 #define IMAGE_UTTILS_
 
+#include <stdint.h>
+#include "memory_utils.h"
+
 enum file {TEXT = 0, BINARY = 1};
 enum image_type {BLACK_WHITE = 4, GRAYSCALE = 5, COLOR = 6};
+enum save_format {SAVE_BINARY, SAVE_TEXT, SAVE_QOI};
+
+//  result of reading an image file: LOAD_NO_FILE if it can't be opened or
+//  isn't a valid image (e.g. it is truncated)
+enum load_status {LOAD_OK = 0, LOAD_NO_FILE = 1, LOAD_NO_MEMORY = 2};
 
 #define MAX_LINE_SIZE 255
 
+struct pyramid;
+struct lut;
+struct save_record;
+
 //  stores image's selection
 typedef struct {
 	int x1;
@@ -30,6 +42,12 @@ typedef struct{
 	void *img;
 	//  image's current selection
 	my_select *select;
+	//  reduced copies of the image for previews (see pyramid_utils), or NULL
+	struct pyramid *pyramid;
+	//  point operations not applied yet (see point_utils), or NULL
+	struct lut *pending;
+	//  last binary SAVE and the rows changed since (see patch_utils), or NULL
+	struct save_record *saved;
 } my_image;
 
 //  color image's 3 color channels
@@ -44,26 +62,45 @@ typedef struct{
 	double **pixels;
 } basic_img;
 
+//  black & white image's pixels, packed 64 per word (see bitmap_utils)
+typedef struct{
+	uint64_t **rows;
+} bit_img;
+
 bool is_empty(my_image *image);
 
 void init_image_data(my_image *image);
 
-void load_image(FILE *file, my_image *image);
+enum load_status load_image(FILE *file, my_image *image);
+
+bool set_pixel_matrix(my_image *image, void *data, int data_size);
 
 void free_image_data(my_image *image);
 
+void move_image_data(my_image *dst, my_image *src);
+
+my_image *copy_image(my_image *image, enum mem_category category);
+
+void free_color_channels(color_img *color, int height);
+
+int image_planes(my_image *image, double **planes[3]);
+
 void set_selection(my_select *select, int x1, int y1, int x2, int y2);
 
-void rotate_image_selection(my_image *image, char sign, int angle);
+bool rotate_image_selection(my_image *image, char sign, int angle);
+
+bool rotate_entire_image(my_image *image, char sign, int angle);
+
+bool crop_image(my_image *image);
 
-void rotate_entire_image(my_image *image, char sign, int angle);
+bool apply(my_image *image, char *args);
 
-void crop_image(my_image *image);
+bool save_image_text(FILE *file, my_image *image);
 
-void apply(my_image *image, char *args);
+int binary_header(my_image *image, char *header, size_t size);
 
-void save_image_text(FILE *file, my_image *image);
+bool save_image_binary(FILE *file, my_image *image);
 
-void save_image_binary(FILE *file, my_image *image);
+bool save_image(FILE *file, my_image *image, enum save_format format);
 
 #endif /* IMAGE_UTTILS_ */
@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <string.h>
+#include "kernel_utils.h"
+
+#define POWER_OF_TWO(div) (((div) & ((div) - 1)) == 0)
+
+//  adds the tap of coefficient c of a kernel divided by div to the sum s,
+//  the conditions are constants so only one branch is compiled: zero taps
+//  vanish and taps of 1 or -1 are a plain add or subtract; a divisor that
+//  is a power of two is taken out of the sum (see SCALE), any other one is
+//  folded in the coefficient, which stays on the tap: the sum of the taps
+//  would round differently than the sum of the divided taps
+#define TAP(s, c, div, v) \
+	do { \
+		if ((c) == 0) \
+			break; \
+		if (!POWER_OF_TWO(div)) \
+			(s) += (v) * ((double)(c) / (div)); \
+		else if ((c) == 1) \
+			(s) += (v); \
+		else if ((c) == -1) \
+			(s) -= (v); \
+		else \
+			(s) += (c) * (v); \
+	} while (0)
+
+//  divides the sum by a power of two divisor, exact so the result is the
+//  same as dividing every tap
+#define SCALE(s, div) \
+	do { \
+		if (POWER_OF_TWO(div) && (div) > 1) \
+			(s) *= 1.0 / (div); \
+	} while (0)
+
+//  handles values outside the desired [min, max] interval
+static inline double clamp(double x, double min, double max)
+{
+	if (x < min)
+		return min;
+
+	if (x > max)
+		return max;
+
+	return x;
+}
+
+//  generates the kernel of a table entry, filter_<name>
+#define ROW_KERNEL(name, c00, c01, c02, c10, c11, c12, c20, c21, c22, div) \
+static void filter_##name(double *out, double **p, int i, int begin, \
+						  int end, double max) \
+{ \
+	const double *up = p[i - 1], *row = p[i], *down = p[i + 1]; \
+\
+	for (int j = begin; j < end; ++j) { \
+		double s = 0; \
+\
+		TAP(s, c00, div, up[j - 1]); \
+		TAP(s, c01, div, up[j]); \
+		TAP(s, c02, div, up[j + 1]); \
+		TAP(s, c10, div, row[j - 1]); \
+		TAP(s, c11, div, row[j]); \
+		TAP(s, c12, div, row[j + 1]); \
+		TAP(s, c20, div, down[j - 1]); \
+		TAP(s, c21, div, down[j]); \
+		TAP(s, c22, div, down[j + 1]); \
+		SCALE(s, div); \
+\
+		out[j] = clamp(s, 0, max); \
+	} \
+}
+
+FIXED_KERNELS(ROW_KERNEL)
+
+//  name of a fixed filter and its kernel
+typedef struct {
+	const char *name;
+	kernel_row row;
+} fixed_kernel;
+
+#define KERNEL_ENTRY(name, ...) {#name, filter_##name},
+
+static const fixed_kernel kernels[] = {
+	FIXED_KERNELS(KERNEL_ENTRY)
+};
+
+//  finds the kernel of the fixed filter the parameter starts with,
+//  returns NULL if it names none of them
+kernel_row find_fixed_kernel(char *name)
+{
+	int count = sizeof(kernels) / sizeof(kernels[0]);
+
+	for (int k = 0; k < count; ++k)
+		if (!strncmp(name, kernels[k].name, strlen(kernels[k].name)))
+			return kernels[k].row;
+
+	return NULL;
+}
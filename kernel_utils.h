@@ -0,0 +1,20 @@
+#ifndef KERNEL_UTTILS_
+#define KERNEL_UTTILS_
+
+//  fixed 3x3 filters of APPLY, in the order their names are matched: the
+//  name, the coefficients row by row, then the divisor of all of them;
+//  every entry gets a kernel of its own (see kernel_utils.c)
+#define FIXED_KERNELS(KERNEL) \
+	KERNEL(EDGE, -1, -1, -1, -1, 8, -1, -1, -1, -1, 1) \
+	KERNEL(SHARPEN, 0, -1, 0, -1, 5, -1, 0, -1, 0, 1) \
+	KERNEL(BLUR, 1, 1, 1, 1, 1, 1, 1, 1, 1, 9) \
+	KERNEL(GAUSSIAN_BLUR, 1, 2, 1, 2, 4, 2, 1, 2, 1, 16)
+
+//  filters the pixels [begin, end) of row i of a plane in out, clamped to
+//  [0, max]; the rows above and below must exist
+typedef void (*kernel_row)(double *out, double **p, int i, int begin,
+						   int end, double max);
+
+kernel_row find_fixed_kernel(char *name);
+
+#endif /* KERNEL_UTTILS_ */
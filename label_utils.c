@@ -0,0 +1,293 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include "label_utils.h"
+#include "bitmap_utils.h"
+#include "memory_utils.h"
+#include "worker_utils.h"
+
+//  labeling of the selection of a bitmap: the set pixels of every row are
+//  stored as runs [start, end), the runs of row i are first[i] to
+//  first[i + 1] - 1, runs of a component share a root in parent
+typedef struct {
+	uint64_t **rows;
+	my_select *select;
+	//  runs touching diagonally are connected
+	bool diagonal;
+	size_t *first;
+	int *start;
+	int *end;
+	size_t *parent;
+	//  rows already connected to the one above
+	bool *merged;
+} label_job;
+
+//  gets the selected pixels of a row from pixel x1 + 64 * k, the ones past
+//  the selection are 0
+static inline uint64_t selected_word(label_job *job, uint64_t *row, int k)
+{
+	my_select *s = job->select;
+	int x = s->x1 + 64 * k;
+	int q = x >> 6, r = x & 63;
+	int words = BITMAP_WORDS(s->x2);
+
+	uint64_t word = row[q] << r;
+	if (r && q + 1 < words)
+		word |= row[q + 1] >> (64 - r);
+
+	if (s->x2 - x < 64)
+		word &= ~(~0ULL >> (s->x2 - x));
+
+	return word;
+}
+
+//  worker task, counts the runs of a band of rows: a run starts at every
+//  set pixel whose left neighbour is not set
+static void count_runs(void *arg, int begin, int end, int worker)
+{
+	label_job *job = arg;
+	my_select *s = job->select;
+	int words = BITMAP_WORDS(s->x2 - s->x1);
+
+	(void)worker;
+
+	for (int i = begin; i < end; ++i) {
+		uint64_t *row = job->rows[s->y1 + i];
+		uint64_t last = 0;
+		size_t count = 0;
+
+		for (int k = 0; k < words; ++k) {
+			uint64_t word = selected_word(job, row, k);
+
+			count += __builtin_popcountll(word & ~((word >> 1) | last));
+			last = word << 63;
+		}
+
+		job->first[i + 1] = count;
+	}
+}
+
+//  stores the runs of a row, a word at a time: leading zeros find where
+//  the current run (or gap) ends
+static void find_runs(label_job *job, int i)
+{
+	my_select *s = job->select;
+	uint64_t *row = job->rows[s->y1 + i];
+	int words = BITMAP_WORDS(s->x2 - s->x1);
+	size_t n = job->first[i];
+	bool inside = false;
+
+	for (int k = 0; k < words; ++k) {
+		uint64_t word = selected_word(job, row, k);
+		int pos = 0;
+
+		while (pos < 64) {
+			uint64_t rest = (inside ? ~word : word) << pos;
+
+			if (!rest)
+				break;
+
+			pos += __builtin_clzll(rest);
+
+			if (inside) {
+				job->end[n++] = s->x1 + 64 * k + pos;
+			} else {
+				job->start[n] = s->x1 + 64 * k + pos;
+				job->parent[n] = n;
+			}
+
+			inside = !inside;
+		}
+	}
+
+	//  the last run reaches the selection's edge
+	if (inside)
+		job->end[n] = s->x2;
+}
+
+//  finds the root of a run, halving its path
+static size_t find_root(size_t *parent, size_t i)
+{
+	while (parent[i] != i) {
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	}
+
+	return i;
+}
+
+//  joins the components of 2 runs, the root stays the earlier run
+static void join_runs(size_t *parent, size_t a, size_t b)
+{
+	a = find_root(parent, a);
+	b = find_root(parent, b);
+
+	if (a < b)
+		parent[b] = a;
+	else if (b < a)
+		parent[a] = b;
+}
+
+//  joins the runs of row i with the ones of row i - 1 they touch, walking
+//  both rows like a merge
+static void connect_rows(label_job *job, int i)
+{
+	size_t p = job->first[i - 1], p_end = job->first[i];
+	size_t q = job->first[i], q_end = job->first[i + 1];
+	int d = job->diagonal;
+
+	while (p < p_end && q < q_end) {
+		if (job->start[p] < job->end[q] + d && job->start[q] < job->end[p] + d)
+			join_runs(job->parent, p, q);
+
+		if (job->end[p] < job->end[q])
+			p++;
+		else
+			q++;
+	}
+}
+
+//  worker task, stores the runs of a band of rows and joins the ones of
+//  consecutive rows in it (bands only touch their own runs)
+static void label_band(void *arg, int begin, int end, int worker)
+{
+	label_job *job = arg;
+
+	(void)worker;
+
+	for (int i = begin; i < end; ++i) {
+		find_runs(job, i);
+
+		if (i > begin) {
+			connect_rows(job, i);
+			job->merged[i] = true;
+		}
+	}
+}
+
+//  frees the components
+void free_components(components *c)
+{
+	mem_free(c->blobs);
+	c->blobs = NULL;
+	c->count = 0;
+}
+
+//  labels the components of set pixels of the selection of a black & white
+//  image (4 or 8 connected), two passes over run-length encoded rows:
+//  worker threads label bands of rows, the first rows of the bands are
+//  joined to the ones above, then every run gets the number of its
+//  component, returns false if memory is exhausted
+bool label_components(my_image *image, int connectivity, components *c)
+{
+	label_job job;
+	my_select *s = image->select;
+	int height = s->y2 - s->y1;
+
+	job.rows = ((bit_img *)image->img)->rows;
+	job.select = s;
+	job.diagonal = connectivity == 8;
+	job.first = mem_alloc(sizeof(size_t) * (height + 1), MEM_SCRATCH);
+	job.merged = mem_alloc(sizeof(bool) * height, MEM_SCRATCH);
+
+	c->count = 0;
+	c->blobs = NULL;
+
+	if (!job.first || !job.merged) {
+		mem_free(job.first);
+		mem_free(job.merged);
+		return false;
+	}
+
+	//  count the runs of every row to place them
+	job.first[0] = 0;
+	workers_run(height, count_runs, &job);
+
+	for (int i = 0; i < height; ++i)
+		job.first[i + 1] += job.first[i];
+
+	size_t runs = job.first[height];
+	job.start = mem_alloc(sizeof(int) * runs + 1, MEM_SCRATCH);
+	job.end = mem_alloc(sizeof(int) * runs + 1, MEM_SCRATCH);
+	job.parent = mem_alloc(sizeof(size_t) * runs + 1, MEM_SCRATCH);
+
+	if (!job.start || !job.end || !job.parent) {
+		mem_free(job.first);
+		mem_free(job.merged);
+		mem_free(job.start);
+		mem_free(job.end);
+		mem_free(job.parent);
+		return false;
+	}
+
+	memset(job.merged, 0, sizeof(bool) * height);
+	workers_run(height, label_band, &job);
+
+	//  join the bands
+	for (int i = 1; i < height; ++i)
+		if (!job.merged[i])
+			connect_rows(&job, i);
+
+	//  a run's parent comes before it, so in order every parent already
+	//  holds its component's number
+	for (size_t r = 0; r < runs; ++r)
+		job.parent[r] = job.parent[r] == r ? c->count++ :
+						job.parent[job.parent[r]];
+
+	c->blobs = mem_alloc(sizeof(blob) * c->count + 1, MEM_SCRATCH);
+	if (!c->blobs) {
+		c->count = 0;
+		mem_free(job.first);
+		mem_free(job.merged);
+		mem_free(job.start);
+		mem_free(job.end);
+		mem_free(job.parent);
+		return false;
+	}
+
+	for (size_t b = 0; b < c->count; ++b)
+		c->blobs[b] = (blob){0, s->x2, s->y2, s->x1, s->y1, 0, 0};
+
+	for (int i = 0; i < height; ++i) {
+		int y = s->y1 + i;
+
+		for (size_t r = job.first[i]; r < job.first[i + 1]; ++r) {
+			blob *b = &c->blobs[job.parent[r]];
+			int len = job.end[r] - job.start[r];
+
+			b->area += len;
+			b->sum_x += (double)len * (job.start[r] + job.end[r] - 1) / 2;
+			b->sum_y += (double)len * y;
+
+			b->x1 = job.start[r] < b->x1 ? job.start[r] : b->x1;
+			b->x2 = job.end[r] > b->x2 ? job.end[r] : b->x2;
+			b->y1 = y < b->y1 ? y : b->y1;
+			b->y2 = y + 1 > b->y2 ? y + 1 : b->y2;
+		}
+	}
+
+	mem_free(job.first);
+	mem_free(job.merged);
+	mem_free(job.start);
+	mem_free(job.end);
+	mem_free(job.parent);
+	return true;
+}
+
+//  prints the components as CSV: their number, area, bounding box (like
+//  a selection) and centroid
+void print_components(FILE *file, components *c)
+{
+	fprintf(file, "label,area,x1,y1,x2,y2,cx,cy\n");
+
+	for (size_t i = 0; i < c->count; ++i) {
+		blob *b = &c->blobs[i];
+
+		fprintf(file, "%zu,%" PRIu64 ",%d,%d,%d,%d,%.2f,%.2f\n", i + 1,
+				b->area, b->x1, b->y1, b->x2, b->y2, b->sum_x / b->area,
+				b->sum_y / b->area);
+	}
+}
@@ -0,0 +1,33 @@
+#ifndef LABEL_UTTILS_
+#define LABEL_UTTILS_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "image_utils.h"
+
+//  a connected set of set pixels: its area, bounding box [x1, x2) x
+//  [y1, y2) and the sums of its pixels' coordinates
+typedef struct {
+	uint64_t area;
+	int x1;
+	int y1;
+	int x2;
+	int y2;
+	double sum_x;
+	double sum_y;
+} blob;
+
+//  components of the selection, in the order of their first pixel
+typedef struct {
+	size_t count;
+	blob *blobs;
+} components;
+
+bool label_components(my_image *image, int connectivity, components *c);
+
+void free_components(components *c);
+
+void print_components(FILE *file, components *c);
+
+#endif /* LABEL_UTTILS_ */
@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "lut_utils.h"
+#include "memory_utils.h"
+#include "bitmap_utils.h"
+#include "worker_utils.h"
+
+//  pass of a lookup table over the selection of an image
+typedef struct {
+	double **planes[3];
+	my_select *select;
+	lut *t;
+} lut_job;
+
+//  allocs identity tables for the channels of an image (a black & white
+//  image has one table of 2 values, indexed by intensity: 0 is black, so
+//  a set bit), returns false if memory is exhausted
+bool lut_init(lut *t, my_image *image)
+{
+	double **planes[3];
+
+	t->channels = image_planes(image, planes);
+	t->size = image->pixel_value + 1;
+
+	if (image->img_type == BLACK_WHITE)
+		t->channels = 1;
+
+	for (int c = 0; c < 3; ++c)
+		t->table[c] = NULL;
+
+	for (int c = 0; c < t->channels; ++c) {
+		t->table[c] = mem_alloc(sizeof(double) * t->size, MEM_SCRATCH);
+		if (!t->table[c]) {
+			lut_free(t);
+			return false;
+		}
+
+		for (int v = 0; v < t->size; ++v)
+			t->table[c][v] = v;
+	}
+
+	return true;
+}
+
+//  frees the tables
+void lut_free(lut *t)
+{
+	for (int c = 0; c < 3; ++c) {
+		mem_free(t->table[c]);
+		t->table[c] = NULL;
+	}
+}
+
+//  worker task, looks up the selected pixels of a band of rows
+static void lut_band(void *arg, int begin, int end, int worker)
+{
+	lut_job *job = arg;
+	my_select *s = job->select;
+	int last = job->t->size - 1;
+
+	(void)worker;
+
+	for (int c = 0; c < job->t->channels; ++c) {
+		double *table = job->t->table[c];
+
+		for (int i = s->y1 + begin; i < s->y1 + end; ++i) {
+			double *row = job->planes[c][i];
+
+			//  pixels are rounded to the nearest value, like when saved
+			for (int j = s->x1; j < s->x2; ++j) {
+				int v = (int)(row[j] + 0.5);
+				row[j] = table[v < 0 ? 0 : v > last ? last : v];
+			}
+		}
+	}
+}
+
+//  replaces every selected pixel with its value in the table of its channel,
+//  in one pass split in row bands between the worker threads
+void lut_apply(my_image *image, lut *t)
+{
+	lut_job job;
+	my_select *s = image->select;
+
+	//  a table of bits either keeps, flips, clears or sets them; a bit's
+	//  intensity is 1 - bit (a set bit is black), so is the new bit of
+	//  its new intensity
+	if (image->img_type == BLACK_WHITE) {
+		uint64_t **rows = ((bit_img *)image->img)->rows;
+		int zero = t->table[0][1] < 0.5;
+		int one = t->table[0][0] < 0.5;
+
+		if (zero == one)
+			fill_bitmap(rows, s->x1, s->y1, s->x2, s->y2, one);
+		else if (zero)
+			invert_bitmap(rows, s->x1, s->y1, s->x2, s->y2);
+		return;
+	}
+
+	image_planes(image, job.planes);
+	job.select = s;
+	job.t = t;
+
+	workers_run(s->y2 - s->y1, lut_band, &job);
+}
@@ -0,0 +1,21 @@
+#ifndef LUT_UTTILS_
+#define LUT_UTTILS_
+
+#include <stdbool.h>
+#include "image_utils.h"
+
+//  lookup table of every channel of an image: pixel value v of channel c
+//  becomes table[c][v], for v from 0 to the image's max pixel value
+typedef struct lut {
+	int channels;
+	int size;
+	double *table[3];
+} lut;
+
+bool lut_init(lut *t, my_image *image);
+
+void lut_free(lut *t);
+
+void lut_apply(my_image *image, lut *t);
+
+#endif /* LUT_UTTILS_ */
@@ -1,44 +1,177 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <string.h>
 #include <math.h>
 #include "matrix_utils.h"
+#include "memory_utils.h"
+#include "numa_utils.h"
 #include "utils.h"
 
-//  allocs memory for a double matrix
-double **alloc_matrix(int n, int m)
+//  allocs a double matrix in the given category as one block:
+//  the row pointers followed by the rows stored contiguously
+double **alloc_matrix_in(int n, int m, enum mem_category category)
 {
-	double **a = (double **)malloc(sizeof(double *) * n);
-	DIE(!a, "malloc a");
+	//  keep the first row aligned to a cache line
+	size_t rows_size = (sizeof(double *) * n + 63) & ~(size_t)63;
+	size_t data_size = sizeof(double) * n * m;
 
-	for (int i = 0; i < n; ++i) {
-		a[i] = (double *)malloc(sizeof(double) * m);
-		DIE(!a[i], "malloc a[i]");
-	}
+	double **a = mem_alloc(rows_size + data_size, category);
+	if (!a)
+		return NULL;
+
+	double *data = (double *)((char *)a + rows_size);
+	for (int i = 0; i < n; ++i)
+		a[i] = data + (size_t)i * m;
+
+	//  rows go to the nodes of the workers that will work on them
+	numa_touch_rows((char *)data, n, sizeof(double) * m, false);
+
+	return a;
+}
+
+//  bytes of the block of a n x m matrix (row pointers and rows)
+size_t matrix_block_size(int n, int m)
+{
+	return ((sizeof(double *) * n + 63) & ~(size_t)63) +
+		   sizeof(double) * n * m;
+}
+
+//  maps the block of a n x m pixel matrix stored in a file (see mem_map),
+//  only the row pointers are rewritten, returns NULL if it can't be mapped
+double **map_matrix(int fd, off_t offset, int n, int m)
+{
+	size_t rows_size = (sizeof(double *) * n + 63) & ~(size_t)63;
+
+	double **a = mem_map(fd, offset, matrix_block_size(n, m), MEM_PLANES);
+	if (!a)
+		return NULL;
+
+	double *data = (double *)((char *)a + rows_size);
+	for (int i = 0; i < n; ++i)
+		a[i] = data + (size_t)i * m;
 
 	return a;
 }
 
+//  allocs memory for a pixel matrix, returns NULL if memory is exhausted
+double **alloc_matrix(int n, int m)
+{
+	return alloc_matrix_in(n, m, MEM_PLANES);
+}
+
+//  allocs memory for a temporary matrix, returns NULL if memory is exhausted
+double **alloc_scratch_matrix(int n, int m)
+{
+	return alloc_matrix_in(n, m, MEM_SCRATCH);
+}
+
+//  copies a matrix in a new one of the given category
+double **copy_matrix(double **a, int n, int m, enum mem_category category)
+{
+	double **copy = alloc_matrix_in(n, m, category);
+	if (!copy)
+		return NULL;
+
+	//  rows are stored contiguously
+	memcpy(copy[0], a[0], sizeof(double) * n * m);
+
+	return copy;
+}
+
 //  frees the memory allocated for a double matrix
 void free_matrix(double **a, int n)
 {
-	for (int i = 0; i < n; ++i)
-		free(a[i]);
+	//  rows live in the same block as the row pointers
+	(void)n;
 
-	free(a);
+	mem_free(a);
 	a = NULL;
 }
 
-//  loads the pixel matrix from a binary file
-void b_load(FILE *file, double **a, int n, int m)
+//  number of bytes of a binary sample for the given max pixel value
+static int sample_bytes(int max)
+{
+	return max > 255 ? 2 : 1;
+}
+
+//  decodes count samples (1 byte or 2 bytes big endian) read from a file,
+//  keeping every step-th one starting with the first
+static void decode_samples(unsigned char *buffer, double *row, int count,
+						   int step, int bytes)
+{
+	if (bytes == 1) {
+		for (int j = 0; j < count; ++j)
+			row[j] = (double)buffer[j * step];
+		return;
+	}
+
+	//  combining the 2 bytes swaps them independently of the host's order
+	for (int j = 0; j < count; ++j) {
+		unsigned char *sample = buffer + 2 * j * step;
+		row[j] = (double)((sample[0] << 8) | sample[1]);
+	}
+}
+
+//  encodes count rounded samples (1 byte or 2 bytes big endian) to be
+//  written to a file, every step-th one starting with the first
+static void encode_samples(double *row, unsigned char *buffer, int count,
+						   int step, int bytes)
 {
+	if (bytes == 1) {
+		for (int j = 0; j < count; ++j)
+			buffer[j * step] = round(row[j]);
+		return;
+	}
+
+	for (int j = 0; j < count; ++j) {
+		unsigned int value = round(row[j]);
+		unsigned char *sample = buffer + 2 * j * step;
+
+		sample[0] = value >> 8;
+		sample[1] = value;
+	}
+}
+
+//  bytes of a row of m pixels of the given number of channels in a binary
+//  file
+size_t b_row_size(int m, int channels, int max)
+{
+	return (size_t)m * channels * sample_bytes(max);
+}
+
+//  encodes row i of the planes as a binary file stores it: the samples of
+//  a pixel are interleaved, 1 or 2 bytes each (see b_row_size)
+void b_encode_row(double **planes[3], int channels, int i, int m, int max,
+				  unsigned char *buffer)
+{
+	int bytes = sample_bytes(max);
+
+	for (int c = 0; c < channels; ++c)
+		encode_samples(planes[c][i], buffer + c * bytes, m, channels, bytes);
+}
+
+//  loads the pixel matrix from a binary file, a row at a time,
+//  returns LOAD_NO_FILE if the file ends before the last row
+enum load_status b_load(FILE *file, double **a, int n, int m, int max)
+{
+	int bytes = sample_bytes(max);
+
+	unsigned char *buffer = mem_alloc((size_t)m * bytes, MEM_IO);
+	if (!buffer)
+		return LOAD_NO_MEMORY;
+
 	for (int i = 0; i < n; ++i) {
-		for (int j = 0; j < m; ++j) {
-			unsigned char pixel;
-			fread(&pixel, sizeof(unsigned char), 1, file);
-			a[i][j] = (double)pixel;
+		if (fread(buffer, bytes, m, file) != (size_t)m) {
+			mem_free(buffer);
+			return LOAD_NO_FILE;
 		}
+
+		decode_samples(buffer, a[i], m, 1, bytes);
 	}
+
+	mem_free(buffer);
+	return LOAD_OK;
 }
 
 //  loads the pixel matrix from a text file
@@ -53,22 +186,31 @@ void t_load(FILE *file, double **a, int n, int m)
 	}
 }
 
-//  loads the color channels matrices from a binary file
-void b_3_load(FILE *file, double **a, double **b, double **c, int n, int m)
+//  loads the color channels matrices from a binary file, a row at a time,
+//  returns LOAD_NO_FILE if the file ends before the last row
+enum load_status b_3_load(FILE *file, double **a, double **b, double **c,
+						  int n, int m, int max)
 {
-	for (int i = 0; i < n; ++i) {
-		for (int j = 0; j < m * 3; j += 3) {
-			unsigned char pixel1, pixel2, pixel3;
-			fread(&pixel1, sizeof(unsigned char), 1, file);
-			a[i][j / 3] = (double)pixel1;
+	int bytes = sample_bytes(max);
 
-			fread(&pixel2, sizeof(unsigned char), 1, file);
-			b[i][j / 3] = (double)pixel2;
+	unsigned char *buffer = mem_alloc((size_t)m * 3 * bytes, MEM_IO);
+	if (!buffer)
+		return LOAD_NO_MEMORY;
 
-			fread(&pixel3, sizeof(unsigned char), 1, file);
-			c[i][j / 3] = (double)pixel3;
+	for (int i = 0; i < n; ++i) {
+		if (fread(buffer, bytes, m * 3, file) != (size_t)m * 3) {
+			mem_free(buffer);
+			return LOAD_NO_FILE;
 		}
+
+		//  samples are interleaved: red, green, blue
+		decode_samples(buffer, a[i], m, 3, bytes);
+		decode_samples(buffer + bytes, b[i], m, 3, bytes);
+		decode_samples(buffer + 2 * bytes, c[i], m, 3, bytes);
 	}
+
+	mem_free(buffer);
+	return LOAD_OK;
 }
 
 //  loads the color channels matrices from a text file
@@ -93,6 +235,9 @@ void t_3_load(FILE *file, double **a, double **b, double **c, int n, int m)
 double **crop_matrix(double **a, int x1, int y1, int x2, int y2)
 {
 	double **crop = alloc_matrix(y2 - y1, x2 - x1);
+	if (!crop)
+		return NULL;
+
 	for (int i = 0; i < y2 - y1; ++i)
 		for (int j = 0; j < x2 - x1; ++j)
 			crop[i][j] = a[i + y1][j + x1];
@@ -149,6 +294,8 @@ void rotate_270_inplace(double **a, int x1, int y1, int n)
 double **rotate_90(double **a, int n, int m)
 {
 	double **rotate = alloc_matrix(m, n);
+	if (!rotate)
+		return NULL;
 
 	for (int i = 0; i < n; ++i)
 		for (int j = 0; j < m; ++j)
@@ -161,6 +308,8 @@ double **rotate_90(double **a, int n, int m)
 double **rotate_180(double **a, int n, int m)
 {
 	double **rotate = alloc_matrix(n, m);
+	if (!rotate)
+		return NULL;
 
 	for (int i = 0; i < n; ++i)
 		for (int j = 0; j < m; ++j)
@@ -173,6 +322,8 @@ double **rotate_180(double **a, int n, int m)
 double **rotate_270(double **a, int n, int m)
 {
 	double **rotate = alloc_matrix(m, n);
+	if (!rotate)
+		return NULL;
 
 	for (int i = 0; i < n; ++i)
 		for (int j = 0; j < m; ++j)
@@ -210,28 +361,47 @@ void t_3_print(FILE *file, double **a, double **b, double **c, int n, int m)
 	}
 }
 
-//  prints pixel matrix to binary file
-void b_print(FILE *file, double **a, int n, int m)
+//  prints pixel matrix to binary file, a row at a time,
+//  returns false if memory is exhausted or a row can't be written
+bool b_print(FILE *file, double **a, int n, int m, int max)
 {
-	for (int i = 0; i < n; ++i)
-		for (int j = 0; j < m; ++j) {
-			unsigned char p_a = round(a[i][j]);
-			fwrite(&p_a, sizeof(unsigned char), 1, file);
-		}
+	int bytes = sample_bytes(max);
+
+	unsigned char *buffer = mem_alloc((size_t)m * bytes, MEM_IO);
+	if (!buffer)
+		return false;
+
+	bool written = true;
+	for (int i = 0; i < n && written; ++i) {
+		encode_samples(a[i], buffer, m, 1, bytes);
+		written = fwrite(buffer, bytes, m, file) == (size_t)m;
+	}
+
+	mem_free(buffer);
+	return written;
 }
 
-//  prints color channels matrices to binary file
-void b_3_print(FILE *file, double **a, double **b, double **c, int n, int m)
+//  prints color channels matrices to binary file, a row at a time,
+//  returns false if memory is exhausted or a row can't be written
+bool b_3_print(FILE *file, double **a, double **b, double **c, int n, int m,
+			   int max)
 {
-	for (int i = 0; i < n; ++i) {
-		for (int j = 0; j < m; ++j) {
-			unsigned char p_a = round(a[i][j]);
-			unsigned char p_b = round(b[i][j]);
-			unsigned char p_c = round(c[i][j]);
+	int bytes = sample_bytes(max);
 
-			fwrite(&p_a, sizeof(unsigned char), 1, file);
-			fwrite(&p_b, sizeof(unsigned char), 1, file);
-			fwrite(&p_c, sizeof(unsigned char), 1, file);
-		}
+	unsigned char *buffer = mem_alloc((size_t)m * 3 * bytes, MEM_IO);
+	if (!buffer)
+		return false;
+
+	bool written = true;
+	for (int i = 0; i < n && written; ++i) {
+		//  interleave the samples: red, green, blue
+		encode_samples(a[i], buffer, m, 3, bytes);
+		encode_samples(b[i], buffer + bytes, m, 3, bytes);
+		encode_samples(c[i], buffer + 2 * bytes, m, 3, bytes);
+
+		written = fwrite(buffer, bytes, m * 3, file) == (size_t)m * 3;
 	}
+
+	mem_free(buffer);
+	return written;
 }
@@ -1,15 +1,31 @@
 #ifndef MATRIX_UTTILS_
 #define MATRIX_UTTILS_
 
+#include <stdio.h>
+#include <stdbool.h>
+#include "memory_utils.h"
+#include "image_utils.h"
+
+double **alloc_matrix_in(int n, int m, enum mem_category category);
+
 double **alloc_matrix(int n, int m);
 
+double **alloc_scratch_matrix(int n, int m);
+
+size_t matrix_block_size(int n, int m);
+
+double **map_matrix(int fd, off_t offset, int n, int m);
+
+double **copy_matrix(double **a, int n, int m, enum mem_category category);
+
 void free_matrix(double **a, int n);
 
-void b_load(FILE *file, double **a, int n, int m);
+enum load_status b_load(FILE *file, double **a, int n, int m, int max);
 
 void t_load(FILE *file, double **a, int n, int m);
 
-void b_3_load(FILE *file, double **a, double **b, double **c, int n, int m);
+enum load_status b_3_load(FILE *file, double **a, double **b, double **c,
+						  int n, int m, int max);
 
 void t_3_load(FILE *file, double **a, double **b, double **c, int n, int m);
 
@@ -31,8 +47,14 @@ void t_print(FILE *file, double **a, int n, int m);
 
 void t_3_print(FILE *file, double **a, double **b, double **c, int n, int m);
 
-void b_print(FILE *file, double **a, int n, int m);
+size_t b_row_size(int m, int channels, int max);
+
+void b_encode_row(double **planes[3], int channels, int i, int m, int max,
+				  unsigned char *buffer);
+
+bool b_print(FILE *file, double **a, int n, int m, int max);
 
-void b_3_print(FILE *file, double **a, double **b, double **c, int n, int m);
+bool b_3_print(FILE *file, double **a, double **b, double **c, int n, int m,
+			   int max);
 
 #endif /* MATRIX_UTTILS_ */
@@ -0,0 +1,318 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "median_utils.h"
+#include "matrix_utils.h"
+#include "bitmap_utils.h"
+#include "memory_utils.h"
+#include "worker_utils.h"
+
+//  8 bit samples: 16 coarse bins of 16 fine bins
+#define COARSE_8 16
+#define FINE_8 256
+#define BUCKET_8 16
+
+//  16 bit samples: 256 coarse bins of 256 fine bins
+#define COARSE_16 256
+#define FINE_16 65536
+#define BUCKET_16 256
+
+//  median filter of a plane over the selection, split in vertical stripes
+typedef struct {
+	//  rounded pixels of the plane's rows [top, bottom)
+	uint16_t *src;
+	int top;
+	int bottom;
+	int height;
+	int width;
+	//  filtered plane
+	double **dst;
+	my_select *select;
+	int radius;
+	//  max pixel value
+	int max;
+	//  histograms of each worker, buffer_size counters from buffers
+	void *buffers;
+	size_t buffer_size;
+} median_job;
+
+//  checks the parameter of APPLY MEDIAN <radius>
+bool get_median_radius(char *args, int *radius)
+{
+	char *end;
+
+	if (strncmp(args, "MEDIAN ", sizeof("MEDIAN ") - 1))
+		return false;
+
+	args += sizeof("MEDIAN ") - 1;
+	long r = strtol(args, &end, 10);
+
+	if (end == args || *end || r < 1 || r > MAX_MEDIAN_RADIUS)
+		return false;
+
+	*radius = (int)r;
+	return true;
+}
+
+//  gets a rounded source pixel, the image's edges are repeated
+static inline int src_pixel(median_job *job, int y, int x)
+{
+	y = y < 0 ? 0 : y >= job->height ? job->height - 1 : y;
+	x = x < 0 ? 0 : x >= job->width ? job->width - 1 : x;
+
+	return job->src[(size_t)(y - job->top) * job->width + x];
+}
+
+//  finds the value of the given rank (0 is the smallest) in a two level
+//  histogram: coarse bin b counts the values of fine bins b * bucket to
+//  (b + 1) * bucket - 1
+static int find_rank(uint32_t *coarse, uint32_t *fine, int bucket,
+					 uint32_t rank)
+{
+	int b = 0;
+
+	while (coarse[b] <= rank)
+		rank -= coarse[b++];
+
+	int v = b * bucket;
+	while (fine[v] <= rank)
+		rank -= fine[v++];
+
+	return v;
+}
+
+//  Perreault-Hebert median for 8 bit samples: every column of the stripe
+//  keeps the histogram of its 2r + 1 rows around the current row, the
+//  window's histogram slides right by adding a column and removing one
+static void median_stripe_8(median_job *job, int begin, int end, int worker)
+{
+	my_select *s = job->select;
+	int r = job->radius;
+	int xs = s->x1 + begin, xe = s->x1 + end;
+	int columns = xe - xs + 2 * r;
+	uint32_t rank = (uint32_t)(2 * r + 1) * (2 * r + 1) / 2;
+
+	//  histograms of columns xs - r .. xe + r - 1, then the window's
+	uint16_t *col_fine = (uint16_t *)((char *)job->buffers +
+									  job->buffer_size * worker);
+	uint16_t *col_coarse = col_fine + (size_t)columns * FINE_8;
+	uint32_t fine[FINE_8], coarse[COARSE_8];
+
+	memset(col_fine, 0, sizeof(uint16_t) * columns * (FINE_8 + COARSE_8));
+
+	for (int c = 0; c < columns; ++c) {
+		for (int k = -r; k <= r; ++k) {
+			int v = src_pixel(job, s->y1 + k, xs - r + c);
+
+			col_fine[(size_t)c * FINE_8 + v]++;
+			col_coarse[(size_t)c * COARSE_8 + v / BUCKET_8]++;
+		}
+	}
+
+	for (int y = s->y1; y < s->y2; ++y) {
+		//  move every column down a row
+		if (y > s->y1) {
+			for (int c = 0; c < columns; ++c) {
+				int out = src_pixel(job, y - 1 - r, xs - r + c);
+				int in = src_pixel(job, y + r, xs - r + c);
+
+				col_fine[(size_t)c * FINE_8 + out]--;
+				col_coarse[(size_t)c * COARSE_8 + out / BUCKET_8]--;
+				col_fine[(size_t)c * FINE_8 + in]++;
+				col_coarse[(size_t)c * COARSE_8 + in / BUCKET_8]++;
+			}
+		}
+
+		//  window of the row's first pixel
+		memset(fine, 0, sizeof(fine));
+		memset(coarse, 0, sizeof(coarse));
+
+		for (int c = 0; c <= 2 * r; ++c) {
+			uint16_t *cf = col_fine + (size_t)c * FINE_8;
+			uint16_t *cc = col_coarse + (size_t)c * COARSE_8;
+
+			for (int v = 0; v < FINE_8; ++v)
+				fine[v] += cf[v];
+			for (int b = 0; b < COARSE_8; ++b)
+				coarse[b] += cc[b];
+		}
+
+		job->dst[y][xs] = find_rank(coarse, fine, BUCKET_8, rank);
+
+		//  slide right: whole histograms are merged (vectorized)
+		for (int x = xs + 1; x < xe; ++x) {
+			uint16_t *af = col_fine + (size_t)(x - xs + 2 * r) * FINE_8;
+			uint16_t *rf = col_fine + (size_t)(x - xs - 1) * FINE_8;
+			uint16_t *ac = col_coarse + (size_t)(x - xs + 2 * r) * COARSE_8;
+			uint16_t *rc = col_coarse + (size_t)(x - xs - 1) * COARSE_8;
+
+			for (int v = 0; v < FINE_8; ++v)
+				fine[v] += af[v] - rf[v];
+			for (int b = 0; b < COARSE_8; ++b)
+				coarse[b] += ac[b] - rc[b];
+
+			job->dst[y][x] = find_rank(coarse, fine, BUCKET_8, rank);
+		}
+	}
+}
+
+//  adds (d = 1) or removes (d = -1) the pixels of a window's row or column
+static void huang_update(median_job *job, uint32_t *coarse, uint32_t *fine,
+						 int y1, int x1, int y2, int x2, int d)
+{
+	for (int y = y1; y <= y2; ++y) {
+		for (int x = x1; x <= x2; ++x) {
+			int v = src_pixel(job, y, x);
+
+			fine[v] += d;
+			coarse[v / BUCKET_16] += d;
+		}
+	}
+}
+
+//  Huang median for 16 bit samples (column histograms would take too much
+//  memory): one window histogram snakes through the stripe, moving right
+//  on even rows and left on odd ones, updating 2r + 1 pixels per step
+static void median_stripe_16(median_job *job, int begin, int end, int worker)
+{
+	my_select *s = job->select;
+	int r = job->radius;
+	int xs = s->x1 + begin, xe = s->x1 + end;
+	uint32_t rank = (uint32_t)(2 * r + 1) * (2 * r + 1) / 2;
+
+	uint32_t *fine = (uint32_t *)((char *)job->buffers +
+								  job->buffer_size * worker);
+	uint32_t *coarse = fine + FINE_16;
+
+	memset(fine, 0, sizeof(uint32_t) * (FINE_16 + COARSE_16));
+	huang_update(job, coarse, fine, s->y1 - r, xs - r, s->y1 + r, xs + r, 1);
+
+	int x = xs;
+
+	for (int y = s->y1; y < s->y2; ++y) {
+		int step = (y - s->y1) % 2 ? -1 : 1;
+
+		//  move the window down a row
+		if (y > s->y1) {
+			huang_update(job, coarse, fine, y - 1 - r, x - r, y - 1 - r,
+						 x + r, -1);
+			huang_update(job, coarse, fine, y + r, x - r, y + r, x + r, 1);
+		}
+
+		while (true) {
+			job->dst[y][x] = find_rank(coarse, fine, BUCKET_16, rank);
+
+			if (x + step < xs || x + step >= xe)
+				break;
+
+			//  move the window a column
+			int out = step > 0 ? x - r : x + r;
+			int in = step > 0 ? x + r + 1 : x - r - 1;
+
+			huang_update(job, coarse, fine, y - r, out, y + r, out, -1);
+			huang_update(job, coarse, fine, y - r, in, y + r, in, 1);
+			x += step;
+		}
+	}
+}
+
+//  worker task, filters a vertical stripe of the selection
+static void median_stripe(void *arg, int begin, int end, int worker)
+{
+	median_job *job = arg;
+
+	if (job->max < FINE_8)
+		median_stripe_8(job, begin, end, worker);
+	else
+		median_stripe_16(job, begin, end, worker);
+}
+
+//  filters the selection of a plane, reading the rounded pixels of src
+static void median_plane(median_job *job, double **plane)
+{
+	for (int y = job->top; y < job->bottom; ++y) {
+		uint16_t *row = job->src + (size_t)(y - job->top) * job->width;
+
+		for (int x = 0; x < job->width; ++x) {
+			int v = (int)(plane[y][x] + 0.5);
+			row[x] = v < 0 ? 0 : v > job->max ? job->max : v;
+		}
+	}
+
+	job->dst = plane;
+	workers_run(job->select->x2 - job->select->x1, median_stripe, job);
+}
+
+//  replaces every selected pixel with the median of the (2r + 1) x (2r + 1)
+//  pixels around it (the image's edges are repeated),
+//  returns false if memory is exhausted
+bool apply_median(my_image *image, int radius)
+{
+	median_job job;
+	my_select *s = image->select;
+	double **planes[3];
+	int channels = image_planes(image, planes);
+
+	//  rows read by the windows of the selection
+	int top = s->y1 - radius < 0 ? 0 : s->y1 - radius;
+	int bottom = s->y2 + radius > image->height ?
+				 image->height : s->y2 + radius;
+
+	job.top = top;
+	job.bottom = bottom;
+	job.height = image->height;
+	job.width = image->width;
+	job.select = s;
+	job.radius = radius;
+	job.max = image->pixel_value;
+
+	//  histograms of every worker, for the widest stripe
+	int count = s->x2 - s->x1;
+	int bands = workers_count() < count ? workers_count() : count;
+	int stripe = (count + bands - 1) / bands;
+
+	if (job.max < FINE_8)
+		job.buffer_size = sizeof(uint16_t) * ((size_t)stripe + 2 * radius) *
+						  (FINE_8 + COARSE_8);
+	else
+		job.buffer_size = sizeof(uint32_t) * (FINE_16 + COARSE_16);
+
+	//  keep every worker's histograms on their own cache lines
+	job.buffer_size = (job.buffer_size + 63) & ~(size_t)63;
+
+	job.src = mem_alloc(sizeof(uint16_t) * (bottom - top) * image->width,
+						MEM_SCRATCH);
+	job.buffers = mem_alloc(job.buffer_size * bands, MEM_SCRATCH);
+
+	//  black & white pixels are filtered as 0/1 values
+	double **pixels = NULL;
+	if (image->img_type == BLACK_WHITE) {
+		pixels = unpack_bitmap(((bit_img *)image->img)->rows, image->height,
+							   image->width, MEM_SCRATCH);
+		planes[0] = pixels;
+		channels = 1;
+	}
+
+	if (!job.src || !job.buffers ||
+		(image->img_type == BLACK_WHITE && !pixels)) {
+		mem_free(job.src);
+		mem_free(job.buffers);
+		free_matrix(pixels, image->height);
+		return false;
+	}
+
+	for (int c = 0; c < channels; ++c)
+		median_plane(&job, planes[c]);
+
+	if (pixels) {
+		pack_bitmap(pixels, ((bit_img *)image->img)->rows, image->height,
+					image->width);
+		free_matrix(pixels, image->height);
+	}
+
+	mem_free(job.src);
+	mem_free(job.buffers);
+	return true;
+}
@@ -0,0 +1,14 @@
+#ifndef MEDIAN_UTTILS_
+#define MEDIAN_UTTILS_
+
+#include <stdbool.h>
+#include "image_utils.h"
+
+//  max radius of the median filter (column counts must fit 16 bits)
+#define MAX_MEDIAN_RADIUS 32767
+
+bool get_median_radius(char *args, int *radius);
+
+bool apply_median(my_image *image, int radius);
+
+#endif /* MEDIAN_UTTILS_ */
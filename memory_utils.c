@@ -0,0 +1,452 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "memory_utils.h"
+
+//  blocks of at least this size are page backed and recycled by the pool
+#define POOL_MIN_SIZE 4096
+
+//  huge pages are used for blocks of at least this size
+#define HUGE_PAGE_SIZE (2UL << 20)
+
+//  default number of bytes the pool may keep cached
+#define POOL_DEFAULT_CAPACITY (512UL << 20)
+
+//  bookkeeping stored in front of every tracked block
+typedef union {
+	struct {
+		//  bytes requested by the caller
+		size_t size;
+		//  bytes of the whole block (header included) for pooled blocks
+		size_t capacity;
+		enum mem_category category;
+		//  block is page backed and owned by the pool
+		bool pooled;
+		//  block is a private mapping of a file
+		bool mapped;
+		//  file of a mapped block
+		dev_t dev;
+		ino_t ino;
+		//  next cached block while sitting in the pool, or next mapped
+		//  block
+		void *next;
+	} info;
+	//  pads the header to a cache line (blocks are cache line aligned)
+	char align[MEM_HEADER_SIZE];
+} mem_header;
+
+//  usage counters of a single category
+typedef struct {
+	size_t live;
+	size_t peak;
+	size_t allocations;
+} mem_stats;
+
+//  plane pool state
+typedef struct {
+	//  freed page backed blocks ready for reuse
+	mem_header *cached;
+	//  bytes held by the cached blocks
+	size_t cached_bytes;
+	//  max bytes kept in the pool
+	size_t capacity;
+	//  requests served from the cache
+	size_t hits;
+	//  requests that had to map new pages
+	size_t misses;
+	//  back new large blocks with huge pages
+	bool huge_pages;
+} mem_pool;
+
+static const char *const category_names[MEM_CATEGORIES] = {
+	"planes", "scratch", "io", "cache"
+};
+
+static mem_stats stats[MEM_CATEGORIES];
+
+//  bytes currently allocated over all categories
+static size_t total_live;
+
+//  highest value reached by total_live
+static size_t total_peak;
+
+//  hard limit of the allocated and cached bytes (0 means unlimited)
+static size_t limit;
+
+//  called to free cached images when a block doesn't fit in the limit
+static mem_reclaimer reclaimer;
+
+static mem_pool pool = {NULL, 0, POOL_DEFAULT_CAPACITY, 0, 0, false};
+
+//  blocks mapped from files
+static mem_header *mapped_blocks;
+
+//  guards the counters and the pool (blocks are allocated by many threads)
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+//  rounds size up to a multiple of align (align is a power of 2)
+static size_t round_up(size_t size, size_t align)
+{
+	return (size + align - 1) & ~(align - 1);
+}
+
+//  maps a new page backed block of the given capacity
+static mem_header *map_block(size_t capacity)
+{
+	void *block = MAP_FAILED;
+
+	//  try explicit huge pages first, they may not be reserved
+	if (pool.huge_pages && capacity % HUGE_PAGE_SIZE == 0)
+		block = mmap(NULL, capacity, PROT_READ | PROT_WRITE,
+					 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+	if (block == MAP_FAILED) {
+		block = mmap(NULL, capacity, PROT_READ | PROT_WRITE,
+					 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (block == MAP_FAILED)
+			return NULL;
+
+		//  fall back to transparent huge pages
+		if (pool.huge_pages && capacity >= HUGE_PAGE_SIZE)
+			madvise(block, capacity, MADV_HUGEPAGE);
+	}
+
+	return block;
+}
+
+//  gets the capacity of the page backed block needed for size bytes
+static size_t block_capacity(size_t size)
+{
+	size_t capacity = sizeof(mem_header) + size;
+
+	if (pool.huge_pages && capacity >= HUGE_PAGE_SIZE)
+		return round_up(capacity, HUGE_PAGE_SIZE);
+
+	return round_up(capacity, (size_t)sysconf(_SC_PAGESIZE));
+}
+
+//  takes a cached block of a close enough capacity out of the pool
+static mem_header *pool_take(size_t capacity)
+{
+	mem_header **best = NULL;
+
+	//  size class: accept blocks up to 1/8 larger than needed
+	for (mem_header **it = &pool.cached; *it;
+		 it = (mem_header **)&(*it)->info.next) {
+		size_t c = (*it)->info.capacity;
+
+		if (c < capacity || c > capacity + capacity / 8)
+			continue;
+
+		if (!best || c < (*best)->info.capacity)
+			best = it;
+	}
+
+	if (!best)
+		return NULL;
+
+	mem_header *block = *best;
+	*best = block->info.next;
+	pool.cached_bytes -= block->info.capacity;
+
+	return block;
+}
+
+//  returns cached blocks to the system until at most keep bytes remain
+static void pool_trim(size_t keep)
+{
+	while (pool.cached && pool.cached_bytes > keep) {
+		mem_header *block = pool.cached;
+
+		pool.cached = block->info.next;
+		pool.cached_bytes -= block->info.capacity;
+		munmap(block, block->info.capacity);
+	}
+}
+
+//  checks if allocating size more bytes would go over the limit (lock held)
+static bool would_exceed(size_t size)
+{
+	if (!limit)
+		return false;
+
+	return total_live + size > limit;
+}
+
+//  checks if allocating size more bytes would go over the limit
+bool mem_would_exceed(size_t size)
+{
+	pthread_mutex_lock(&lock);
+	bool exceeds = would_exceed(size);
+	pthread_mutex_unlock(&lock);
+
+	return exceeds;
+}
+
+//  counts a new block of size bytes (lock held)
+static void count_block(size_t size, enum mem_category category)
+{
+	//  update category counters
+	mem_stats *s = &stats[category];
+	s->live += size;
+	s->allocations++;
+	if (s->live > s->peak)
+		s->peak = s->live;
+
+	//  update global counters
+	total_live += size;
+	if (total_live > total_peak)
+		total_peak = total_live;
+}
+
+//  gets a page backed block from the pool or maps a new one
+static mem_header *alloc_pooled(size_t size)
+{
+	size_t capacity = block_capacity(size);
+
+	mem_header *header = pool_take(capacity);
+	if (header) {
+		pool.hits++;
+		return header;
+	}
+
+	//  make room for the new block by dropping cached ones
+	if (limit && total_live + pool.cached_bytes + capacity > limit)
+		pool_trim(limit - total_live > capacity ?
+				  limit - total_live - capacity : 0);
+
+	header = map_block(capacity);
+	if (!header)
+		return NULL;
+
+	pool.misses++;
+	header->info.capacity = capacity;
+	return header;
+}
+
+//  allocates a tracked block, returns NULL if over the limit or out of memory
+void *mem_alloc(size_t size, enum mem_category category)
+{
+	mem_header *header;
+	bool pooled = size >= POOL_MIN_SIZE;
+
+	pthread_mutex_lock(&lock);
+
+	//  cached images give way to the block, they are freed without the
+	//  lock, which mem_free takes
+	while (would_exceed(size) && reclaimer) {
+		mem_reclaimer reclaim = reclaimer;
+		size_t needed = total_live + size - limit;
+
+		pthread_mutex_unlock(&lock);
+		size_t freed = reclaim(needed);
+		pthread_mutex_lock(&lock);
+
+		if (!freed)
+			break;
+	}
+
+	if (would_exceed(size)) {
+		pthread_mutex_unlock(&lock);
+		return NULL;
+	}
+
+	if (pooled)
+		header = alloc_pooled(size);
+	else
+		header = malloc(sizeof(mem_header) + size);
+
+	if (!header) {
+		pthread_mutex_unlock(&lock);
+		return NULL;
+	}
+
+	header->info.size = size;
+	header->info.category = category;
+	header->info.pooled = pooled;
+	header->info.mapped = false;
+	count_block(size, category);
+
+	pthread_mutex_unlock(&lock);
+
+	return header + 1;
+}
+
+//  maps size bytes of a file copy on write as a tracked block: the file
+//  keeps MEM_HEADER_SIZE bytes for the header at offset (page aligned),
+//  the block follows them; returns NULL if over the limit or if the file
+//  can't be mapped
+void *mem_map(int fd, off_t offset, size_t size, enum mem_category category)
+{
+	size_t capacity = round_up(sizeof(mem_header) + size,
+							   (size_t)sysconf(_SC_PAGESIZE));
+	struct stat st;
+
+	if (fstat(fd, &st))
+		return NULL;
+
+	pthread_mutex_lock(&lock);
+
+	if (would_exceed(size)) {
+		pthread_mutex_unlock(&lock);
+		return NULL;
+	}
+
+	//  pages are read from the file when touched, copied when written
+	mem_header *header = mmap(NULL, capacity, PROT_READ | PROT_WRITE,
+							  MAP_PRIVATE, fd, offset);
+	if (header == MAP_FAILED) {
+		pthread_mutex_unlock(&lock);
+		return NULL;
+	}
+
+	header->info.size = size;
+	header->info.capacity = capacity;
+	header->info.category = category;
+	header->info.pooled = false;
+	header->info.mapped = true;
+	header->info.dev = st.st_dev;
+	header->info.ino = st.st_ino;
+	header->info.next = mapped_blocks;
+	mapped_blocks = header;
+	count_block(size, category);
+
+	pthread_mutex_unlock(&lock);
+
+	return header + 1;
+}
+
+//  frees a block returned by mem_alloc or mem_map
+void mem_free(void *ptr)
+{
+	if (!ptr)
+		return;
+
+	mem_header *header = (mem_header *)ptr - 1;
+
+	pthread_mutex_lock(&lock);
+
+	stats[header->info.category].live -= header->info.size;
+	total_live -= header->info.size;
+
+	if (header->info.mapped) {
+		mem_header **it = &mapped_blocks;
+		while (*it != header)
+			it = (mem_header **)&(*it)->info.next;
+		*it = header->info.next;
+
+		//  mapped blocks are never recycled, their pages belong to a file
+		munmap(header, header->info.capacity);
+	} else if (!header->info.pooled) {
+		free(header);
+	} else if (pool.cached_bytes + header->info.capacity > pool.capacity) {
+		//  pool is full, give the block back to the system
+		munmap(header, header->info.capacity);
+	} else {
+		//  keep the block for the next allocation of the same size
+		header->info.next = pool.cached;
+		pool.cached = header;
+		pool.cached_bytes += header->info.capacity;
+	}
+
+	pthread_mutex_unlock(&lock);
+}
+
+//  checks if a live block is mapped from the file
+bool mem_file_mapped(dev_t dev, ino_t ino)
+{
+	bool found = false;
+
+	pthread_mutex_lock(&lock);
+
+	for (mem_header *h = mapped_blocks; h && !found; h = h->info.next)
+		found = h->info.dev == dev && h->info.ino == ino;
+
+	pthread_mutex_unlock(&lock);
+
+	return found;
+}
+
+//  sets the memory limit in bytes (0 disables it)
+void mem_set_limit(size_t bytes)
+{
+	pthread_mutex_lock(&lock);
+
+	limit = bytes;
+
+	//  cached blocks count against the limit as well
+	if (limit)
+		pool_trim(limit > total_live ? limit - total_live : 0);
+
+	pthread_mutex_unlock(&lock);
+}
+
+//  sets the function freeing cached data when the limit is reached
+void mem_set_reclaimer(mem_reclaimer reclaim)
+{
+	pthread_mutex_lock(&lock);
+	reclaimer = reclaim;
+	pthread_mutex_unlock(&lock);
+}
+
+//  gets the memory limit in bytes (0 if disabled)
+size_t mem_get_limit(void)
+{
+	pthread_mutex_lock(&lock);
+	size_t bytes = limit;
+	pthread_mutex_unlock(&lock);
+
+	return bytes;
+}
+
+//  sets the max number of bytes kept in the pool
+void mem_set_pool_capacity(size_t bytes)
+{
+	pthread_mutex_lock(&lock);
+
+	pool.capacity = bytes;
+	pool_trim(bytes);
+
+	pthread_mutex_unlock(&lock);
+}
+
+//  enables or disables huge page backing for new large blocks
+void mem_set_huge_pages(bool enabled)
+{
+	pthread_mutex_lock(&lock);
+	pool.huge_pages = enabled;
+	pthread_mutex_unlock(&lock);
+}
+
+//  prints the memory usage of every category
+void mem_report(FILE *file)
+{
+	pthread_mutex_lock(&lock);
+
+	fprintf(file, "Memory usage:\n");
+
+	for (int i = 0; i < MEM_CATEGORIES; ++i) {
+		fprintf(file, "%s: live %zu B, peak %zu B, allocations %zu\n",
+				category_names[i], stats[i].live, stats[i].peak,
+				stats[i].allocations);
+	}
+
+	fprintf(file, "total: live %zu B, peak %zu B\n", total_live, total_peak);
+
+	fprintf(file, "pool: cached %zu B, hits %zu, misses %zu, huge pages %s\n",
+			pool.cached_bytes, pool.hits, pool.misses,
+			pool.huge_pages ? "on" : "off");
+
+	if (limit)
+		fprintf(file, "limit: %zu B\n", limit);
+	else
+		fprintf(file, "limit: none\n");
+
+	pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,43 @@
+#ifndef MEMORY_UTTILS_
+#define MEMORY_UTTILS_
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+//  allocation categories tracked by the memory layer
+enum mem_category {MEM_PLANES = 0, MEM_SCRATCH = 1, MEM_IO = 2, MEM_CACHE = 3};
+
+#define MEM_CATEGORIES 4
+
+//  bytes of bookkeeping in front of every block
+#define MEM_HEADER_SIZE 64
+
+//  frees cached data to make room for an allocation that would go over the
+//  limit, returns the number of bytes it freed
+typedef size_t (*mem_reclaimer)(size_t bytes);
+
+void *mem_alloc(size_t size, enum mem_category category);
+
+void *mem_map(int fd, off_t offset, size_t size, enum mem_category category);
+
+void mem_free(void *ptr);
+
+bool mem_file_mapped(dev_t dev, ino_t ino);
+
+bool mem_would_exceed(size_t size);
+
+void mem_set_limit(size_t limit);
+
+void mem_set_reclaimer(mem_reclaimer reclaim);
+
+size_t mem_get_limit(void);
+
+void mem_set_pool_capacity(size_t bytes);
+
+void mem_set_huge_pages(bool enabled);
+
+void mem_report(FILE *file);
+
+#endif /* MEMORY_UTTILS_ */
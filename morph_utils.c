@@ -0,0 +1,626 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include "morph_utils.h"
+#include "matrix_utils.h"
+#include "bitmap_utils.h"
+#include "memory_utils.h"
+#include "worker_utils.h"
+
+//  side of the blocks of a transposition
+#define TILE 32
+
+//  names of the operations, in the order of enum morph_op
+static char *names[] = {"ERODE", "DILATE", "OPEN", "CLOSE"};
+
+//  one erosion (min) or dilation (max): the window of pixel (x, y) is
+//  [x - before_x, x + after_x] x [y - before_y, y + after_y]
+typedef struct {
+	int before_x;
+	int after_x;
+	int before_y;
+	int after_y;
+	bool max;
+} morph_pass;
+
+//  pixels of the rectangle [x, x + width) x [y, y + height) of a plane
+//  (or of a bitmap, always as wide as the image), the others are neutral
+typedef struct {
+	double **planes;
+	uint64_t **bits;
+	int x;
+	int y;
+	int width;
+	int height;
+} morph_view;
+
+//  combines rows a and b into dst on the columns [begin, end)
+typedef void (*rows_op)(void *dst, void *a, void *b, int begin, int end);
+
+//  van Herk / Gil-Werman pass along a column of rows: output row y combines
+//  the input rows y to y + before + after
+typedef struct {
+	void **in;
+	void **out;
+	int count;
+	int before;
+	int after;
+	//  suffixes of a block (but its first and last rows), and 2 spare rows
+	void **suffix;
+	void *spare[2];
+	size_t size;
+	rows_op op;
+} vhgw_job;
+
+//  transposition of a flat matrix: dst[i][j] = src[j * stride + i]
+typedef struct {
+	double *src;
+	int stride;
+	double **dst;
+	int count;
+} transpose_job;
+
+//  horizontal pass over rows of bits
+typedef struct {
+	uint64_t **in;
+	uint64_t **out;
+	int width;
+	morph_pass *pass;
+	//  rows of every worker, buffer_size words from buffers
+	uint64_t *buffers;
+	size_t buffer_size;
+} bits_job;
+
+//  gets a morphological operation by name (a command without arguments
+//  still ends with the new line)
+bool get_morph_op(char *name, enum morph_op *op)
+{
+	for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); ++i) {
+		size_t len = strlen(names[i]);
+
+		if (!strncmp(name, names[i], len) &&
+			(name[len] == '\0' || name[len] == '\n')) {
+			*op = i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+//  gets the name of a morphological operation
+char *morph_op_name(enum morph_op op)
+{
+	return names[op];
+}
+
+//  the row operations are plain loops over restrict pointers, so the
+//  compiler turns them into vector min / max / and / or instructions
+static void min_rows(void *dst, void *a, void *b, int begin, int end)
+{
+	double *restrict d = dst;
+	double *restrict x = a;
+	double *restrict y = b;
+
+	for (int j = begin; j < end; ++j)
+		d[j] = x[j] < y[j] ? x[j] : y[j];
+}
+
+static void max_rows(void *dst, void *a, void *b, int begin, int end)
+{
+	double *restrict d = dst;
+	double *restrict x = a;
+	double *restrict y = b;
+
+	for (int j = begin; j < end; ++j)
+		d[j] = x[j] > y[j] ? x[j] : y[j];
+}
+
+static void and_rows(void *dst, void *a, void *b, int begin, int end)
+{
+	uint64_t *restrict d = dst;
+	uint64_t *restrict x = a;
+	uint64_t *restrict y = b;
+
+	for (int j = begin; j < end; ++j)
+		d[j] = x[j] & y[j];
+}
+
+static void or_rows(void *dst, void *a, void *b, int begin, int end)
+{
+	uint64_t *restrict d = dst;
+	uint64_t *restrict x = a;
+	uint64_t *restrict y = b;
+
+	for (int j = begin; j < end; ++j)
+		d[j] = x[j] | y[j];
+}
+
+//  worker task, runs the pass on the columns [begin, end) of the rows:
+//  the input rows are split in blocks of k = before + after + 1, the window
+//  of a row starting a block is the block's suffix from it, any other
+//  window is a suffix of its block plus a prefix of the next one, so every
+//  output row costs 3 operations whatever k is
+static void vhgw_columns(void *arg, int begin, int end, int worker)
+{
+	vhgw_job *job = arg;
+	int k = job->before + job->after + 1;
+	size_t offset = job->size * begin, length = job->size * (end - begin);
+
+	(void)worker;
+
+	//  the window is a single row
+	if (k == 1) {
+		for (int y = 0; y < job->count; ++y)
+			memcpy((char *)job->out[y] + offset,
+				   (char *)job->in[y] + offset, length);
+		return;
+	}
+
+	for (int s = 0; s < job->count; s += k) {
+		int e = s + k < job->count ? s + k : job->count;
+		void *next = job->in[s + k - 1];
+
+		//  suffixes of the block, from its end: the first one is the output
+		//  of row s, the ones of rows with no output only pass through the
+		//  spare rows
+		for (int p = s + k - 2; p >= s; --p) {
+			void *dst = p == s ? job->out[s] : p < e ? job->suffix[p - s] :
+						job->spare[p & 1];
+
+			job->op(dst, job->in[p], next, begin, end);
+			next = dst;
+		}
+
+		//  prefixes of the next block, kept in the spare rows
+		void *prefix = NULL;
+
+		for (int y = s + 1; y < e; ++y) {
+			if (y == s + 1) {
+				prefix = job->in[s + k];
+			} else {
+				job->op(job->spare[y & 1], prefix, job->in[y + k - 1],
+						begin, end);
+				prefix = job->spare[y & 1];
+			}
+
+			//  the block's last row is its own suffix
+			void *suffix = y - s == k - 1 ? job->in[y] : job->suffix[y - s];
+
+			job->op(job->out[y], suffix, prefix, begin, end);
+		}
+	}
+}
+
+//  worker task, transposes the rows [begin, end) of dst in blocks
+static void transpose_rows(void *arg, int begin, int end, int worker)
+{
+	transpose_job *job = arg;
+
+	(void)worker;
+
+	for (int i0 = begin; i0 < end; i0 += TILE) {
+		int i1 = i0 + TILE < end ? i0 + TILE : end;
+
+		for (int j0 = 0; j0 < job->count; j0 += TILE) {
+			int j1 = j0 + TILE < job->count ? j0 + TILE : job->count;
+
+			for (int i = i0; i < i1; ++i)
+				for (int j = j0; j < j1; ++j)
+					job->dst[i][j] = job->src[(size_t)j * job->stride + i];
+		}
+	}
+}
+
+//  gets the 64 pixels of a row starting at pixel x, fill past its ends
+static inline uint64_t bits_at(uint64_t *row, int words, long x,
+							   uint64_t fill)
+{
+	long q = x >= 0 ? x / 64 : -((63 - x) / 64);
+	int s = (int)(x - 64 * q);
+
+	uint64_t first = q >= 0 && q < words ? row[q] : fill;
+	if (!s)
+		return first;
+
+	uint64_t second = q + 1 >= 0 && q + 1 < words ? row[q + 1] : fill;
+	return (first << s) | (second >> (64 - s));
+}
+
+//  combines every span of len pixels of a padded row with the span that
+//  starts shift pixels later, in place (a word only reads the next ones)
+static void bits_span(uint64_t *row, int words, int shift, bool max)
+{
+	uint64_t fill = max ? 0 : ~0ULL;
+
+	for (int k = 0; k < words; ++k) {
+		uint64_t next = bits_at(row, words, 64L * k + shift, fill);
+
+		row[k] = max ? row[k] | next : row[k] & next;
+	}
+}
+
+//  worker task, runs the horizontal pass on the rows [begin, end): a row
+//  is shifted by before pixels, then spans of 1, 2, 4, ... pixels are
+//  combined with their neighbours until they cover the window, 64 pixels
+//  per operation
+static void bits_rows(void *arg, int begin, int end, int worker)
+{
+	bits_job *job = arg;
+	morph_pass *pass = job->pass;
+	int words = BITMAP_WORDS(job->width);
+	int span = pass->before_x + pass->after_x + 1;
+	int padded = BITMAP_WORDS(job->width + span - 1);
+	uint64_t fill = pass->max ? 0 : ~0ULL;
+	uint64_t tail = job->width % 64 ? ~(~0ULL >> job->width % 64) : ~0ULL;
+
+	uint64_t *row = job->buffers + job->buffer_size * worker;
+	uint64_t *pad = row + words;
+
+	for (int i = begin; i < end; ++i) {
+		//  the pixels past the row's end are neutral
+		memcpy(row, job->in[i], sizeof(uint64_t) * words);
+		row[words - 1] = (row[words - 1] & tail) | (fill & ~tail);
+
+		for (int k = 0; k < padded; ++k)
+			pad[k] = bits_at(row, words, 64L * k - pass->before_x, fill);
+
+		int len = 1;
+		for (; 2 * len <= span; len *= 2)
+			bits_span(pad, padded, len, pass->max);
+		if (len < span)
+			bits_span(pad, padded, span - len, pass->max);
+
+		memcpy(job->out[i], pad, sizeof(uint64_t) * words);
+		job->out[i][words - 1] &= tail;
+	}
+}
+
+//  runs one pass over the rectangle [x1, x2) x [y1, y2) of an image plane,
+//  reading src and writing dst: a vertical van Herk / Gil-Werman pass over
+//  the rows, a transposition, a vertical pass again (the horizontal one)
+//  and a transposition into dst, returns false if memory is exhausted
+static bool morph_plane(morph_view *src, morph_view *dst, int x1, int y1,
+						int x2, int y2, morph_pass *pass)
+{
+	int w = x2 - x1, h = y2 - y1;
+	int ky = pass->before_y + pass->after_y + 1;
+	int kx = pass->before_x + pass->after_x + 1;
+	int columns = w + kx - 1, rows = h + ky - 1;
+	int left = x1 - pass->before_x, top = y1 - pass->before_y;
+	double neutral = pass->max ? -INFINITY : INFINITY;
+
+	//  suffixes of a block of either pass, 2 spare rows and a neutral one
+	int suffixes = ky - 1 < h ? ky - 1 : h;
+	int length = columns > h ? columns : h;
+	int lines = columns > h ? columns : h;
+	int outputs = w > h ? w : h;
+
+	if ((kx - 1 < w ? kx - 1 : w) > suffixes)
+		suffixes = kx - 1 < w ? kx - 1 : w;
+
+	double *flat = mem_alloc(sizeof(double) * h * columns, MEM_SCRATCH);
+	double *turned = mem_alloc(sizeof(double) * columns * h, MEM_SCRATCH);
+	double *extra = mem_alloc(sizeof(double) * (suffixes + 3) * length,
+							  MEM_SCRATCH);
+	void **ptrs = mem_alloc(sizeof(void *) * ((size_t)rows + columns +
+											  outputs + suffixes),
+							MEM_SCRATCH);
+	double **targets = mem_alloc(sizeof(double *) * lines, MEM_SCRATCH);
+
+	if (!flat || !turned || !extra || !ptrs || !targets) {
+		mem_free(flat);
+		mem_free(turned);
+		mem_free(extra);
+		mem_free(ptrs);
+		mem_free(targets);
+		return false;
+	}
+
+	void **in = ptrs, **out = in + rows + columns, **suffix = out + outputs;
+	double *spare = extra + (size_t)suffixes * length;
+	double *line = spare + 2 * (size_t)length;
+
+	for (int i = 0; i < suffixes; ++i)
+		suffix[i] = extra + (size_t)i * length;
+	for (int j = 0; j < length; ++j)
+		line[j] = neutral;
+
+	vhgw_job job = {
+		.suffix = suffix,
+		.spare = {spare, spare + length},
+		.size = sizeof(double),
+		.op = pass->max ? max_rows : min_rows
+	};
+
+	//  columns of the window that src holds, the others are neutral
+	int c0 = (src->x > left ? src->x : left) - left;
+	int c1 = (src->x + src->width < left + columns ?
+			  src->x + src->width : left + columns) - left;
+
+	for (int i = 0; i < h; ++i) {
+		double *row = flat + (size_t)i * columns;
+
+		for (int j = 0; j < c0; ++j)
+			row[j] = neutral;
+		for (int j = c1; j < columns; ++j)
+			row[j] = neutral;
+
+		out[i] = row + c0;
+	}
+
+	for (int i = 0; i < rows; ++i) {
+		int y = top + i;
+
+		if (y >= src->y && y < src->y + src->height)
+			in[i] = src->planes[y - src->y] + (left + c0 - src->x);
+		else
+			in[i] = line;
+	}
+
+	job.in = in;
+	job.out = out;
+	job.count = h;
+	job.before = pass->before_y;
+	job.after = pass->after_y;
+	workers_run(c1 - c0, vhgw_columns, &job);
+
+	//  columns become rows
+	for (int j = 0; j < columns; ++j)
+		targets[j] = turned + (size_t)j * h;
+
+	transpose_job t = {flat, columns, targets, h};
+	workers_run(columns, transpose_rows, &t);
+
+	//  horizontal pass, its output reuses the first buffer
+	for (int j = 0; j < columns; ++j)
+		in[j] = turned + (size_t)j * h;
+	for (int j = 0; j < w; ++j)
+		out[j] = flat + (size_t)j * h;
+
+	job.count = w;
+	job.before = pass->before_x;
+	job.after = pass->after_x;
+	workers_run(h, vhgw_columns, &job);
+
+	//  rows become columns again, in dst
+	for (int i = 0; i < h; ++i)
+		targets[i] = dst->planes[y1 + i - dst->y] + (x1 - dst->x);
+
+	t = (transpose_job){flat, h, targets, w};
+	workers_run(h, transpose_rows, &t);
+
+	mem_free(flat);
+	mem_free(turned);
+	mem_free(extra);
+	mem_free(ptrs);
+	mem_free(targets);
+	return true;
+}
+
+//  runs one pass over the rows [y1, y2) of a bitmap, reading src and
+//  writing the rows of dst from y1: a vertical van Herk / Gil-Werman pass
+//  over whole words, then the horizontal pass of every row,
+//  returns false if memory is exhausted
+static bool morph_bits(morph_view *src, uint64_t **dst, int y1, int y2,
+					   int width, morph_pass *pass)
+{
+	int words = BITMAP_WORDS(width);
+	int h = y2 - y1;
+	int ky = pass->before_y + pass->after_y + 1;
+	int rows = h + ky - 1;
+	int suffixes = ky - 1 < h ? ky - 1 : h;
+	int workers = workers_count();
+	int padded = BITMAP_WORDS(width + pass->before_x + pass->after_x);
+	uint64_t neutral = pass->max ? 0 : ~0ULL;
+
+	bits_job bits = {
+		.width = width,
+		.pass = pass,
+		.buffer_size = words + padded
+	};
+
+	uint64_t *flat = mem_alloc(sizeof(uint64_t) * (h + suffixes + 3) * words,
+							   MEM_SCRATCH);
+	void **ptrs = mem_alloc(sizeof(void *) * (rows + 2 * (size_t)h +
+											  suffixes), MEM_SCRATCH);
+	bits.buffers = mem_alloc(sizeof(uint64_t) * bits.buffer_size * workers,
+							 MEM_SCRATCH);
+
+	if (!flat || !ptrs || !bits.buffers) {
+		mem_free(flat);
+		mem_free(ptrs);
+		mem_free(bits.buffers);
+		return false;
+	}
+
+	void **in = ptrs, **out = in + rows, **suffix = out + h;
+	uint64_t **vertical = (uint64_t **)(suffix + suffixes);
+	uint64_t *extra = flat + (size_t)h * words;
+	uint64_t *spare = extra + (size_t)suffixes * words;
+	uint64_t *line = spare + 2 * (size_t)words;
+
+	for (int i = 0; i < h; ++i) {
+		out[i] = flat + (size_t)i * words;
+		vertical[i] = flat + (size_t)i * words;
+	}
+	for (int i = 0; i < suffixes; ++i)
+		suffix[i] = extra + (size_t)i * words;
+	for (int k = 0; k < words; ++k)
+		line[k] = neutral;
+
+	for (int i = 0; i < rows; ++i) {
+		int y = y1 - pass->before_y + i;
+
+		if (y >= src->y && y < src->y + src->height)
+			in[i] = src->bits[y - src->y];
+		else
+			in[i] = line;
+	}
+
+	vhgw_job job = {
+		.in = in,
+		.out = out,
+		.count = h,
+		.before = pass->before_y,
+		.after = pass->after_y,
+		.suffix = suffix,
+		.spare = {spare, spare + words},
+		.size = sizeof(uint64_t),
+		.op = pass->max ? or_rows : and_rows
+	};
+	workers_run(words, vhgw_columns, &job);
+
+	bits.in = vertical;
+	bits.out = dst;
+	workers_run(h, bits_rows, &bits);
+
+	mem_free(flat);
+	mem_free(ptrs);
+	mem_free(bits.buffers);
+	return true;
+}
+
+//  runs the passes (1 or 2) over the selection of a plane, the first of 2
+//  passes covers the pixels the windows of the second one read,
+//  returns false if memory is exhausted
+static bool morph_plane_passes(my_image *image, double **plane,
+							   morph_pass *passes, int count)
+{
+	my_select *s = image->select;
+	morph_view whole = {plane, NULL, 0, 0, image->width, image->height};
+
+	if (count == 1)
+		return morph_plane(&whole, &whole, s->x1, s->y1, s->x2, s->y2,
+						   &passes[0]);
+
+	int x1 = s->x1 - passes[1].before_x, x2 = s->x2 + passes[1].after_x;
+	int y1 = s->y1 - passes[1].before_y, y2 = s->y2 + passes[1].after_y;
+
+	x1 = x1 < 0 ? 0 : x1;
+	y1 = y1 < 0 ? 0 : y1;
+	x2 = x2 > image->width ? image->width : x2;
+	y2 = y2 > image->height ? image->height : y2;
+
+	double **middle = alloc_scratch_matrix(y2 - y1, x2 - x1);
+	if (!middle)
+		return false;
+
+	morph_view part = {middle, NULL, x1, y1, x2 - x1, y2 - y1};
+
+	bool done = morph_plane(&whole, &part, x1, y1, x2, y2, &passes[0]) &&
+				morph_plane(&part, &whole, s->x1, s->y1, s->x2, s->y2,
+							&passes[1]);
+
+	free_matrix(middle, y2 - y1);
+	return done;
+}
+
+//  runs the passes (1 or 2) over the rows of the selection of a bitmap,
+//  then copies the selected pixels, returns false if memory is exhausted
+static bool morph_bits_passes(my_image *image, morph_pass *passes, int count)
+{
+	my_select *s = image->select;
+	uint64_t **bits = ((bit_img *)image->img)->rows;
+	morph_view whole = {NULL, bits, 0, 0, image->width, image->height};
+	int words = BITMAP_WORDS(image->width);
+	int h = s->y2 - s->y1;
+
+	//  rows of the middle result, then of the final one
+	int y1 = s->y1, y2 = s->y1;
+	if (count == 2) {
+		y1 = s->y1 - passes[1].before_y;
+		y2 = s->y2 + passes[1].after_y;
+		y1 = y1 < 0 ? 0 : y1;
+		y2 = y2 > image->height ? image->height : y2;
+	}
+
+	int total = y2 - y1 + h;
+	uint64_t *flat = mem_alloc(sizeof(uint64_t) * total * words, MEM_SCRATCH);
+	uint64_t **rows = mem_alloc(sizeof(uint64_t *) * total, MEM_SCRATCH);
+
+	if (!flat || !rows) {
+		mem_free(flat);
+		mem_free(rows);
+		return false;
+	}
+
+	for (int i = 0; i < total; ++i)
+		rows[i] = flat + (size_t)i * words;
+
+	uint64_t **middle = rows, **result = rows + (y2 - y1);
+	morph_view part = {NULL, middle, 0, y1, image->width, y2 - y1};
+	bool done;
+
+	if (count == 1)
+		done = morph_bits(&whole, result, s->y1, s->y2, image->width,
+						  &passes[0]);
+	else
+		done = morph_bits(&whole, middle, y1, y2, image->width,
+						  &passes[0]) &&
+			   morph_bits(&part, result, s->y1, s->y2, image->width,
+						  &passes[1]);
+
+	if (done)
+		blend_bitmap(bits, result, s->x1, s->y1, s->x2, s->y2);
+
+	mem_free(flat);
+	mem_free(rows);
+	return done;
+}
+
+//  gets the pass of an erosion (or of a dilation, with the reflected
+//  element) by a width x height rectangle centered on the pixel; a window
+//  never needs to reach further than the image's other end
+static morph_pass get_pass(my_image *image, bool max, int width, int height)
+{
+	morph_pass pass;
+	int small_x = (width - 1) / 2, large_x = width / 2;
+	int small_y = (height - 1) / 2, large_y = height / 2;
+
+	pass.before_x = max ? large_x : small_x;
+	pass.after_x = max ? small_x : large_x;
+	pass.before_y = max ? large_y : small_y;
+	pass.after_y = max ? small_y : large_y;
+	pass.max = max;
+
+	if (pass.before_x > image->width - 1)
+		pass.before_x = image->width - 1;
+	if (pass.after_x > image->width - 1)
+		pass.after_x = image->width - 1;
+	if (pass.before_y > image->height - 1)
+		pass.before_y = image->height - 1;
+	if (pass.after_y > image->height - 1)
+		pass.after_y = image->height - 1;
+
+	return pass;
+}
+
+//  erodes (min), dilates (max), opens (erodes then dilates) or closes
+//  (dilates then erodes) the selection with a width x height rectangle,
+//  reading the pixels around it like APPLY (the pixels outside the image
+//  are ignored), returns false if memory is exhausted
+bool morph_image(my_image *image, enum morph_op op, int width, int height)
+{
+	morph_pass passes[2];
+	int count = op == OPEN || op == CLOSE ? 2 : 1;
+	bool first_max = op == DILATE || op == CLOSE;
+
+	passes[0] = get_pass(image, first_max, width, height);
+	passes[1] = get_pass(image, !first_max, width, height);
+
+	if (image->img_type == BLACK_WHITE)
+		return morph_bits_passes(image, passes, count);
+
+	double **planes[3];
+	int channels = image_planes(image, planes);
+
+	for (int c = 0; c < channels; ++c)
+		if (!morph_plane_passes(image, planes[c], passes, count))
+			return false;
+
+	return true;
+}
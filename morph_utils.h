@@ -0,0 +1,21 @@
+#ifndef MORPH_UTTILS_
+#define MORPH_UTTILS_
+
+#include <stdbool.h>
+#include "image_utils.h"
+
+//  morphological operations with a rectangular structuring element
+enum morph_op {
+	ERODE = 0,
+	DILATE = 1,
+	OPEN = 2,
+	CLOSE = 3
+};
+
+bool get_morph_op(char *name, enum morph_op *op);
+
+char *morph_op_name(enum morph_op op);
+
+bool morph_image(my_image *image, enum morph_op op, int width, int height);
+
+#endif /* MORPH_UTTILS_ */
@@ -0,0 +1,194 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include "numa_utils.h"
+#include "worker_utils.h"
+
+//  pages whose node is asked for at once
+#define PAGE_BATCH 1024
+
+static int nodes = 1;
+
+static pthread_once_t counted = PTHREAD_ONCE_INIT;
+
+//  parses a list of ids and ranges of ids like "0-3,8,10-11", returns the
+//  number of ids, or -1 if the list is invalid or names more than max ids
+int parse_id_list(char *list, int *ids, int max)
+{
+	int count = 0;
+	char *p = list;
+
+	while (*p) {
+		char *end;
+
+		if (!isdigit((unsigned char)*p))
+			return -1;
+		long first = strtol(p, &end, 10), last = first;
+		p = end;
+
+		if (*p == '-') {
+			if (!isdigit((unsigned char)*++p))
+				return -1;
+			last = strtol(p, &end, 10);
+			p = end;
+		}
+
+		if (last < first || last - first >= max - count)
+			return -1;
+
+		for (long id = first; id <= last; ++id)
+			ids[count++] = (int)id;
+
+		if (*p == ',' && p[1])
+			p++;
+		else if (*p)
+			return -1;
+	}
+
+	return count ? count : -1;
+}
+
+//  counts the online memory nodes listed by the kernel
+static void count_nodes(void)
+{
+	int ids[MAX_CPU_IDS];
+	char list[256];
+
+	FILE *file = fopen("/sys/devices/system/node/online", "r");
+	if (!file)
+		return;
+
+	if (fgets(list, sizeof(list), file)) {
+		list[strcspn(list, "\n")] = '\0';
+
+		int count = parse_id_list(list, ids, MAX_CPU_IDS);
+		nodes = count > 1 ? count : 1;
+	}
+
+	fclose(file);
+}
+
+//  returns the number of NUMA nodes, 1 if the machine has none or they
+//  can't be found
+int numa_nodes(void)
+{
+	pthread_once(&counted, count_nodes);
+
+	return nodes;
+}
+
+//  returns the node of the CPU the calling thread runs on, -1 if unknown
+int numa_current_node(void)
+{
+	unsigned int cpu, node;
+
+	if (syscall(SYS_getcpu, &cpu, &node, NULL))
+		return -1;
+
+	return (int)node;
+}
+
+//  rows of a block touched by the workers
+typedef struct {
+	char *data;
+	size_t row_size;
+	bool zero;
+} touch_job;
+
+//  worker task, writes the rows [begin, end): zeroes them, or writes one
+//  byte in each of their pages
+static void touch_band(void *arg, int begin, int end, int worker)
+{
+	touch_job *job = arg;
+	char *first = job->data + (size_t)begin * job->row_size;
+	char *last = job->data + (size_t)end * job->row_size;
+	uintptr_t page = sysconf(_SC_PAGESIZE);
+
+	(void)worker;
+
+	if (job->zero) {
+		memset(first, 0, last - first);
+		return;
+	}
+
+	if (first == last)
+		return;
+
+	*first = 0;
+	for (char *p = (char *)(((uintptr_t)first + page) & ~(page - 1));
+		 p < last; p += page)
+		*p = 0;
+}
+
+//  touches the n rows of a new block first from the workers that will work
+//  on them: the kernel places a page on the node of the thread touching it
+//  first, and jobs split rows in the same bands; left to the caller on
+//  machines with one node and for small blocks
+void numa_touch_rows(char *data, int n, size_t row_size, bool zero)
+{
+	touch_job job = {data, row_size, zero};
+
+	if (numa_nodes() > 1 && (size_t)n * row_size >= NUMA_TOUCH_MIN)
+		workers_run(n, touch_band, &job);
+	else if (zero)
+		memset(data, 0, (size_t)n * row_size);
+}
+
+//  counts the pages of the n rows of a block that are on another node
+//  than the worker doing their band, total gets the number of pages whose
+//  node is known
+size_t numa_remote_pages(char *data, int n, size_t row_size, size_t *total)
+{
+	int bands = workers_count() < n ? workers_count() : n;
+	uintptr_t page = sysconf(_SC_PAGESIZE);
+	void *pages[PAGE_BATCH];
+	int status[PAGE_BATCH];
+	size_t remote = 0;
+
+	*total = 0;
+
+	for (int w = 0; w < bands; ++w) {
+		int begin = (int)((long long)n * w / bands);
+		int end = (int)((long long)n * (w + 1) / bands);
+		uintptr_t p = (uintptr_t)(data + (size_t)begin * row_size) &
+					  ~(page - 1);
+		uintptr_t last = (uintptr_t)(data + (size_t)end * row_size);
+		int node = workers_node(w);
+
+		//  the worker didn't do a job yet
+		if (node < 0)
+			continue;
+
+		while (p < last) {
+			int count = 0;
+
+			while (p < last && count < PAGE_BATCH) {
+				pages[count++] = (void *)p;
+				p += page;
+			}
+
+			//  no nodes given, the pages stay and their nodes are returned
+			if (syscall(SYS_move_pages, 0, (unsigned long)count, pages, NULL,
+						status, 0))
+				return remote;
+
+			for (int k = 0; k < count; ++k) {
+				//  pages never touched have no node
+				if (status[k] < 0)
+					continue;
+
+				(*total)++;
+				remote += status[k] != node;
+			}
+		}
+	}
+
+	return remote;
+}
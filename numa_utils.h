@@ -0,0 +1,23 @@
+#ifndef NUMA_UTTILS_
+#define NUMA_UTTILS_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+//  blocks smaller than this are left to the thread allocating them
+#define NUMA_TOUCH_MIN (4UL << 20)
+
+//  most CPUs a topology names
+#define MAX_CPU_IDS 1024
+
+int parse_id_list(char *list, int *ids, int max);
+
+int numa_nodes(void);
+
+int numa_current_node(void);
+
+void numa_touch_rows(char *data, int n, size_t row_size, bool zero);
+
+size_t numa_remote_pages(char *data, int n, size_t row_size, size_t *total);
+
+#endif /* NUMA_UTTILS_ */
@@ -0,0 +1,393 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "optimize_utils.h"
+#include "editor_utils.h"
+#include "slot_utils.h"
+#include "qoi_utils.h"
+#include "path_utils.h"
+#include "utils.h"
+
+//  command of the script, split the way the editor splits it
+typedef struct {
+	enum command_kind kind;
+	char text[MAX_INPUT_LINE_SIZE];
+	//  points in text, NULL if there are none
+	char *args;
+	//  slot whose image the command works on
+	int slot;
+} script_command;
+
+//  slots named by the script and the one its commands work on
+typedef struct {
+	char **names;
+	int count;
+	int current;
+} slot_names;
+
+//  finds a slot by name, adds it if asked, returns -1 if it doesn't exist
+static int find_name(slot_names *slots, char *name, bool create)
+{
+	for (int i = 0; i < slots->count; ++i)
+		if (!strcmp(slots->names[i], name))
+			return i;
+
+	if (!create)
+		return -1;
+
+	char **grown = realloc(slots->names, sizeof(char *) * (slots->count + 1));
+	DIE(!grown, "realloc names");
+	slots->names = grown;
+
+	slots->names[slots->count] = strdup(name);
+	DIE(!slots->names[slots->count], "strdup name");
+
+	return slots->count++;
+}
+
+//  splits the arguments in words (at most max of them, the rest is
+//  ignored), returns their number
+static int split_words(char *args, char *copy, char **words, int max)
+{
+	char *save;
+	int count = 0;
+
+	if (!args)
+		return 0;
+
+	strcpy(copy, args);
+	for (char *w = strtok_r(copy, " ", &save); w && count < max;
+		 w = strtok_r(NULL, " ", &save))
+		words[count++] = w;
+
+	return count;
+}
+
+//  splits every line like the editor, and finds the slot every command
+//  works on, following LOAD <slot> <file> and USE like the editor does
+static void parse_commands(char **lines, int count, script_command *commands)
+{
+	slot_names slots = {NULL, 0, 0};
+
+	find_name(&slots, DEFAULT_SLOT, true);
+
+	for (int i = 0; i < count; ++i) {
+		script_command *c = &commands[i];
+		char copy[MAX_INPUT_LINE_SIZE], *words[3], *save;
+
+		memcpy(c->text, lines[i], strlen(lines[i]) + 1);
+
+		char *command = strtok_r(c->text, " ", &save);
+		c->args = strtok_r(NULL, "\n", &save);
+		c->kind = command ? get_command_kind(command) : COMMAND_UNKNOWN;
+
+		//  a LOAD in a named slot makes it the current one
+		if (c->kind == COMMAND_LOAD &&
+			split_words(c->args, copy, words, 3) == 2)
+			slots.current = find_name(&slots, words[0], true);
+
+		//  USE of a slot that exists
+		if (c->kind == COMMAND_USE && c->args && !strchr(c->args, ' ')) {
+			int slot = find_name(&slots, c->args, false);
+
+			slots.current = slot < 0 ? slots.current : slot;
+		}
+
+		c->slot = slots.current;
+	}
+
+	for (int i = 0; i < slots.count; ++i)
+		free(slots.names[i]);
+	free(slots.names);
+}
+
+//  gets the number of slots the commands work on
+static int count_slots(script_command *commands, int count)
+{
+	int slots = 1;
+
+	for (int i = 0; i < count; ++i)
+		slots = commands[i].slot >= slots ? commands[i].slot + 1 : slots;
+
+	return slots;
+}
+
+//  checks if a command discards the pixels of its slot: a LOAD with a file
+//  replaces them even if it fails
+static bool replaces_pixels(script_command *c)
+{
+	char copy[MAX_INPUT_LINE_SIZE], *words[3];
+
+	if (c->kind != COMMAND_LOAD)
+		return false;
+
+	int count = split_words(c->args, copy, words, 3);
+	return count == 1 || count == 2;
+}
+
+//  checks if a command reads the pixels of its slot (a RESTORE is taken as
+//  one, it may fail and leave them)
+static bool reads_pixels(script_command *c)
+{
+	return c->kind == COMMAND_HISTOGRAM || c->kind == COMMAND_LABEL ||
+		   c->kind == COMMAND_SAVE || c->kind == COMMAND_SNAPSHOT ||
+		   c->kind == COMMAND_THUMBNAIL || c->kind == COMMAND_RESTORE;
+}
+
+//  checks if a command only changes pixels of the selection, never the
+//  size, type or selection of the image
+static bool only_changes_pixels(script_command *c)
+{
+	return c->kind == COMMAND_POINT_OP || c->kind == COMMAND_APPLY ||
+		   c->kind == COMMAND_EQUALIZE || c->kind == COMMAND_MORPH;
+}
+
+//  checks if a command may change the pixels of its slot
+static bool changes_pixels(script_command *c)
+{
+	return only_changes_pixels(c) || c->kind == COMMAND_LOAD ||
+		   c->kind == COMMAND_ROTATE || c->kind == COMMAND_CROP ||
+		   c->kind == COMMAND_RESIZE || c->kind == COMMAND_RESTORE;
+}
+
+//  marks the commands whose pixels are never read: going backwards, the
+//  pixels of a slot are read if a command reads them before the next one
+//  discards them, nothing reads them after the script
+static void find_dead_pixels(script_command *commands, int count,
+							 script_step *steps)
+{
+	int slots = count_slots(commands, count);
+
+	bool *live = calloc(slots, sizeof(bool));
+	DIE(!live, "calloc live");
+
+	for (int i = count - 1; i >= 0; --i) {
+		script_command *c = &commands[i];
+
+		if (reads_pixels(c))
+			live[c->slot] = true;
+		else if (replaces_pixels(c))
+			live[c->slot] = false;
+		else if (only_changes_pixels(c))
+			steps[i].dead = !live[c->slot];
+	}
+
+	free(live);
+}
+
+//  gets the angle of a ROTATE by a right angle (a single word, like the
+//  editor reads it), returns false for any other ROTATE
+static bool right_angle(script_command *c, int *angle)
+{
+	char copy[MAX_INPUT_LINE_SIZE], *words[2];
+	double value;
+
+	if (c->kind != COMMAND_ROTATE ||
+		split_words(c->args, copy, words, 2) != 1)
+		return false;
+
+	if (!parse_decimal(words[0], &value) || value < -360 || value > 360 ||
+		value != (int)value)
+		return false;
+
+	*angle = (int)value;
+	return *angle % 90 == 0 && *angle >= -360 && *angle <= 360;
+}
+
+//  joins the runs of ROTATEs by right angles: the first one turns the image
+//  by their sum, ROTATE 90 four times (or ROTATE 0) doesn't move a pixel
+static void join_rotations(script_command *commands, int count,
+						   script_step *steps)
+{
+	for (int i = 0; i < count;) {
+		int angle, sum = 0, j = i;
+
+		while (j < count && right_angle(&commands[j], &angle)) {
+			sum += angle;
+			if (j > i)
+				steps[j].leader = &steps[i];
+			j++;
+		}
+
+		if (j > i)
+			steps[i].turn = (sum % 360 + 360) % 360;
+
+		i = j > i ? j : i + 1;
+	}
+}
+
+//  most words of a command
+#define MAX_WORDS (MAX_INPUT_LINE_SIZE / 2)
+
+//  gets the files every word of a command may name (e.g. reads or writes),
+//  by their canonical paths, returns their number
+static int named_files(script_command *c, char **files)
+{
+	char copy[MAX_INPUT_LINE_SIZE], *words[MAX_WORDS];
+	int count = split_words(c->args, copy, words, MAX_WORDS);
+
+	for (int k = 0; k < count; ++k)
+		files[k] = canonical_path(words[k]);
+
+	return count;
+}
+
+//  checks if a canonical path is one of the files a command names
+static bool names_file(char **files, int count, char *path)
+{
+	for (int k = 0; k < count; ++k)
+		if (!strcmp(files[k], path))
+			return true;
+
+	return false;
+}
+
+//  gets the file and the format of a SAVE (see editor_save), returns false
+//  if it is invalid
+static bool save_target(script_command *c, char *copy, char **path,
+						enum save_format *format)
+{
+	char *save;
+
+	if (!c->args)
+		return false;
+
+	strcpy(copy, c->args);
+	*path = strtok_r(copy, " ", &save);
+	char *text = *path ? strtok_r(NULL, "\n", &save) : NULL;
+
+	if (!*path || (text && is_qoi_path(*path)))
+		return false;
+
+	*format = is_qoi_path(*path) ? SAVE_QOI : text ? SAVE_TEXT : SAVE_BINARY;
+	return true;
+}
+
+//  last SAVE of a slot whose pixels didn't change since
+typedef struct {
+	//  index of the SAVE, -1 if there is none
+	int index;
+	//  canonical path of its file
+	char *path;
+	enum save_format format;
+} saved_pixels;
+
+//  finds the SAVEs of pixels an earlier SAVE of the same slot already wrote
+//  in the same format: nothing changed the slot in between and no command
+//  named the earlier file (by any of its paths), which may then be copied
+static void share_saves(script_command *commands, int count,
+						script_step *steps)
+{
+	int slots = count_slots(commands, count);
+
+	saved_pixels *saved = malloc(sizeof(saved_pixels) * slots);
+	DIE(!saved, "malloc saved");
+
+	for (int s = 0; s < slots; ++s) {
+		saved[s].index = -1;
+		saved[s].path = NULL;
+	}
+
+	for (int i = 0; i < count; ++i) {
+		script_command *c = &commands[i];
+		saved_pixels *last = &saved[c->slot];
+		char copy[MAX_INPUT_LINE_SIZE], *path, *files[MAX_WORDS];
+		enum save_format format;
+		int named = named_files(c, files);
+
+		//  the file may be read or written by now
+		for (int s = 0; s < slots; ++s)
+			if (saved[s].index >= 0 &&
+				names_file(files, named, saved[s].path))
+				saved[s].index = -1;
+
+		for (int k = 0; k < named; ++k)
+			free(files[k]);
+
+		if (changes_pixels(c))
+			last->index = -1;
+
+		if (c->kind != COMMAND_SAVE || !save_target(c, copy, &path, &format))
+			continue;
+
+		if (last->index >= 0 && last->format == format) {
+			steps[i].source = &steps[last->index];
+		} else {
+			last->index = i;
+			free(last->path);
+			last->path = canonical_path(path);
+			last->format = format;
+		}
+	}
+
+	for (int s = 0; s < slots; ++s)
+		free(saved[s].path);
+	free(saved);
+}
+
+//  plans how to run a script read ahead of time: commands whose pixels are
+//  never read only reply, runs of ROTATEs by right angles turn the image
+//  once, and SAVEs of pixels already saved in the same format copy that
+//  file; the replies and files stay the same as running every command,
+//  except for MEMORY, which reports the work done (nothing is optimized)
+script_step *optimize_script(char **lines, int count)
+{
+	size_t size = count > 0 ? (size_t)count : 1;
+
+	script_step *steps = malloc(sizeof(script_step) * size);
+	DIE(!steps, "malloc steps");
+
+	for (int i = 0; i < count; ++i) {
+		steps[i].dead = false;
+		steps[i].turn = -1;
+		steps[i].turned = false;
+		steps[i].leader = NULL;
+		steps[i].source = NULL;
+		steps[i].path = NULL;
+	}
+
+	script_command *commands = malloc(sizeof(script_command) * size);
+	DIE(!commands, "malloc commands");
+
+	parse_commands(lines, count, commands);
+
+	//  the commands after EXIT never run
+	int length = 0;
+	while (length < count && commands[length].kind != COMMAND_EXIT)
+		length++;
+
+	bool memory = false;
+	for (int i = 0; i < length; ++i)
+		memory = memory || commands[i].kind == COMMAND_MEMORY;
+
+	if (!memory) {
+		find_dead_pixels(commands, length, steps);
+		join_rotations(commands, length, steps);
+		share_saves(commands, length, steps);
+	}
+
+	free(commands);
+	return steps;
+}
+
+//  frees the plan of a script
+void free_script(script_step *steps, int count)
+{
+	for (int i = 0; i < count; ++i)
+		free(steps[i].path);
+
+	free(steps);
+}
+
+//  records the file a SAVE wrote, for the SAVEs copying it
+void step_saved(script_step *step, char *path)
+{
+	if (!step)
+		return;
+
+	free(step->path);
+	step->path = strdup(path);
+	DIE(!step->path, "strdup path");
+}
@@ -0,0 +1,32 @@
+#ifndef OPTIMIZE_UTTILS_
+#define OPTIMIZE_UTTILS_
+
+#include <stdbool.h>
+
+//  how the editor runs a command of a script optimized ahead of time
+typedef struct script_step {
+	//  the pixels the command computes are never read (a LOAD replaces them
+	//  or the script ends first): it only checks its arguments and replies
+	bool dead;
+	//  first of a run of ROTATEs by right angles: the sum of their angles,
+	//  in [0, 360), or -1
+	int turn;
+	//  set once the first ROTATE of the run turned the entire image by the
+	//  sum, the others only check their arguments and reply then
+	bool turned;
+	//  first ROTATE of the run of a ROTATE after it, or NULL
+	struct script_step *leader;
+	//  earlier SAVE of the same pixels in the same format: the file it
+	//  wrote is copied instead of encoding the image again (or NULL)
+	struct script_step *source;
+	//  file the SAVE wrote, once it ran
+	char *path;
+} script_step;
+
+script_step *optimize_script(char **lines, int count);
+
+void free_script(script_step *steps, int count);
+
+void step_saved(script_step *step, char *path);
+
+#endif /* OPTIMIZE_UTTILS_ */
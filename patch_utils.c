@@ -0,0 +1,292 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "patch_utils.h"
+#include "matrix_utils.h"
+#include "bitmap_utils.h"
+#include "memory_utils.h"
+#include "utils.h"
+
+//  bytes of changed rows encoded before they are written
+#define PATCH_BUFFER_SIZE (1 << 20)
+
+//  records of the images saved in binary files, a file belongs to the
+//  latest one that wrote it
+static save_record *records;
+
+//  guards the list and the paths of the records, the sessions of a server
+//  share the files; the rows of a record are only marked by its image's
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+//  unlinks and frees the record of the image, if any
+static void drop_record(my_image *image)
+{
+	save_record *r = image->saved;
+
+	if (!r)
+		return;
+
+	save_record **it = &records;
+	while (*it != r)
+		it = &(*it)->next;
+	*it = r->next;
+
+	mem_free(r->dirty);
+	free(r);
+	image->saved = NULL;
+}
+
+//  modification time of a file in ns
+static int64_t mtime_ns(struct stat *st)
+{
+	return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+//  the records of the file don't describe it anymore
+static void drop_file(dev_t dev, ino_t ino)
+{
+	for (save_record *r = records; r; r = r->next)
+		if (r->valid && r->dev == dev && r->ino == ino)
+			r->valid = false;
+}
+
+//  the file was written by something else than its record's image
+void release_path(char *path)
+{
+	struct stat st;
+
+	if (stat(path, &st))
+		return;
+
+	pthread_mutex_lock(&lock);
+	drop_file(st.st_dev, st.st_ino);
+	pthread_mutex_unlock(&lock);
+}
+
+//  starts recording the rows of the image changed since its binary SAVE to
+//  the opened file, the next SAVE to that file only writes them (once the
+//  SAVE is stamped)
+void track_save(my_image *image, FILE *file)
+{
+	struct stat st;
+
+	pthread_mutex_lock(&lock);
+
+	drop_record(image);
+
+	//  untracked, the next SAVE writes the whole file
+	if (fstat(fileno(file), &st)) {
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+
+	drop_file(st.st_dev, st.st_ino);
+
+	save_record *r = malloc(sizeof(save_record));
+	DIE(!r, "malloc save record");
+
+	r->height = image->height;
+	r->dirty = mem_alloc(sizeof(uint64_t) * BITMAP_WORDS(r->height), MEM_IO);
+
+	//  untracked, the next SAVE writes the whole file
+	if (!r->dirty) {
+		free(r);
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+
+	r->valid = true;
+	r->dev = st.st_dev;
+	r->ino = st.st_ino;
+	r->stamped = false;
+	memset(r->dirty, 0, sizeof(uint64_t) * BITMAP_WORDS(r->height));
+
+	r->next = records;
+	records = r;
+	image->saved = r;
+
+	pthread_mutex_unlock(&lock);
+}
+
+//  records the modification time and size of a file a SAVE just wrote
+//  (before it is closed), its record now describes it
+void stamp_save(FILE *file)
+{
+	struct stat st;
+
+	if (fflush(file) || fstat(fileno(file), &st))
+		return;
+
+	pthread_mutex_lock(&lock);
+
+	for (save_record *r = records; r; r = r->next) {
+		if (r->valid && r->dev == st.st_dev && r->ino == st.st_ino) {
+			r->stamped = true;
+			r->mtime = mtime_ns(&st);
+			r->size = st.st_size;
+		}
+	}
+
+	pthread_mutex_unlock(&lock);
+}
+
+//  records that the rows [y1, y2) of the image changed
+void mark_rows_changed(my_image *image, int y1, int y2)
+{
+	save_record *r = image->saved;
+
+	if (!r)
+		return;
+
+	y1 = y1 < 0 ? 0 : y1;
+	y2 = y2 > r->height ? r->height : y2;
+
+	//  the rows are the pixels of a bitmap of one row
+	if (y1 < y2)
+		fill_bitmap(&r->dirty, y1, 0, y2, 1, 1);
+}
+
+//  stops recording the changes of the image (e.g. every pixel changed)
+void forget_save(my_image *image)
+{
+	if (!image->saved)
+		return;
+
+	pthread_mutex_lock(&lock);
+	drop_record(image);
+	pthread_mutex_unlock(&lock);
+}
+
+//  writes length bytes at the given offset of the file
+static bool write_at(int fd, unsigned char *buffer, size_t length,
+					 off_t offset)
+{
+	while (length) {
+		ssize_t written = pwrite(fd, buffer, length, offset);
+
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+
+		buffer += written;
+		length -= written;
+		offset += written;
+	}
+
+	return true;
+}
+
+//  writes the changed rows of the image over the file
+static bool write_rows(my_image *image, char *path)
+{
+	save_record *r = image->saved;
+
+	if (!r || !r->valid || !r->stamped || r->height != image->height)
+		return false;
+
+	char header[MAX_LINE_SIZE], found[MAX_LINE_SIZE];
+	int header_size = binary_header(image, header, sizeof(header));
+	int height = image->height, width = image->width;
+	double **planes[3];
+	int channels = image_planes(image, planes);
+	uint64_t **bits = channels ? NULL : ((bit_img *)image->img)->rows;
+	size_t row_size = channels ?
+					  b_row_size(width, channels, image->pixel_value) :
+					  (size_t)(width + 7) / 8;
+
+	int fd = open(path, O_RDWR);
+	if (fd < 0)
+		return false;
+
+	//  the same file, untouched since the SAVE
+	struct stat st;
+	bool same = !fstat(fd, &st) && st.st_dev == r->dev &&
+				st.st_ino == r->ino && mtime_ns(&st) == r->mtime &&
+				st.st_size == r->size &&
+				(size_t)st.st_size == header_size + row_size * height &&
+				pread(fd, found, header_size, 0) == header_size &&
+				!memcmp(found, header, header_size);
+
+	//  rows encoded at once
+	size_t rows = PATCH_BUFFER_SIZE / row_size;
+	rows = rows < 1 ? 1 : rows;
+
+	unsigned char *buffer = same ? mem_alloc(row_size * rows, MEM_IO) : NULL;
+	bool patched = buffer;
+
+	for (int y = 0; y < height && patched;) {
+		//  skip the unchanged rows a word at a time
+		if (!(r->dirty[y >> 6] << (y & 63))) {
+			y += 64 - (y & 63);
+			continue;
+		}
+
+		if (!BIT_GET(r->dirty, y)) {
+			y++;
+			continue;
+		}
+
+		//  encode a run of changed rows, then write it over the old one
+		int first = y;
+		size_t length = 0;
+
+		while (y < height && BIT_GET(r->dirty, y) &&
+			   (size_t)(y - first) < rows) {
+			if (channels)
+				b_encode_row(planes, channels, y, width,
+							 image->pixel_value, buffer + length);
+			else
+				b_bits_encode_row(bits[y], width, buffer + length);
+
+			length += row_size;
+			y++;
+		}
+
+		patched = write_at(fd, buffer, length,
+						   header_size + (off_t)first * row_size);
+	}
+
+	mem_free(buffer);
+
+	//  the file now holds the image, as it was written
+	if (patched && !fstat(fd, &st)) {
+		r->mtime = mtime_ns(&st);
+		r->size = st.st_size;
+	} else {
+		patched = false;
+	}
+
+	if (close(fd))
+		patched = false;
+
+	if (patched)
+		memset(r->dirty, 0, sizeof(uint64_t) * BITMAP_WORDS(r->height));
+	else
+		r->stamped = false;
+
+	return patched;
+}
+
+//  writes the rows of the image changed since its last binary SAVE to path
+//  over that file, in place; returns false if the file has to be written
+//  again: it was saved from another image or changed since (its header or
+//  size differs), every pixel changed, or memory is exhausted
+bool patch_save(my_image *image, char *path)
+{
+	//  the record can't be released meanwhile
+	pthread_mutex_lock(&lock);
+	bool patched = write_rows(image, path);
+	pthread_mutex_unlock(&lock);
+
+	return patched;
+}
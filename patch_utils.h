@@ -0,0 +1,42 @@
+#ifndef PATCH_UTTILS_
+#define PATCH_UTTILS_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include "image_utils.h"
+
+//  last binary SAVE of an image: the file holds the image as it was then,
+//  except for the rows changed since
+typedef struct save_record {
+	//  false once something else wrote the file
+	bool valid;
+	//  the file, by its device and inode (not its path, which has aliases)
+	dev_t dev;
+	ino_t ino;
+	//  the file's modification time (in ns) and size once the SAVE wrote
+	//  it, unknown until then
+	bool stamped;
+	int64_t mtime;
+	off_t size;
+	int height;
+	//  one bit per row (see bitmap_utils), set if the row changed
+	uint64_t *dirty;
+	//  records of all images
+	struct save_record *next;
+} save_record;
+
+void track_save(my_image *image, FILE *file);
+
+void stamp_save(FILE *file);
+
+void mark_rows_changed(my_image *image, int y1, int y2);
+
+void forget_save(my_image *image);
+
+void release_path(char *path);
+
+bool patch_save(my_image *image, char *path);
+
+#endif /* PATCH_UTTILS_ */
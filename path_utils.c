@@ -0,0 +1,44 @@
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "path_utils.h"
+#include "utils.h"
+
+//  gets a name of the file that all of its paths share ("out.pgm",
+//  "./out.pgm" and "d/../out.pgm" get the same one): the real path of the
+//  file, or of its directory followed by its name if the file doesn't
+//  exist yet; a path whose directory doesn't exist is kept as it is.
+//  The name is allocated, the caller frees it
+char *canonical_path(const char *path)
+{
+	char *real = realpath(path, NULL);
+	if (real)
+		return real;
+
+	//  the directory is everything before the last slash ("/" for "/x")
+	const char *slash = strrchr(path, '/');
+	const char *name = slash ? slash + 1 : path;
+	char *dir = slash ? strndup(path, slash - path + (slash == path)) :
+				strdup(".");
+	DIE(!dir, "strdup dir");
+
+	real = realpath(dir, NULL);
+	free(dir);
+
+	if (!real) {
+		char *copy = strdup(path);
+		DIE(!copy, "strdup path");
+		return copy;
+	}
+
+	//  the root directory already ends with a slash
+	bool root = !strcmp(real, "/");
+	char *canonical = malloc(strlen(real) + strlen(name) + 2);
+	DIE(!canonical, "malloc path");
+	sprintf(canonical, "%s/%s", root ? "" : real, name);
+
+	free(real);
+	return canonical;
+}
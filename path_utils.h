@@ -0,0 +1,6 @@
+#ifndef PATH_UTTILS_
+#define PATH_UTTILS_
+
+char *canonical_path(const char *path);
+
+#endif /* PATH_UTTILS_ */
@@ -0,0 +1,337 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "pipeline_utils.h"
+#include "memory_utils.h"
+#include "cache_utils.h"
+#include "path_utils.h"
+#include "utils.h"
+
+//  number of input lines that can be read ahead
+#define QUEUE_SIZE 64
+
+//  max number of images decoded ahead and not yet used by their LOAD
+#define PREFETCH_DEPTH 2
+
+//  lines read ahead, waiting to be executed
+typedef struct {
+	command_entry entries[QUEUE_SIZE];
+	int head;
+	int count;
+} command_queue;
+
+//  files written by commands read so far, by canonical path (the same
+//  file may be named "out.pgm" and "./out.pgm")
+typedef struct {
+	char **paths;
+	int count;
+} written_files;
+
+static FILE *input_file;
+
+static command_queue queue;
+
+//  LOADs waiting for the I/O thread
+static prefetch *io_head;
+static prefetch *io_tail;
+
+//  images being decoded or decoded and not released yet
+static int prefetched;
+
+//  only touched by the reader thread
+static written_files written;
+
+//  set by the first MEMORY command read, no LOAD after it is read ahead:
+//  a limit (or a report) must see the same allocations as running the
+//  commands one by one
+static bool stopped;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_changed = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t io_changed = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t load_done = PTHREAD_COND_INITIALIZER;
+
+//  checks if a file (by canonical path) was named as output by an
+//  earlier command
+static bool is_canonical_written(char *canonical)
+{
+	for (int i = 0; i < written.count; ++i)
+		if (!strcmp(written.paths[i], canonical))
+			return true;
+
+	return false;
+}
+
+//  checks if a file was named as output by an earlier command
+static bool is_written(char *path)
+{
+	char *canonical = canonical_path(path);
+	bool found = is_canonical_written(canonical);
+
+	free(canonical);
+	return found;
+}
+
+//  remembers that a command writes the given file
+static void add_written(char *path)
+{
+	char *canonical = canonical_path(path);
+
+	if (is_canonical_written(canonical)) {
+		free(canonical);
+		return;
+	}
+
+	char **paths = realloc(written.paths, sizeof(char *) * (written.count + 1));
+	DIE(!paths, "realloc paths");
+
+	written.paths = paths;
+	written.paths[written.count++] = canonical;
+}
+
+//  queues a LOAD of the given file on the I/O thread
+static prefetch *schedule_load(char *path)
+{
+	prefetch *load = calloc(1, sizeof(prefetch));
+	DIE(!load, "calloc load");
+
+	memcpy(load->path, path, strlen(path) + 1);
+	load->state = PREFETCH_PENDING;
+
+	pthread_mutex_lock(&lock);
+
+	if (io_tail)
+		io_tail->next = load;
+	else
+		io_head = load;
+	io_tail = load;
+
+	pthread_cond_signal(&io_changed);
+	pthread_mutex_unlock(&lock);
+
+	return load;
+}
+
+//  looks ahead at a line: starts LOADs early and tracks written files
+static prefetch *plan_command(char *line)
+{
+	char copy[MAX_INPUT_LINE_SIZE];
+	memcpy(copy, line, strlen(line) + 1);
+
+	char *save;
+	//  split the line the same way the editor does
+	char *command = strtok_r(copy, " ", &save);
+	char *args = strtok_r(NULL, "\n", &save);
+
+	if (command && !strncmp(command, "MEMORY", sizeof("MEMORY") - 1))
+		stopped = true;
+
+	if (!command || !args || stopped)
+		return NULL;
+
+	if (!strncmp(command, "SAVE", sizeof("SAVE") - 1)) {
+		char *path = strtok_r(args, " ", &save);
+		if (path)
+			add_written(path);
+		return NULL;
+	}
+
+	//  HISTOGRAM [<bins>] [<file>] and LABEL [4 | 8] [<file>]
+	if (!strncmp(command, "HISTOGRAM", sizeof("HISTOGRAM") - 1) ||
+		!strncmp(command, "LABEL", sizeof("LABEL") - 1)) {
+		char *path = strtok_r(args, " ", &save);
+		if (path && !not_a_num(path))
+			path = strtok_r(NULL, " ", &save);
+		if (path)
+			add_written(path);
+		return NULL;
+	}
+
+	if (!strncmp(command, "SNAPSHOT", sizeof("SNAPSHOT") - 1)) {
+		char *path = strtok_r(args, " ", &save);
+		if (path)
+			add_written(path);
+		return NULL;
+	}
+
+	if (!strncmp(command, "THUMBNAIL", sizeof("THUMBNAIL") - 1)) {
+		strtok_r(args, " ", &save);
+		char *path = strtok_r(NULL, " ", &save);
+		if (path)
+			add_written(path);
+		return NULL;
+	}
+
+	if (strncmp(command, "LOAD", sizeof("LOAD") - 1))
+		return NULL;
+
+	//  LOAD <file> or LOAD <slot> <file>
+	char *path = strtok_r(args, " ", &save);
+	char *file = strtok_r(NULL, " ", &save);
+	if (file)
+		path = file;
+
+	//  invalid LOAD, the editor will report it
+	if (!path || strtok_r(NULL, " ", &save))
+		return NULL;
+
+	//  the file may change before the LOAD runs, read it at that time
+	if (is_written(path))
+		return NULL;
+
+	return schedule_load(path);
+}
+
+//  reads input lines ahead of the editor
+static void *reader_thread(void *arg)
+{
+	(void)arg;
+
+	while (true) {
+		command_entry entry;
+		entry.load = NULL;
+		entry.eof = !fgets(entry.line, MAX_INPUT_LINE_SIZE, input_file);
+
+		if (!entry.eof)
+			entry.load = plan_command(entry.line);
+
+		pthread_mutex_lock(&lock);
+
+		//  wait for the editor to make room
+		while (queue.count == QUEUE_SIZE)
+			pthread_cond_wait(&queue_changed, &lock);
+
+		queue.entries[(queue.head + queue.count) % QUEUE_SIZE] = entry;
+		queue.count++;
+
+		pthread_cond_broadcast(&queue_changed);
+		pthread_mutex_unlock(&lock);
+
+		if (entry.eof)
+			break;
+	}
+
+	return NULL;
+}
+
+//  decodes an image ahead of its LOAD command
+static enum prefetch_state decode(prefetch *load)
+{
+	load->image = malloc(sizeof(my_image));
+	DIE(!load->image, "malloc load->image");
+	init_image_data(load->image);
+
+	enum load_status status = cache_load(load->path, load->image);
+	if (status == LOAD_OK)
+		return PREFETCH_LOADED;
+
+	free_image_data(load->image);
+	free(load->image);
+	load->image = NULL;
+
+	//  not enough memory now, the LOAD will retry
+	if (status == LOAD_NO_MEMORY)
+		return PREFETCH_FAILED;
+
+	return PREFETCH_NO_FILE;
+}
+
+//  reads and decodes the files of upcoming LOAD commands
+static void *io_thread(void *arg)
+{
+	(void)arg;
+
+	pthread_mutex_lock(&lock);
+
+	while (true) {
+		//  wait for a LOAD and for room to keep its image
+		while (!io_head || prefetched >= PREFETCH_DEPTH)
+			pthread_cond_wait(&io_changed, &lock);
+
+		prefetch *load = io_head;
+		io_head = load->next;
+		if (!io_head)
+			io_tail = NULL;
+		prefetched++;
+
+		pthread_mutex_unlock(&lock);
+		enum prefetch_state state = decode(load);
+		pthread_mutex_lock(&lock);
+
+		load->state = state;
+		pthread_cond_broadcast(&load_done);
+	}
+
+	return NULL;
+}
+
+//  starts reading commands from the given file ahead of their execution
+void pipeline_start(FILE *input)
+{
+	pthread_t reader, io;
+
+	input_file = input;
+
+	DIE(pthread_create(&reader, NULL, reader_thread, NULL), "reader thread");
+	DIE(pthread_create(&io, NULL, io_thread, NULL), "io thread");
+
+	pthread_detach(reader);
+	pthread_detach(io);
+}
+
+//  gets the next input line in order, returns false when input ended
+bool pipeline_next(command_entry *entry)
+{
+	pthread_mutex_lock(&lock);
+
+	while (!queue.count)
+		pthread_cond_wait(&queue_changed, &lock);
+
+	*entry = queue.entries[queue.head];
+
+	//  keep the end of input marker for later calls
+	if (!entry->eof) {
+		queue.head = (queue.head + 1) % QUEUE_SIZE;
+		queue.count--;
+		pthread_cond_broadcast(&queue_changed);
+	}
+
+	pthread_mutex_unlock(&lock);
+
+	return !entry->eof;
+}
+
+//  waits until the I/O thread is done with a LOAD
+enum prefetch_state prefetch_wait(prefetch *load)
+{
+	pthread_mutex_lock(&lock);
+
+	while (load->state == PREFETCH_PENDING)
+		pthread_cond_wait(&load_done, &lock);
+
+	enum prefetch_state state = load->state;
+	pthread_mutex_unlock(&lock);
+
+	return state;
+}
+
+//  frees a finished LOAD and its image, unless the editor took it
+void prefetch_release(prefetch *load)
+{
+	if (load->image) {
+		free_image_data(load->image);
+		free(load->image);
+	}
+
+	pthread_mutex_lock(&lock);
+
+	prefetched--;
+	pthread_cond_signal(&io_changed);
+
+	pthread_mutex_unlock(&lock);
+
+	free(load);
+}
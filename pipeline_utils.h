@@ -0,0 +1,42 @@
+#ifndef PIPELINE_UTTILS_
+#define PIPELINE_UTTILS_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "image_utils.h"
+#include "editor_utils.h"
+
+//  state of an image decoded ahead of its LOAD command
+enum prefetch_state {
+	PREFETCH_PENDING = 0,
+	PREFETCH_LOADED = 1,
+	PREFETCH_NO_FILE = 2,
+	PREFETCH_FAILED = 3
+};
+
+//  LOAD whose file is read by the I/O thread before the command runs
+typedef struct prefetch {
+	char path[MAX_INPUT_LINE_SIZE];
+	my_image *image;
+	enum prefetch_state state;
+	struct prefetch *next;
+} prefetch;
+
+//  input line read ahead of its execution
+typedef struct {
+	char line[MAX_INPUT_LINE_SIZE];
+	//  input ended, there is no line
+	bool eof;
+	//  background load of the file named by a LOAD line (or NULL)
+	prefetch *load;
+} command_entry;
+
+void pipeline_start(FILE *input);
+
+bool pipeline_next(command_entry *entry);
+
+enum prefetch_state prefetch_wait(prefetch *load);
+
+void prefetch_release(prefetch *load);
+
+#endif /* PIPELINE_UTTILS_ */
@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include "point_utils.h"
+#include "lut_utils.h"
+#include "pyramid_utils.h"
+#include "patch_utils.h"
+#include "utils.h"
+
+//  names of the point operations, in the order of enum point_op
+static char *names[] = {
+	"BRIGHTNESS", "CONTRAST", "GAMMA", "LEVELS", "INVERT", "THRESHOLD"
+};
+
+//  gets a point operation by name (a command without arguments still
+//  ends with the new line)
+bool get_point_op(char *name, enum point_op *op)
+{
+	for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); ++i) {
+		size_t len = strlen(names[i]);
+
+		if (!strncmp(name, names[i], len) &&
+			(name[len] == '\0' || name[len] == '\n')) {
+			*op = i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+//  gets the name of a point operation
+char *point_op_name(enum point_op op)
+{
+	return names[op];
+}
+
+//  checks the parameters of a point operation:
+//  BRIGHTNESS <delta>, CONTRAST <factor>, GAMMA <gamma>,
+//  LEVELS <in low> <in high> [<out low> <out high>], INVERT, THRESHOLD <t>
+bool point_params_are_invalid(enum point_op op, double *params, int count)
+{
+	switch (op) {
+	case BRIGHTNESS:
+		return count != 1;
+	case CONTRAST:
+		return count != 1 || params[0] < 0;
+	case GAMMA:
+		return count != 1 || params[0] <= 0;
+	case LEVELS:
+		return (count != 2 && count != 4) || params[0] >= params[1];
+	case INVERT:
+		return count != 0;
+	case THRESHOLD:
+		return count != 1;
+	}
+
+	return true;
+}
+
+//  computes the value of a pixel after the operation
+static double point_value(enum point_op op, double *params, int count,
+						  double v, double max)
+{
+	switch (op) {
+	case BRIGHTNESS:
+		v += params[0];
+		break;
+	case CONTRAST:
+		//  stretch the values away from (or towards) the middle one
+		v = (v - max / 2) * params[0] + max / 2;
+		break;
+	case GAMMA:
+		v = max * pow(v / max, 1 / params[0]);
+		break;
+	case LEVELS: {
+		double t = (v - params[0]) / (params[1] - params[0]);
+		double low = count == 4 ? params[2] : 0;
+		double high = count == 4 ? params[3] : max;
+
+		t = t < 0 ? 0 : t > 1 ? 1 : t;
+		v = low + t * (high - low);
+		break;
+	}
+	case INVERT:
+		v = max - v;
+		break;
+	case THRESHOLD:
+		v = v >= params[0] ? max : 0;
+		break;
+	}
+
+	return v < 0 ? 0 : v > max ? max : v;
+}
+
+//  composes the operation with the ones waiting for the image's pixels:
+//  only the tables change (one entry per value), the pixels are changed
+//  once by flush_point_ops, returns false if memory is exhausted
+bool add_point_op(my_image *image, enum point_op op, double *params,
+				  int count)
+{
+	lut *t = image->pending;
+
+	if (!t) {
+		t = malloc(sizeof(lut));
+		DIE(!t, "malloc lut");
+
+		if (!lut_init(t, image)) {
+			free(t);
+			return false;
+		}
+
+		image->pending = t;
+	}
+
+	for (int c = 0; c < t->channels; ++c)
+		for (int v = 0; v < t->size; ++v)
+			t->table[c][v] = point_value(op, params, count, t->table[c][v],
+										 image->pixel_value);
+
+	return true;
+}
+
+//  applies the composed point operations to the selection, in one pass
+void flush_point_ops(my_image *image)
+{
+	if (!image->pending)
+		return;
+
+	lut_apply(image, image->pending);
+
+	mark_dirty(image, image->select->x1, image->select->y1,
+			   image->select->x2, image->select->y2);
+	mark_rows_changed(image, image->select->y1, image->select->y2);
+
+	drop_point_ops(image);
+}
+
+//  forgets the point operations that were not applied
+void drop_point_ops(my_image *image)
+{
+	if (!image->pending)
+		return;
+
+	lut_free(image->pending);
+	free(image->pending);
+	image->pending = NULL;
+}
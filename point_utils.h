@@ -0,0 +1,30 @@
+#ifndef POINT_UTTILS_
+#define POINT_UTTILS_
+
+#include <stdbool.h>
+#include "image_utils.h"
+
+//  operations that change every pixel on its own, by its value
+enum point_op {
+	BRIGHTNESS = 0,
+	CONTRAST = 1,
+	GAMMA = 2,
+	LEVELS = 3,
+	INVERT = 4,
+	THRESHOLD = 5
+};
+
+bool get_point_op(char *name, enum point_op *op);
+
+char *point_op_name(enum point_op op);
+
+bool point_params_are_invalid(enum point_op op, double *params, int count);
+
+bool add_point_op(my_image *image, enum point_op op, double *params,
+				  int count);
+
+void flush_point_ops(my_image *image);
+
+void drop_point_ops(my_image *image);
+
+#endif /* POINT_UTTILS_ */
@@ -0,0 +1,319 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include "pyramid_utils.h"
+#include "matrix_utils.h"
+#include "bitmap_utils.h"
+#include "memory_utils.h"
+#include "resize_utils.h"
+#include "worker_utils.h"
+#include "utils.h"
+
+//  reduction of a region of a level into the next level
+typedef struct {
+	//  source level, either planes or (for level 0 of a black & white
+	//  image) packed pixels
+	double **src;
+	uint64_t **bits;
+	int src_height;
+	int src_width;
+	double **dst;
+	//  columns [x1, x2) of the rows [y1, y1 + band rows) of dst
+	int x1;
+	int x2;
+	int y1;
+} reduction;
+
+//  frees a pyramid and its levels
+void free_pyramid(pyramid *p)
+{
+	if (!p)
+		return;
+
+	for (int k = 1; k <= p->levels; ++k)
+		for (int c = 0; c < p->channels; ++c)
+			free_matrix(p->planes[k][c], p->height[k]);
+
+	free(p);
+}
+
+//  records that the pixels [x1, x2) x [y1, y2) of the image changed,
+//  only the pyramid blocks over them are recomputed
+void mark_dirty(my_image *image, int x1, int y1, int x2, int y2)
+{
+	pyramid *p = image->pyramid;
+
+	if (!p)
+		return;
+
+	if (!p->dirty) {
+		set_selection(&p->region, x1, y1, x2, y2);
+		p->dirty = true;
+		return;
+	}
+
+	//  grow the region to cover both changes
+	my_select *r = &p->region;
+	set_selection(r, x1 < r->x1 ? x1 : r->x1, y1 < r->y1 ? y1 : r->y1,
+				  x2 > r->x2 ? x2 : r->x2, y2 > r->y2 ? y2 : r->y2);
+}
+
+//  drops the pyramid of an image whose size (or every pixel) changed
+void invalidate_pyramid(my_image *image)
+{
+	free_pyramid(image->pyramid);
+	image->pyramid = NULL;
+}
+
+//  gets a pixel of the source level, the last row and column are
+//  repeated for odd dimensions
+static double get_level_pixel(reduction *r, int i, int j)
+{
+	if (i >= r->src_height)
+		i = r->src_height - 1;
+	if (j >= r->src_width)
+		j = r->src_width - 1;
+
+	if (r->bits)
+		return (double)BIT_GET(r->bits[i], j);
+
+	return r->src[i][j];
+}
+
+//  worker task, averages the 2x2 blocks under a band of rows
+static void reduce_band(void *arg, int begin, int end, int worker)
+{
+	reduction *r = arg;
+
+	(void)worker;
+
+	for (int i = r->y1 + begin; i < r->y1 + end; ++i) {
+		double *out = r->dst[i];
+		int j = r->x1;
+
+		//  both source rows and columns exist: no checks (vectorized)
+		if (!r->bits && 2 * i + 1 < r->src_height) {
+			double *a = r->src[2 * i];
+			double *b = r->src[2 * i + 1];
+			int last = r->x2 < r->src_width / 2 ? r->x2 : r->src_width / 2;
+
+			for (; j < last; ++j)
+				out[j] = 0.25 * (a[2 * j] + a[2 * j + 1] +
+								 b[2 * j] + b[2 * j + 1]);
+		}
+
+		for (; j < r->x2; ++j)
+			out[j] = 0.25 * (get_level_pixel(r, 2 * i, 2 * j) +
+							 get_level_pixel(r, 2 * i, 2 * j + 1) +
+							 get_level_pixel(r, 2 * i + 1, 2 * j) +
+							 get_level_pixel(r, 2 * i + 1, 2 * j + 1));
+	}
+}
+
+//  recomputes the region [x1, x2) x [y1, y2) of level k from level k - 1
+static void reduce_level(my_image *image, pyramid *p, int k,
+						 my_select *region)
+{
+	double **planes[3] = {NULL, NULL, NULL};
+
+	if (k == 1)
+		image_planes(image, planes);
+
+	for (int c = 0; c < p->channels; ++c) {
+		reduction r;
+
+		r.src = k == 1 ? planes[c] : p->planes[k - 1][c];
+		r.bits = k == 1 && image->img_type == BLACK_WHITE ?
+				 ((bit_img *)image->img)->rows : NULL;
+		r.src_height = p->height[k - 1];
+		r.src_width = p->width[k - 1];
+		r.dst = p->planes[k][c];
+		r.x1 = region->x1;
+		r.x2 = region->x2;
+		r.y1 = region->y1;
+
+		workers_run(region->y2 - region->y1, reduce_band, &r);
+	}
+}
+
+//  region of level k covered by a region of level k - 1
+static void halve_region(my_select *region)
+{
+	set_selection(region, region->x1 / 2, region->y1 / 2,
+				  (region->x2 + 1) / 2, (region->y2 + 1) / 2);
+}
+
+//  brings the levels up to date and builds them down to the given one,
+//  returns false if memory is exhausted
+static bool build_levels(my_image *image, int level)
+{
+	pyramid *p = image->pyramid;
+
+	if (!p) {
+		p = calloc(1, sizeof(pyramid));
+		DIE(!p, "calloc pyramid");
+
+		p->channels = image->img_type == COLOR ? 3 : 1;
+		p->height[0] = image->height;
+		p->width[0] = image->width;
+		image->pyramid = p;
+	}
+
+	//  recompute the changed blocks of the levels already built
+	if (p->dirty) {
+		my_select region = p->region;
+
+		for (int k = 1; k <= p->levels; ++k) {
+			halve_region(&region);
+			reduce_level(image, p, k, &region);
+		}
+
+		p->dirty = false;
+	}
+
+	//  build the missing levels
+	while (p->levels < level) {
+		int k = p->levels + 1;
+
+		p->height[k] = (p->height[k - 1] + 1) / 2;
+		p->width[k] = (p->width[k - 1] + 1) / 2;
+
+		for (int c = 0; c < p->channels; ++c) {
+			p->planes[k][c] = alloc_matrix_in(p->height[k], p->width[k],
+											  MEM_CACHE);
+
+			if (!p->planes[k][c]) {
+				for (int d = 0; d < c; ++d)
+					free_matrix(p->planes[k][d], p->height[k]);
+				return false;
+			}
+		}
+
+		my_select region = {0, p->width[k], 0, p->height[k]};
+		p->levels = k;
+		reduce_level(image, p, k, &region);
+	}
+
+	return true;
+}
+
+//  copies a level in a new image of the same kind (a black & white image
+//  becomes a grayscale one, 1 bits are black), returns NULL if memory is
+//  exhausted
+static my_image *level_image(my_image *image, int level)
+{
+	pyramid *p = image->pyramid;
+	int n = level ? p->height[level] : image->height;
+	int m = level ? p->width[level] : image->width;
+
+	my_image *copy = malloc(sizeof(my_image));
+	DIE(!copy, "malloc copy");
+	init_image_data(copy);
+
+	copy->file_type = BINARY;
+	copy->img_type = image->img_type == COLOR ? COLOR : GRAYSCALE;
+	copy->height = n;
+	copy->width = m;
+	copy->pixel_value = image->img_type == BLACK_WHITE ?
+						255 : image->pixel_value;
+	set_selection(copy->select, 0, 0, m, n);
+
+	double **planes[3] = {NULL, NULL, NULL};
+	double **src[3] = {NULL, NULL, NULL};
+	bool copied = true;
+
+	if (level)
+		memcpy(src, p->planes[level], sizeof(src));
+	else
+		image_planes(image, src);
+
+	for (int c = 0; c < p->channels; ++c) {
+		if (image->img_type != BLACK_WHITE) {
+			planes[c] = copy_matrix(src[c], n, m, MEM_SCRATCH);
+		} else if (level) {
+			planes[c] = copy_matrix(src[c], n, m, MEM_SCRATCH);
+			if (planes[c])
+				for (int i = 0; i < n; ++i)
+					for (int j = 0; j < m; ++j)
+						planes[c][i][j] = 255 * (1 - planes[c][i][j]);
+		} else {
+			planes[c] = unpack_bitmap(((bit_img *)image->img)->rows, n, m,
+									  MEM_SCRATCH);
+			if (planes[c])
+				for (int i = 0; i < n; ++i)
+					for (int j = 0; j < m; ++j)
+						planes[c][i][j] = 255 * (1 - planes[c][i][j]);
+		}
+
+		copied = copied && planes[c];
+	}
+
+	if (copied && copy->img_type == COLOR) {
+		color_img color = {planes[0], planes[1], planes[2]};
+
+		copy->img = mem_alloc(sizeof(color_img), MEM_SCRATCH);
+		if (copy->img) {
+			memcpy(copy->img, &color, sizeof(color_img));
+			return copy;
+		}
+	} else if (copied) {
+		basic_img basic = {planes[0]};
+
+		copy->img = mem_alloc(sizeof(basic_img), MEM_SCRATCH);
+		if (copy->img) {
+			memcpy(copy->img, &basic, sizeof(basic_img));
+			return copy;
+		}
+	}
+
+	for (int c = 0; c < 3; ++c)
+		free_matrix(planes[c], n);
+	free_image_data(copy);
+	free(copy);
+	return NULL;
+}
+
+//  makes a preview of the image that fits in max_dim x max_dim, resized
+//  from the smallest pyramid level that is still large enough,
+//  returns NULL if memory is exhausted
+my_image *make_thumbnail(my_image *image, int max_dim)
+{
+	int n = image->height, m = image->width;
+	int level = 0;
+
+	//  size of the preview, never larger than the image
+	double scale = (double)max_dim / (n > m ? n : m);
+	if (scale > 1)
+		scale = 1;
+
+	int height = (int)round(n * scale);
+	int width = (int)round(m * scale);
+	height = height < 1 ? 1 : height;
+	width = width < 1 ? 1 : width;
+
+	//  halve while the next level is still at least as large as the preview
+	while (level + 1 < MAX_LEVELS && (n + 1) / 2 >= height &&
+		   (m + 1) / 2 >= width && (n > 1 || m > 1)) {
+		n = (n + 1) / 2;
+		m = (m + 1) / 2;
+		level++;
+	}
+
+	if (!build_levels(image, level))
+		return NULL;
+
+	my_image *preview = level_image(image, level);
+	if (!preview)
+		return NULL;
+
+	if (!resize_image(preview, width, height, TRIANGLE)) {
+		free_image_data(preview);
+		free(preview);
+		return NULL;
+	}
+
+	return preview;
+}
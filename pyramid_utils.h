@@ -0,0 +1,34 @@
+#ifndef PYRAMID_UTTILS_
+#define PYRAMID_UTTILS_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "image_utils.h"
+
+//  max number of halvings of an image (enough for any int dimension)
+#define MAX_LEVELS 32
+
+//  mipmap pyramid of an image: level k is the image reduced 2^k times,
+//  by averaging blocks of 2x2 pixels of level k - 1 (level 0 is the image)
+typedef struct pyramid {
+	//  number of levels built after level 0
+	int levels;
+	//  number of planes of each level (3 for color images, 1 otherwise)
+	int channels;
+	int height[MAX_LEVELS];
+	int width[MAX_LEVELS];
+	double **planes[MAX_LEVELS][3];
+	//  region of the image changed since the levels were built
+	bool dirty;
+	my_select region;
+} pyramid;
+
+void free_pyramid(pyramid *p);
+
+void mark_dirty(my_image *image, int x1, int y1, int x2, int y2);
+
+void invalidate_pyramid(my_image *image);
+
+my_image *make_thumbnail(my_image *image, int max_dim);
+
+#endif /* PYRAMID_UTTILS_ */
@@ -0,0 +1,419 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "qoi_utils.h"
+#include "matrix_utils.h"
+#include "bitmap_utils.h"
+#include "memory_utils.h"
+#include "worker_utils.h"
+
+//  operations: a 2 bit tag and 6 bits of data, or a whole byte tag
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xc0
+#define QOI_OP_RGB 0xfe
+#define QOI_OP_RGBA 0xff
+#define QOI_TAG_MASK 0xc0
+
+#define QOI_HEADER_SIZE 14
+#define QOI_MAX_RUN 62
+
+//  largest image a file may claim, like the reference decoder's limit
+#define QOI_PIXELS_MAX 400000000
+
+//  pixels encoded by the worker threads before their chunks are written
+#define QOI_ROUND_PIXELS (1 << 20)
+
+//  bytes read from the file at a time
+#define QOI_READ_SIZE (1 << 16)
+
+//  the stream ends with 7 zeros and a one
+static const unsigned char qoi_end[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+//  pixels are packed as 0xRRGGBBAA
+#define QOI_R(px) ((px) >> 24)
+#define QOI_G(px) (((px) >> 16) & 0xff)
+#define QOI_B(px) (((px) >> 8) & 0xff)
+#define QOI_A(px) ((px) & 0xff)
+
+//  encoding of a round of rows: every band of rows is a chunk encoded on its
+//  own, so chunks can be written one after the other
+typedef struct {
+	my_image *image;
+	double **planes[3];
+	int channels;
+	//  samples are scaled to 8 bits
+	double scale;
+	//  first row of the round
+	int first;
+	//  chunk of the band starting at row i of the round is at
+	//  out + 4 * i * width, lengths[i] bytes long (0 if no band starts there)
+	unsigned char *out;
+	size_t *lengths;
+} qoi_job;
+
+//  reads a file a buffer at a time
+typedef struct {
+	FILE *file;
+	unsigned char *buffer;
+	size_t pos;
+	size_t length;
+	//  the file ended (or failed) before the last pixel
+	bool short_read;
+} qoi_reader;
+
+//  checks if a file has to be saved as QOI, by its extension
+bool is_qoi_path(char *path)
+{
+	size_t len = strlen(path);
+
+	return len >= sizeof(".qoi") - 1 &&
+		   !strcmp(path + len - (sizeof(".qoi") - 1), ".qoi");
+}
+
+//  slot of a pixel in the index of recently seen pixels
+static inline int qoi_hash(uint32_t px)
+{
+	return (QOI_R(px) * 3 + QOI_G(px) * 5 + QOI_B(px) * 7 +
+			QOI_A(px) * 11) % 64;
+}
+
+//  rounds a sample to 8 bits
+static inline uint32_t qoi_sample(double v, double scale)
+{
+	v = v * scale + 0.5;
+
+	return v < 0 ? 0 : v >= 255 ? 255 : (uint32_t)v;
+}
+
+//  gets a pixel of the image, grayscale and black & white ones as gray
+static inline uint32_t qoi_pixel(qoi_job *job, int y, int x)
+{
+	if (!job->channels) {
+		uint64_t *row = ((bit_img *)job->image->img)->rows[y];
+		uint32_t v = BIT_GET(row, x) ? 0 : 255;
+
+		return v << 24 | v << 16 | v << 8 | 255;
+	}
+
+	uint32_t r = qoi_sample(job->planes[0][y][x], job->scale);
+	if (job->channels == 1)
+		return r << 24 | r << 16 | r << 8 | 255;
+
+	uint32_t g = qoi_sample(job->planes[1][y][x], job->scale);
+	uint32_t b = qoi_sample(job->planes[2][y][x], job->scale);
+
+	return r << 24 | g << 16 | b << 8 | 255;
+}
+
+//  worker task, encodes a band of rows of the round as a chunk any decoder
+//  can read after the previous one: it starts with a whole pixel, its index
+//  only trusts the slots it filled itself and its last run ends with it
+static void qoi_encode_band(void *arg, int begin, int end, int worker)
+{
+	qoi_job *job = arg;
+	int width = job->image->width;
+	unsigned char *out = job->out + (size_t)4 * begin * width, *p = out;
+	uint32_t index[64], prev = 0;
+	uint64_t valid = 0;
+	bool started = false;
+	int run = 0;
+
+	(void)worker;
+
+	for (int y = job->first + begin; y < job->first + end; ++y) {
+		for (int x = 0; x < width; ++x) {
+			uint32_t px = qoi_pixel(job, y, x);
+
+			if (started && px == prev) {
+				if (++run == QOI_MAX_RUN) {
+					*p++ = QOI_OP_RUN | (run - 1);
+					run = 0;
+				}
+				continue;
+			}
+
+			if (run) {
+				*p++ = QOI_OP_RUN | (run - 1);
+				run = 0;
+			}
+
+			int slot = qoi_hash(px);
+
+			if (started && ((valid >> slot) & 1) && index[slot] == px) {
+				*p++ = QOI_OP_INDEX | slot;
+				prev = px;
+				continue;
+			}
+
+			index[slot] = px;
+			valid |= 1ULL << slot;
+
+			//  differences wrap around like the decoder's sums
+			signed char vr = QOI_R(px) - QOI_R(prev);
+			signed char vg = QOI_G(px) - QOI_G(prev);
+			signed char vb = QOI_B(px) - QOI_B(prev);
+			signed char vg_r = vr - vg;
+			signed char vg_b = vb - vg;
+
+			if (started && vr > -3 && vr < 2 && vg > -3 && vg < 2 &&
+				vb > -3 && vb < 2) {
+				*p++ = QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+			} else if (started && vg_r > -9 && vg_r < 8 && vg > -33 &&
+					   vg < 32 && vg_b > -9 && vg_b < 8) {
+				*p++ = QOI_OP_LUMA | (vg + 32);
+				*p++ = (vg_r + 8) << 4 | (vg_b + 8);
+			} else {
+				*p++ = QOI_OP_RGB;
+				*p++ = QOI_R(px);
+				*p++ = QOI_G(px);
+				*p++ = QOI_B(px);
+			}
+
+			started = true;
+			prev = px;
+		}
+	}
+
+	if (run)
+		*p++ = QOI_OP_RUN | (run - 1);
+
+	job->lengths[begin] = p - out;
+}
+
+//  writes a 32 bit big endian value
+static void put_u32(unsigned char *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+//  reads a 32 bit big endian value
+static uint32_t get_u32(unsigned char *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+		   (uint32_t)p[2] << 8 | p[3];
+}
+
+//  writes the header of a width x height RGB image
+static void put_header(FILE *file, int width, int height)
+{
+	unsigned char header[QOI_HEADER_SIZE];
+
+	memcpy(header, QOI_MAGIC, 4);
+	put_u32(header + 4, width);
+	put_u32(header + 8, height);
+	header[12] = 3;
+	header[13] = 0;
+	fwrite(header, 1, QOI_HEADER_SIZE, file);
+}
+
+//  saves the image as QOI (RGB, samples scaled to 8 bits), encoding bands
+//  of rows on the worker threads, returns false if memory is exhausted
+bool save_image_qoi(FILE *file, my_image *image)
+{
+	qoi_job job;
+	int width = image->width, height = image->height;
+
+	//  an empty image is only a header and the end of the stream
+	if (width < 1 || height < 1) {
+		put_header(file, width, height);
+		fwrite(qoi_end, 1, sizeof(qoi_end), file);
+		return true;
+	}
+
+	int rows = QOI_ROUND_PIXELS / width;
+
+	rows = rows < 1 ? 1 : rows > height ? height : rows;
+
+	job.image = image;
+	job.channels = image_planes(image, job.planes);
+	job.scale = 255.0 / image->pixel_value;
+	job.out = mem_alloc((size_t)4 * rows * width, MEM_IO);
+	job.lengths = mem_alloc(sizeof(size_t) * rows, MEM_IO);
+
+	if (!job.out || !job.lengths) {
+		mem_free(job.out);
+		mem_free(job.lengths);
+		return false;
+	}
+
+	put_header(file, width, height);
+
+	for (job.first = 0; job.first < height; job.first += rows) {
+		int count = height - job.first < rows ? height - job.first : rows;
+
+		memset(job.lengths, 0, sizeof(size_t) * count);
+		workers_run(count, qoi_encode_band, &job);
+
+		//  chunks in the order of their rows
+		for (int i = 0; i < count; ++i)
+			if (job.lengths[i])
+				fwrite(job.out + (size_t)4 * i * width, 1, job.lengths[i],
+					   file);
+	}
+
+	fwrite(qoi_end, 1, sizeof(qoi_end), file);
+
+	mem_free(job.out);
+	mem_free(job.lengths);
+	return true;
+}
+
+//  gets the next byte of the file (0 past its end, which is a short read)
+static inline unsigned char next_byte(qoi_reader *reader)
+{
+	if (reader->pos == reader->length) {
+		reader->length = fread(reader->buffer, 1, QOI_READ_SIZE,
+							   reader->file);
+		reader->pos = 0;
+
+		if (!reader->length) {
+			reader->short_read = true;
+			return 0;
+		}
+	}
+
+	return reader->buffer[reader->pos++];
+}
+
+//  decodes the pixels of a QOI file straight into the color channels,
+//  returns false if every pixel is gray
+static bool qoi_decode(qoi_reader *reader, color_img *color, int height,
+					   int width)
+{
+	uint32_t index[64] = {0};
+	uint32_t px = 255;
+	bool gray = true;
+	int run = 0;
+
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			if (run) {
+				run--;
+			} else {
+				unsigned char b1 = next_byte(reader);
+
+				if (b1 == QOI_OP_RGB || b1 == QOI_OP_RGBA) {
+					uint32_t r = next_byte(reader);
+					uint32_t g = next_byte(reader);
+					uint32_t b = next_byte(reader);
+					uint32_t a = b1 == QOI_OP_RGBA ? next_byte(reader) :
+								 QOI_A(px);
+
+					px = r << 24 | g << 16 | b << 8 | a;
+				} else if ((b1 & QOI_TAG_MASK) == QOI_OP_INDEX) {
+					px = index[b1];
+				} else if ((b1 & QOI_TAG_MASK) == QOI_OP_DIFF) {
+					uint32_t r = (QOI_R(px) + ((b1 >> 4) & 3) - 2) & 0xff;
+					uint32_t g = (QOI_G(px) + ((b1 >> 2) & 3) - 2) & 0xff;
+					uint32_t b = (QOI_B(px) + (b1 & 3) - 2) & 0xff;
+
+					px = r << 24 | g << 16 | b << 8 | QOI_A(px);
+				} else if ((b1 & QOI_TAG_MASK) == QOI_OP_LUMA) {
+					unsigned char b2 = next_byte(reader);
+					int vg = (b1 & 0x3f) - 32;
+					uint32_t r = (QOI_R(px) + vg - 8 + (b2 >> 4)) & 0xff;
+					uint32_t g = (QOI_G(px) + vg) & 0xff;
+					uint32_t b = (QOI_B(px) + vg - 8 + (b2 & 0x0f)) & 0xff;
+
+					px = r << 24 | g << 16 | b << 8 | QOI_A(px);
+				} else {
+					run = b1 & 0x3f;
+				}
+
+				index[qoi_hash(px)] = px;
+			}
+
+			color->red[y][x] = QOI_R(px);
+			color->green[y][x] = QOI_G(px);
+			color->blue[y][x] = QOI_B(px);
+			gray = gray && QOI_R(px) == QOI_G(px) && QOI_G(px) == QOI_B(px);
+		}
+
+		//  the rest of the pixels are missing
+		if (reader->short_read)
+			break;
+	}
+
+	return !gray;
+}
+
+//  loads a QOI image (its alpha channel is dropped), as a grayscale image
+//  if every pixel is gray; the file must have a valid header and all of
+//  its pixels, else LOAD_NO_FILE is returned
+enum load_status load_qoi_image(FILE *file, my_image *image)
+{
+	unsigned char header[QOI_HEADER_SIZE] = {0};
+	qoi_reader reader = {file, NULL, 0, 0, false};
+	color_img color;
+
+	if (fread(header, 1, QOI_HEADER_SIZE, file) != QOI_HEADER_SIZE ||
+		memcmp(header, QOI_MAGIC, 4))
+		return LOAD_NO_FILE;
+
+	//  the dimensions are checked before they become ints, the channels
+	//  are RGB or RGBA and the color space sRGB or linear
+	uint32_t file_width = get_u32(header + 4);
+	uint32_t file_height = get_u32(header + 8);
+
+	if (!file_width || !file_height || file_width > INT32_MAX ||
+		file_height > INT32_MAX ||
+		(uint64_t)file_width * file_height > QOI_PIXELS_MAX ||
+		(header[12] != 3 && header[12] != 4) || header[13] > 1)
+		return LOAD_NO_FILE;
+
+	int height = (int)file_height, width = (int)file_width;
+
+	reader.buffer = mem_alloc(QOI_READ_SIZE, MEM_IO);
+	color.red = alloc_matrix(height, width);
+	color.green = alloc_matrix(height, width);
+	color.blue = alloc_matrix(height, width);
+
+	if (!reader.buffer || !color.red || !color.green || !color.blue) {
+		mem_free(reader.buffer);
+		free_color_channels(&color, height);
+		return LOAD_NO_MEMORY;
+	}
+
+	bool colored = qoi_decode(&reader, &color, height, width);
+	mem_free(reader.buffer);
+
+	if (reader.short_read) {
+		free_color_channels(&color, height);
+		return LOAD_NO_FILE;
+	}
+
+	image->file_type = BINARY;
+	image->img_type = COLOR;
+	image->width = width;
+	image->height = height;
+	image->pixel_value = 255;
+	set_selection(image->select, 0, 0, width, height);
+
+	if (colored) {
+		if (set_pixel_matrix(image, &color, sizeof(color_img)))
+			return LOAD_OK;
+
+		free_color_channels(&color, height);
+		return LOAD_NO_MEMORY;
+	}
+
+	//  keep one channel of a gray image
+	basic_img basic = {color.red};
+
+	free_matrix(color.green, height);
+	free_matrix(color.blue, height);
+	image->img_type = GRAYSCALE;
+
+	if (set_pixel_matrix(image, &basic, sizeof(basic_img)))
+		return LOAD_OK;
+
+	free_matrix(basic.pixels, height);
+	return LOAD_NO_MEMORY;
+}
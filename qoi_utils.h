@@ -0,0 +1,17 @@
+#ifndef QOI_UTTILS_
+#define QOI_UTTILS_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "image_utils.h"
+
+//  first bytes of a QOI file
+#define QOI_MAGIC "qoif"
+
+bool is_qoi_path(char *path);
+
+enum load_status load_qoi_image(FILE *file, my_image *image);
+
+bool save_image_qoi(FILE *file, my_image *image);
+
+#endif /* QOI_UTTILS_ */
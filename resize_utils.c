@@ -0,0 +1,394 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include "resize_utils.h"
+#include "matrix_utils.h"
+#include "bitmap_utils.h"
+#include "memory_utils.h"
+#include "worker_utils.h"
+
+#define PI 3.14159265358979323846
+
+//  weights of the source pixels of every output pixel along one axis,
+//  output i reads the pixels first[i] .. first[i] + count[i] - 1
+typedef struct {
+	int *first;
+	int *count;
+	//  taps weights per output pixel, unused ones are 0
+	double *weights;
+	int taps;
+} weight_table;
+
+//  one pass of the resize: every output row is a weighted sum of source
+//  rows (vertical) or every output pixel of its row's pixels (horizontal)
+typedef struct {
+	double **src;
+	double **dst;
+	//  bitmap source of the horizontal pass, read instead of src
+	uint64_t **src_bits;
+	//  bitmap output of the vertical pass, written instead of dst: every
+	//  row is summed in the worker's row of buffers, then packed
+	uint64_t **dst_bits;
+	double *buffers;
+	//  number of pixels of an output row
+	int width;
+	weight_table *table;
+	double max;
+} resize_pass;
+
+//  gets a resampling filter by name
+bool get_resize_filter(char *name, enum resize_filter *filter)
+{
+	if (!strcmp(name, "BOX"))
+		*filter = BOX;
+	else if (!strcmp(name, "BILINEAR"))
+		*filter = TRIANGLE;
+	else if (!strcmp(name, "BICUBIC"))
+		*filter = CUBIC;
+	else if (!strcmp(name, "LANCZOS3"))
+		*filter = LANCZOS3;
+	else
+		return false;
+
+	return true;
+}
+
+//  half width of a filter, in source pixels when not downscaling
+static double filter_support(enum resize_filter filter)
+{
+	if (filter == BOX)
+		return 0.5;
+	if (filter == TRIANGLE)
+		return 1;
+	if (filter == CUBIC)
+		return 2;
+	return 3;
+}
+
+static double sinc(double x)
+{
+	if (x == 0)
+		return 1;
+
+	x *= PI;
+	return sin(x) / x;
+}
+
+//  value of a filter at distance x from its center
+static double filter_value(enum resize_filter filter, double x)
+{
+	x = fabs(x);
+
+	if (filter == BOX)
+		return x <= 0.5 ? 1 : 0;
+
+	if (filter == TRIANGLE)
+		return x < 1 ? 1 - x : 0;
+
+	if (filter == CUBIC) {
+		//  Catmull-Rom (Keys, a = -0.5)
+		if (x < 1)
+			return 1.5 * x * x * x - 2.5 * x * x + 1;
+		if (x < 2)
+			return -0.5 * x * x * x + 2.5 * x * x - 4 * x + 2;
+		return 0;
+	}
+
+	return x < 3 ? sinc(x) * sinc(x / 3) : 0;
+}
+
+static void free_weight_table(weight_table *table)
+{
+	mem_free(table->first);
+	mem_free(table->count);
+	mem_free(table->weights);
+}
+
+//  computes the weights that resample n source pixels into m pixels,
+//  returns false if memory is exhausted
+static bool init_weight_table(weight_table *table, int n, int m,
+							  enum resize_filter filter)
+{
+	double scale = (double)n / m;
+
+	//  when downscaling, the filter is stretched over the source pixels
+	double stretch = scale > 1 ? scale : 1;
+	double support = filter_support(filter) * stretch;
+
+	table->taps = (int)ceil(2 * support) + 1;
+	table->first = mem_alloc(sizeof(int) * m, MEM_SCRATCH);
+	table->count = mem_alloc(sizeof(int) * m, MEM_SCRATCH);
+	table->weights = mem_alloc(sizeof(double) * m * table->taps, MEM_SCRATCH);
+
+	if (!table->first || !table->count || !table->weights) {
+		free_weight_table(table);
+		return false;
+	}
+
+	for (int i = 0; i < m; ++i) {
+		double *w = table->weights + (size_t)i * table->taps;
+
+		//  center of output pixel i, in source coordinates
+		double center = (i + 0.5) * scale - 0.5;
+		int lo = (int)ceil(center - support);
+		int hi = (int)floor(center + support);
+
+		//  taps outside the source are dropped (the rest is renormalized)
+		if (lo < 0)
+			lo = 0;
+		if (hi > n - 1)
+			hi = n - 1;
+		if (hi - lo + 1 > table->taps)
+			hi = lo + table->taps - 1;
+
+		double sum = 0;
+		int count = hi - lo + 1;
+
+		for (int k = 0; k < table->taps; ++k) {
+			w[k] = k < count ? filter_value(filter, (lo + k - center) / stretch)
+							 : 0;
+			sum += w[k];
+		}
+
+		//  the filter misses every pixel, take the nearest one
+		if (sum == 0) {
+			lo = (int)floor(center + 0.5);
+			lo = lo < 0 ? 0 : lo > n - 1 ? n - 1 : lo;
+			count = 1;
+			w[0] = sum = 1;
+		}
+
+		for (int k = 0; k < count; ++k)
+			w[k] /= sum;
+
+		table->first[i] = lo;
+		table->count[i] = count;
+	}
+
+	return true;
+}
+
+//  filters can overshoot, keep the pixels in range
+static void clamp_row(double *row, int n, double max)
+{
+	for (int j = 0; j < n; ++j)
+		row[j] = row[j] < 0 ? 0 : row[j] > max ? max : row[j];
+}
+
+//  worker task, resamples the pixels of a band of rows
+static void horizontal_band(void *arg, int begin, int end, int worker)
+{
+	resize_pass *pass = arg;
+	weight_table *t = pass->table;
+
+	(void)worker;
+
+	for (int i = begin; i < end; ++i) {
+		double *out = pass->dst[i];
+
+		if (pass->src_bits) {
+			uint64_t *in = pass->src_bits[i];
+
+			for (int j = 0; j < pass->width; ++j) {
+				double *w = t->weights + (size_t)j * t->taps;
+				int first = t->first[j];
+				double s = 0;
+
+				for (int k = 0; k < t->count[j]; ++k)
+					s += w[k] * BIT_GET(in, first + k);
+
+				out[j] = s;
+			}
+			continue;
+		}
+
+		double *in = pass->src[i];
+
+		for (int j = 0; j < pass->width; ++j) {
+			double *w = t->weights + (size_t)j * t->taps;
+			double *p = in + t->first[j];
+			double s = 0;
+
+			for (int k = 0; k < t->count[j]; ++k)
+				s += w[k] * p[k];
+
+			out[j] = s;
+		}
+	}
+}
+
+//  worker task, computes a band of output rows, each one a weighted sum
+//  of whole source rows (the inner loop is vectorized)
+static void vertical_band(void *arg, int begin, int end, int worker)
+{
+	resize_pass *pass = arg;
+	weight_table *t = pass->table;
+
+	for (int i = begin; i < end; ++i) {
+		double *w = t->weights + (size_t)i * t->taps;
+		double *out = pass->dst_bits
+						  ? pass->buffers + (size_t)worker * pass->width
+						  : pass->dst[i];
+
+		memset(out, 0, sizeof(double) * pass->width);
+
+		for (int k = 0; k < t->count[i]; ++k) {
+			double *in = pass->src[t->first[i] + k];
+			double wk = w[k];
+
+			for (int j = 0; j < pass->width; ++j)
+				out[j] += wk * in[j];
+		}
+
+		clamp_row(out, pass->width, pass->max);
+
+		if (pass->dst_bits)
+			pack_bitmap_row(out, pass->dst_bits[i], pass->width);
+	}
+}
+
+//  resamples a plane of n x m pixels into a new plane of height x width,
+//  in two passes: first along the rows, then along the columns
+static double **resize_plane(double **a, int n, int width, int height,
+							 weight_table *columns, weight_table *rows,
+							 double max, enum mem_category category)
+{
+	double **tmp = alloc_scratch_matrix(n, width);
+	double **resized = alloc_matrix_in(height, width, category);
+
+	if (!tmp || !resized) {
+		free_matrix(tmp, n);
+		free_matrix(resized, height);
+		return NULL;
+	}
+
+	resize_pass pass = {a, tmp, NULL, NULL, NULL, width, columns, max};
+	workers_run(n, horizontal_band, &pass);
+
+	pass.src = tmp;
+	pass.dst = resized;
+	pass.table = rows;
+	workers_run(height, vertical_band, &pass);
+
+	free_matrix(tmp, n);
+	return resized;
+}
+
+//  resize_plane for a bitmap of n x m pixels: the bits are read as 0/1
+//  pixels and every output row is thresholded back to bits as soon as
+//  it is summed, returns NULL if memory is exhausted
+static uint64_t **resize_bitmap(uint64_t **a, int n, int width, int height,
+								weight_table *columns, weight_table *rows)
+{
+	double **tmp = alloc_scratch_matrix(n, width);
+	uint64_t **resized = alloc_bitmap(height, width);
+	double *buffers = mem_alloc(sizeof(double) * width * workers_count(),
+								MEM_SCRATCH);
+
+	if (!tmp || !resized || !buffers) {
+		free_matrix(tmp, n);
+		free_bitmap(resized);
+		mem_free(buffers);
+		return NULL;
+	}
+
+	resize_pass pass = {NULL, tmp, a, NULL, NULL, width, columns, 1};
+	workers_run(n, horizontal_band, &pass);
+
+	pass.src = tmp;
+	pass.src_bits = NULL;
+	pass.dst = NULL;
+	pass.dst_bits = resized;
+	pass.buffers = buffers;
+	pass.table = rows;
+	workers_run(height, vertical_band, &pass);
+
+	free_matrix(tmp, n);
+	mem_free(buffers);
+	return resized;
+}
+
+//  resizes the entire image to width x height with the given filter,
+//  returns false if memory is exhausted (the image is left unchanged)
+bool resize_image(my_image *image, int width, int height,
+				  enum resize_filter filter)
+{
+	weight_table columns, rows;
+	int n = image->height, m = image->width;
+	bool resized = false;
+
+	if (!init_weight_table(&columns, m, width, filter))
+		return false;
+
+	if (!init_weight_table(&rows, n, height, filter)) {
+		free_weight_table(&columns);
+		return false;
+	}
+
+	if (image->img_type == COLOR) {
+		color_img *color = (color_img *)image->img;
+		double **planes[3] = {color->red, color->green, color->blue};
+		double **result[3] = {NULL, NULL, NULL};
+
+		for (int c = 0; c < 3; ++c) {
+			result[c] = resize_plane(planes[c], n, width, height,
+									 &columns, &rows, image->pixel_value,
+									 MEM_PLANES);
+			if (!result[c])
+				break;
+		}
+
+		resized = result[0] && result[1] && result[2];
+
+		if (resized) {
+			free_color_channels(color, n);
+			color->red = result[0];
+			color->green = result[1];
+			color->blue = result[2];
+		} else {
+			for (int c = 0; c < 3; ++c)
+				free_matrix(result[c], height);
+		}
+
+	} else if (image->img_type == BLACK_WHITE) {
+		bit_img *bits = (bit_img *)image->img;
+
+		uint64_t **packed = resize_bitmap(bits->rows, n, width, height,
+										  &columns, &rows);
+
+		resized = packed != NULL;
+
+		if (resized) {
+			free_bitmap(bits->rows);
+			bits->rows = packed;
+		}
+
+	} else {
+		basic_img *basic = (basic_img *)image->img;
+		double **result = resize_plane(basic->pixels, n, width, height,
+									   &columns, &rows, image->pixel_value,
+									   MEM_PLANES);
+
+		resized = result != NULL;
+
+		if (resized) {
+			free_matrix(basic->pixels, n);
+			basic->pixels = result;
+		}
+	}
+
+	free_weight_table(&columns);
+	free_weight_table(&rows);
+
+	if (!resized)
+		return false;
+
+	image->height = height;
+	image->width = width;
+
+	set_selection(image->select, 0, 0, width, height);
+	return true;
+}
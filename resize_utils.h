@@ -0,0 +1,15 @@
+#ifndef RESIZE_UTTILS_
+#define RESIZE_UTTILS_
+
+#include <stdbool.h>
+#include "image_utils.h"
+
+//  resampling filters, from the sharpest to the smoothest cut-off
+enum resize_filter {BOX = 0, TRIANGLE = 1, CUBIC = 2, LANCZOS3 = 3};
+
+bool get_resize_filter(char *name, enum resize_filter *filter);
+
+bool resize_image(my_image *image, int width, int height,
+				  enum resize_filter filter);
+
+#endif /* RESIZE_UTTILS_ */
@@ -0,0 +1,513 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include "rotate_utils.h"
+#include "matrix_utils.h"
+#include "bitmap_utils.h"
+#include "memory_utils.h"
+#include "worker_utils.h"
+
+#define PI 3.14159265358979323846
+
+//  number of pixels whose source coordinates are computed at once
+#define STEP_BLOCK 64
+
+//  rotation of a source plane into a destination plane,
+//  every destination pixel is sampled at its inverse rotated position
+typedef struct {
+	double **src;
+	//  bitmap source of a black and white image, read instead of src
+	uint64_t **src_bits;
+	int src_height;
+	int src_width;
+	//  rotated plane
+	double **dst;
+	//  rotated bitmap, written instead of dst: every row is sampled in the
+	//  worker's row of buffers (width doubles each), then packed
+	uint64_t **dst_bits;
+	double *buffers;
+	int height;
+	int width;
+	//  source position of the rotated pixel (0, 0)
+	double start_x;
+	double start_y;
+	//  cosine and sine of the angle: a step to the right moves the source
+	//  position by (cos, -sin), a step down by (sin, cos)
+	double cos;
+	double sin;
+	//  max pixel value, cubic samples can overshoot it
+	double max;
+	enum interpolation method;
+} rotation;
+
+//  gets an interpolation method by name
+bool get_interpolation(char *name, enum interpolation *method)
+{
+	if (!strcmp(name, "NEAREST"))
+		*method = NEAREST;
+	else if (!strcmp(name, "BILINEAR"))
+		*method = BILINEAR;
+	else if (!strcmp(name, "BICUBIC"))
+		*method = BICUBIC;
+	else
+		return false;
+
+	return true;
+}
+
+//  Catmull-Rom weights of the 4 pixels around a sample at fraction t
+static void cubic_weights(double t, double w[4])
+{
+	double t2 = t * t;
+	double t3 = t2 * t;
+
+	w[0] = 0.5 * (-t3 + 2 * t2 - t);
+	w[1] = 0.5 * (3 * t3 - 5 * t2 + 2);
+	w[2] = 0.5 * (-3 * t3 + 4 * t2 + t);
+	w[3] = 0.5 * (t3 - t2);
+}
+
+//  gets a source pixel, pixels outside the image are background (0)
+static double get_source(rotation *r, int i, int j)
+{
+	if (i < 0 || j < 0 || i >= r->src_height || j >= r->src_width)
+		return 0;
+
+	if (r->src_bits)
+		return (double)BIT_GET(r->src_bits[i], j);
+
+	return r->src[i][j];
+}
+
+//  samples the source at (x, y), checking every pixel against the borders
+static double sample_border(rotation *r, double x, double y)
+{
+	//  far outside, also keeps the int conversion in range
+	if (x < -2 || y < -2 || x > r->src_width + 1 || y > r->src_height + 1)
+		return 0;
+
+	int j = (int)floor(x);
+	int i = (int)floor(y);
+	double tx = x - j;
+	double ty = y - i;
+
+	if (r->method == NEAREST)
+		return get_source(r, (int)floor(y + 0.5), (int)floor(x + 0.5));
+
+	if (r->method == BILINEAR) {
+		double top = (1 - tx) * get_source(r, i, j) +
+					 tx * get_source(r, i, j + 1);
+		double bottom = (1 - tx) * get_source(r, i + 1, j) +
+						tx * get_source(r, i + 1, j + 1);
+		return (1 - ty) * top + ty * bottom;
+	}
+
+	double wx[4], wy[4], s = 0;
+	cubic_weights(tx, wx);
+	cubic_weights(ty, wy);
+
+	for (int a = 0; a < 4; ++a)
+		for (int b = 0; b < 4; ++b)
+			s += wy[a] * wx[b] * get_source(r, i - 1 + a, j - 1 + b);
+
+	return s < 0 ? 0 : s > r->max ? r->max : s;
+}
+
+//  narrows [lo, hi) to the pixels t whose coordinate s + t * d
+//  stays in [a, b], keeping one pixel of margin for rounding errors
+static void clip_span(double s, double d, double a, double b, int *lo, int *hi)
+{
+	if (fabs(d) < 1e-12) {
+		if (s < a || s > b)
+			*hi = *lo;
+		return;
+	}
+
+	double first = (a - s) / d;
+	double last = (b - s) / d;
+
+	if (first > last) {
+		double tmp = first;
+		first = last;
+		last = tmp;
+	}
+
+	first = ceil(first) + 1;
+	last = floor(last) - 1;
+
+	if (first > *lo)
+		*lo = first < *hi ? (int)first : *hi;
+	if (last + 1 < *hi)
+		*hi = last + 1 > *lo ? (int)last + 1 : *lo;
+}
+
+//  samples a block of n pixels whose kernels are inside the source
+static void sample_block(rotation *r, double *out, double *xs, double *ys,
+						 int n)
+{
+	double **p = r->src;
+
+	if (r->method == NEAREST) {
+		for (int k = 0; k < n; ++k)
+			out[k] = p[(int)(ys[k] + 0.5)][(int)(xs[k] + 0.5)];
+		return;
+	}
+
+	if (r->method == BILINEAR) {
+		for (int k = 0; k < n; ++k) {
+			int j = (int)xs[k];
+			int i = (int)ys[k];
+			double tx = xs[k] - j;
+			double ty = ys[k] - i;
+			double top = p[i][j] + tx * (p[i][j + 1] - p[i][j]);
+			double bottom = p[i + 1][j] + tx * (p[i + 1][j + 1] - p[i + 1][j]);
+
+			out[k] = top + ty * (bottom - top);
+		}
+		return;
+	}
+
+	for (int k = 0; k < n; ++k) {
+		int j = (int)xs[k];
+		int i = (int)ys[k];
+		double wx[4], wy[4], s = 0;
+
+		cubic_weights(xs[k] - j, wx);
+		cubic_weights(ys[k] - i, wy);
+
+		for (int a = 0; a < 4; ++a) {
+			double *row = p[i - 1 + a] + j - 1;
+			s += wy[a] * (wx[0] * row[0] + wx[1] * row[1] +
+						  wx[2] * row[2] + wx[3] * row[3]);
+		}
+
+		out[k] = s < 0 ? 0 : s > r->max ? r->max : s;
+	}
+}
+
+//  sample_block for a bitmap source, pixels are read as 0 or 1
+static void sample_bits_block(rotation *r, double *out, double *xs,
+							  double *ys, int n)
+{
+	uint64_t **p = r->src_bits;
+
+	if (r->method == NEAREST) {
+		for (int k = 0; k < n; ++k)
+			out[k] = BIT_GET(p[(int)(ys[k] + 0.5)], (int)(xs[k] + 0.5));
+		return;
+	}
+
+	if (r->method == BILINEAR) {
+		for (int k = 0; k < n; ++k) {
+			int j = (int)xs[k];
+			int i = (int)ys[k];
+			double tx = xs[k] - j;
+			double ty = ys[k] - i;
+			double p00 = BIT_GET(p[i], j), p01 = BIT_GET(p[i], j + 1);
+			double p10 = BIT_GET(p[i + 1], j), p11 = BIT_GET(p[i + 1], j + 1);
+			double top = p00 + tx * (p01 - p00);
+			double bottom = p10 + tx * (p11 - p10);
+
+			out[k] = top + ty * (bottom - top);
+		}
+		return;
+	}
+
+	for (int k = 0; k < n; ++k) {
+		int j = (int)xs[k];
+		int i = (int)ys[k];
+		double wx[4], wy[4], s = 0;
+
+		cubic_weights(xs[k] - j, wx);
+		cubic_weights(ys[k] - i, wy);
+
+		for (int a = 0; a < 4; ++a) {
+			uint64_t *row = p[i - 1 + a];
+			double row0 = BIT_GET(row, j - 1), row1 = BIT_GET(row, j);
+			double row2 = BIT_GET(row, j + 1), row3 = BIT_GET(row, j + 2);
+
+			s += wy[a] * (wx[0] * row0 + wx[1] * row1 +
+						  wx[2] * row2 + wx[3] * row3);
+		}
+
+		out[k] = s < 0 ? 0 : s > r->max ? r->max : s;
+	}
+}
+
+//  computes row y of the rotated plane in out
+static void rotate_row(rotation *r, int y, double *out)
+{
+	//  source position of the row's first pixel and its step to the right
+	double x0 = r->start_x + y * r->sin;
+	double y0 = r->start_y + y * r->cos;
+	double dx = r->cos;
+	double dy = -r->sin;
+
+	//  source pixels the kernel reaches around the sampled position
+	int before = r->method == BICUBIC ? 1 : 0;
+	int after = r->method == NEAREST ? 0 : r->method == BILINEAR ? 1 : 2;
+
+	//  pixels whose whole kernel is inside the source
+	int lo = 0, hi = r->width;
+	clip_span(x0, dx, before, r->src_width - 1 - after, &lo, &hi);
+	clip_span(y0, dy, before, r->src_height - 1 - after, &lo, &hi);
+
+	for (int j = 0; j < lo; ++j)
+		out[j] = sample_border(r, x0 + j * dx, y0 + j * dy);
+
+	//  inside the source: step the coordinates a block at a time (this
+	//  loop is vectorized), then sample without any border check
+	double xs[STEP_BLOCK], ys[STEP_BLOCK];
+
+	for (int j = lo; j < hi; j += STEP_BLOCK) {
+		int n = hi - j < STEP_BLOCK ? hi - j : STEP_BLOCK;
+		double bx = x0 + j * dx;
+		double by = y0 + j * dy;
+
+		for (int k = 0; k < n; ++k) {
+			xs[k] = bx + k * dx;
+			ys[k] = by + k * dy;
+		}
+
+		if (r->src_bits)
+			sample_bits_block(r, out + j, xs, ys, n);
+		else
+			sample_block(r, out + j, xs, ys, n);
+	}
+
+	for (int j = hi; j < r->width; ++j)
+		out[j] = sample_border(r, x0 + j * dx, y0 + j * dy);
+}
+
+//  worker task, computes a band of rows of the rotated plane
+static void rotate_band(void *arg, int begin, int end, int worker)
+{
+	rotation *r = arg;
+
+	if (!r->dst_bits) {
+		for (int y = begin; y < end; ++y)
+			rotate_row(r, y, r->dst[y]);
+		return;
+	}
+
+	double *out = r->buffers + (size_t)worker * r->width;
+
+	for (int y = begin; y < end; ++y) {
+		rotate_row(r, y, out);
+		pack_bitmap_row(out, r->dst_bits[y], r->width);
+	}
+}
+
+//  rotates src clockwise around its point (cx, cy), into dst whose center
+//  lands on that point
+static void rotate_plane(rotation *r, double cx, double cy)
+{
+	//  source position of the rotated pixel (0, 0): the inverse
+	//  rotation of its offset from the center
+	double ox = -(r->width - 1) / 2.0;
+	double oy = -(r->height - 1) / 2.0;
+
+	r->start_x = cx + ox * r->cos + oy * r->sin;
+	r->start_y = cy - ox * r->sin + oy * r->cos;
+
+	workers_run(r->height, rotate_band, r);
+}
+
+//  fills the fields shared by every plane of an image
+static void init_rotation(rotation *r, my_image *image, double angle,
+						  enum interpolation method)
+{
+	double rad = angle * PI / 180;
+
+	r->cos = cos(rad);
+	r->sin = sin(rad);
+	r->src_height = image->height;
+	r->src_width = image->width;
+	r->max = image->pixel_value;
+	r->method = method;
+	r->src_bits = NULL;
+	r->dst_bits = NULL;
+	r->buffers = NULL;
+}
+
+//  rotates the bitmap src into dst, a row of r->width pixels at a time,
+//  returns false if memory is exhausted
+static bool rotate_bitmap(rotation *r, uint64_t **src, uint64_t **dst,
+						  double cx, double cy)
+{
+	r->src_bits = src;
+	r->dst_bits = dst;
+	r->buffers = mem_alloc(sizeof(double) * r->width * workers_count(),
+						   MEM_SCRATCH);
+	if (!r->buffers)
+		return false;
+
+	rotate_plane(r, cx, cy);
+
+	mem_free(r->buffers);
+	return true;
+}
+
+//  rotates an entire image by any angle (clockwise for positive angles),
+//  the canvas grows to fit the rotated image, new pixels are 0
+bool rotate_entire_image_angle(my_image *image, double angle,
+							   enum interpolation method)
+{
+	rotation r;
+	init_rotation(&r, image, angle, method);
+
+	//  bounding box of the rotated image, the small slack keeps
+	//  floating point noise from adding a column
+	double w = image->width, h = image->height;
+	int width = (int)ceil(fabs(w * r.cos) + fabs(h * r.sin) - 1e-6);
+	int height = (int)ceil(fabs(w * r.sin) + fabs(h * r.cos) - 1e-6);
+
+	r.width = width;
+	r.height = height;
+
+	double cx = (image->width - 1) / 2.0;
+	double cy = (image->height - 1) / 2.0;
+
+	if (image->img_type == COLOR) {
+		color_img *color = (color_img *)image->img;
+		double **planes[3] = {color->red, color->green, color->blue};
+		double **rotated[3] = {NULL, NULL, NULL};
+
+		for (int c = 0; c < 3; ++c) {
+			rotated[c] = alloc_matrix(height, width);
+			if (!rotated[c]) {
+				for (int k = 0; k < c; ++k)
+					free_matrix(rotated[k], height);
+				return false;
+			}
+
+			r.src = planes[c];
+			r.dst = rotated[c];
+			rotate_plane(&r, cx, cy);
+		}
+
+		free_color_channels(color, image->height);
+		color->red = rotated[0];
+		color->green = rotated[1];
+		color->blue = rotated[2];
+
+	} else if (image->img_type == BLACK_WHITE) {
+		bit_img *bits = (bit_img *)image->img;
+
+		//  sample the bits as 0/1 pixels, then threshold them back to bits
+		uint64_t **rotated = alloc_bitmap(height, width);
+
+		if (!rotated || !rotate_bitmap(&r, bits->rows, rotated, cx, cy)) {
+			free_bitmap(rotated);
+			return false;
+		}
+
+		free_bitmap(bits->rows);
+		bits->rows = rotated;
+
+	} else {
+		basic_img *basic = (basic_img *)image->img;
+
+		r.src = basic->pixels;
+		r.dst = alloc_matrix(height, width);
+		if (!r.dst)
+			return false;
+
+		rotate_plane(&r, cx, cy);
+
+		free_matrix(basic->pixels, image->height);
+		basic->pixels = r.dst;
+	}
+
+	image->height = height;
+	image->width = width;
+
+	set_selection(image->select, 0, 0, width, height);
+	return true;
+}
+
+//  rotates a plane's selection into the scratch matrix r->dst, then copies
+//  it over the selection; window gets the selection's rows, so only the
+//  selected pixels are sampled
+static void rotate_plane_selection(rotation *r, double **plane, my_select *s,
+								   double **window)
+{
+	for (int i = 0; i < r->height; ++i)
+		window[i] = plane[s->y1 + i] + s->x1;
+
+	r->src = window;
+
+	rotate_plane(r, (r->width - 1) / 2.0, (r->height - 1) / 2.0);
+
+	for (int i = 0; i < r->height; ++i)
+		memcpy(plane[s->y1 + i] + s->x1, r->dst[i],
+			   sizeof(double) * r->width);
+}
+
+//  rotates the selection by any angle around its center, the selection
+//  keeps its place and size (it doesn't have to be square)
+bool rotate_image_selection_angle(my_image *image, double angle,
+								  enum interpolation method)
+{
+	my_select *s = image->select;
+	rotation r;
+
+	init_rotation(&r, image, angle, method);
+	r.height = s->y2 - s->y1;
+	r.width = s->x2 - s->x1;
+
+	//  the source is the selection alone, the pixels around it are out of
+	//  range (0) like the ones outside the image, as for right angles
+	r.src_height = r.height;
+	r.src_width = r.width;
+
+	if (image->img_type == BLACK_WHITE) {
+		bit_img *bits = (bit_img *)image->img;
+		uint64_t **section = alloc_bitmap(r.height, r.width);
+		uint64_t **selected = crop_bitmap(bits->rows, s->x1, s->y1,
+										  s->x2, s->y2);
+
+		//  the selection is copied out, rotated, then pasted
+		if (!section || !selected ||
+			!rotate_bitmap(&r, selected, section, (r.width - 1) / 2.0,
+						   (r.height - 1) / 2.0)) {
+			free_bitmap(selected);
+			free_bitmap(section);
+			return false;
+		}
+
+		paste_bitmap(bits->rows, image->width, section, s->x1, s->y1,
+					 r.height, r.width);
+
+		free_bitmap(selected);
+		free_bitmap(section);
+		return true;
+	}
+
+	//  the scratch matrix is reused by each channel
+	double **window = mem_alloc(sizeof(double *) * r.height, MEM_SCRATCH);
+	r.dst = window ? alloc_scratch_matrix(r.height, r.width) : NULL;
+	if (!r.dst) {
+		mem_free(window);
+		return false;
+	}
+
+	if (image->img_type == COLOR) {
+		color_img *color = (color_img *)image->img;
+
+		rotate_plane_selection(&r, color->red, s, window);
+		rotate_plane_selection(&r, color->green, s, window);
+		rotate_plane_selection(&r, color->blue, s, window);
+	} else {
+		basic_img *basic = (basic_img *)image->img;
+
+		rotate_plane_selection(&r, basic->pixels, s, window);
+	}
+
+	free_matrix(r.dst, r.height);
+	mem_free(window);
+	return true;
+}
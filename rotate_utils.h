@@ -0,0 +1,18 @@
+#ifndef ROTATE_UTTILS_
+#define ROTATE_UTTILS_
+
+#include <stdbool.h>
+#include "image_utils.h"
+
+//  how pixels are sampled between the source pixels
+enum interpolation {NEAREST = 0, BILINEAR = 1, BICUBIC = 2};
+
+bool get_interpolation(char *name, enum interpolation *method);
+
+bool rotate_entire_image_angle(my_image *image, double angle,
+							   enum interpolation method);
+
+bool rotate_image_selection_angle(my_image *image, double angle,
+								  enum interpolation method);
+
+#endif /* ROTATE_UTTILS_ */
@@ -0,0 +1,116 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "server_utils.h"
+#include "session_utils.h"
+#include "slot_utils.h"
+#include "utils.h"
+
+//  connection served by its own thread
+typedef struct {
+	int fd;
+	client_handler handler;
+} client;
+
+//  runs a client's session: its commands are read from the socket and the
+//  replies written back to it, its image slots are freed when it leaves
+static void *client_thread(void *arg)
+{
+	client *c = arg;
+	int out_fd = dup(c->fd);
+	FILE *input = fdopen(c->fd, "r");
+	FILE *output = out_fd < 0 ? NULL : fdopen(out_fd, "w");
+
+	if (input && output) {
+		session s;
+
+		session_init(&s, output);
+		session_bind(&s);
+		c->handler(input);
+
+		slots_free();
+		session_bind(NULL);
+	}
+
+	if (output)
+		fclose(output);
+	else if (out_fd >= 0)
+		close(out_fd);
+
+	if (input)
+		fclose(input);
+	else
+		close(c->fd);
+
+	free(c);
+	return NULL;
+}
+
+//  listens on a Unix domain socket and serves every client in a session of
+//  its own, on its own thread; the worker threads, the image cache and the
+//  background SAVEs are shared by all of them, returns false if the socket
+//  can't be set up (it doesn't return otherwise)
+bool server_run(char *path, client_handler handler)
+{
+	struct sockaddr_un address;
+
+	if (strlen(path) >= sizeof(address.sun_path))
+		return false;
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return false;
+
+	//  a socket left by an earlier server
+	unlink(path);
+
+	if (bind(fd, (struct sockaddr *)&address, sizeof(address)) ||
+		listen(fd, SERVER_BACKLOG)) {
+		close(fd);
+		return false;
+	}
+
+	//  a client leaving early must not stop the server
+	signal(SIGPIPE, SIG_IGN);
+
+	pthread_attr_t attr;
+	DIE(pthread_attr_init(&attr), "pthread_attr_init");
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	while (true) {
+		int client_fd = accept(fd, NULL, NULL);
+
+		if (client_fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			DIE(errno != EMFILE && errno != ENFILE, "accept");
+
+			//  out of descriptors until a client leaves
+			sleep(1);
+			continue;
+		}
+
+		client *c = malloc(sizeof(client));
+		DIE(!c, "malloc client");
+		c->fd = client_fd;
+		c->handler = handler;
+
+		pthread_t thread;
+		if (pthread_create(&thread, &attr, client_thread, c)) {
+			close(client_fd);
+			free(c);
+		}
+	}
+}
@@ -0,0 +1,15 @@
+#ifndef SERVER_UTTILS_
+#define SERVER_UTTILS_
+
+#include <stdio.h>
+#include <stdbool.h>
+
+//  connections waiting to be accepted
+#define SERVER_BACKLOG 64
+
+//  runs the commands of a client, read from input, in its session
+typedef void (*client_handler)(FILE *input);
+
+bool server_run(char *path, client_handler handler);
+
+#endif /* SERVER_UTTILS_ */
@@ -0,0 +1,121 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include "session_utils.h"
+#include "utils.h"
+
+//  session of the standard input, used by threads bound to no other one
+static session console = {NULL, {NULL, 0, -1}, NULL, NULL};
+
+//  guards the failed SAVEs of every session
+static pthread_mutex_t failures_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//  session bound to the calling thread
+static pthread_key_t key;
+static pthread_once_t created = PTHREAD_ONCE_INIT;
+
+static void create_key(void)
+{
+	DIE(pthread_key_create(&key, NULL), "pthread_key_create");
+}
+
+//  starts a session with no image slots, replying to output
+void session_init(session *s, FILE *output)
+{
+	s->output = output;
+	s->slots.slots = NULL;
+	s->slots.count = 0;
+	s->slots.current = -1;
+	s->failures = NULL;
+	s->last_failure = NULL;
+}
+
+//  makes the calling thread run the commands of the session
+void session_bind(session *s)
+{
+	pthread_once(&created, create_key);
+	DIE(pthread_setspecific(key, s), "pthread_setspecific");
+}
+
+//  gets the session of the calling thread
+session *session_get(void)
+{
+	pthread_once(&created, create_key);
+
+	session *s = pthread_getspecific(key);
+	return s ? s : &console;
+}
+
+//  gets the stream the replies of the calling thread go to
+FILE *session_output(void)
+{
+	session *s = session_get();
+
+	return s->output ? s->output : stdout;
+}
+
+//  prints a reply to a command, like printf
+void reply(const char *format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	vfprintf(session_output(), format, args);
+	va_end(args);
+}
+
+//  a background SAVE of the session failed after it was reported as done:
+//  the console says so at once on the standard error, a client is told
+//  before the reply to its next command (see session_report_failures)
+void session_save_failed(session *s, char *path)
+{
+	if (!s->output) {
+		fprintf(stderr, "Failed to save %s\n", path);
+		return;
+	}
+
+	save_failure *failure = malloc(sizeof(save_failure));
+	DIE(!failure, "malloc failure");
+
+	failure->path = strdup(path);
+	DIE(!failure->path, "strdup failure");
+	failure->next = NULL;
+
+	pthread_mutex_lock(&failures_lock);
+
+	if (s->last_failure)
+		s->last_failure->next = failure;
+	else
+		s->failures = failure;
+	s->last_failure = failure;
+
+	pthread_mutex_unlock(&failures_lock);
+}
+
+//  replies with the background SAVEs of the calling thread's session that
+//  failed since the last call
+void session_report_failures(void)
+{
+	session *s = session_get();
+
+	pthread_mutex_lock(&failures_lock);
+
+	save_failure *failure = s->failures;
+	s->failures = NULL;
+	s->last_failure = NULL;
+
+	pthread_mutex_unlock(&failures_lock);
+
+	while (failure) {
+		save_failure *next = failure->next;
+
+		reply("Failed to save %s\n", failure->path);
+
+		free(failure->path);
+		free(failure);
+		failure = next;
+	}
+}
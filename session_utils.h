@@ -0,0 +1,38 @@
+#ifndef SESSION_UTTILS_
+#define SESSION_UTTILS_
+
+#include <stdio.h>
+#include "slot_utils.h"
+
+//  file whose background SAVE failed, not reported yet
+typedef struct save_failure {
+	char *path;
+	struct save_failure *next;
+} save_failure;
+
+//  the images and the replies of one command stream: the standard input
+//  or a client of the server
+typedef struct {
+	//  NULL for the standard output
+	FILE *output;
+	slot_table slots;
+	//  failed background SAVEs, in order (written by the writer thread)
+	save_failure *failures;
+	save_failure *last_failure;
+} session;
+
+void session_init(session *s, FILE *output);
+
+void session_bind(session *s);
+
+session *session_get(void);
+
+FILE *session_output(void);
+
+void reply(const char *format, ...);
+
+void session_save_failed(session *s, char *path);
+
+void session_report_failures(void);
+
+#endif /* SESSION_UTTILS_ */
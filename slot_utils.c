@@ -0,0 +1,85 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "slot_utils.h"
+#include "session_utils.h"
+#include "utils.h"
+
+//  finds a slot by name, returns -1 if it doesn't exist
+static int find_slot(slot_table *table, char *name)
+{
+	for (int i = 0; i < table->count; ++i)
+		if (!strcmp(table->slots[i].name, name))
+			return i;
+
+	return -1;
+}
+
+//  adds an empty slot
+static int add_slot(slot_table *table, char *name)
+{
+	image_slot *grown = realloc(table->slots,
+								sizeof(image_slot) * (table->count + 1));
+	DIE(!grown, "realloc slots");
+	table->slots = grown;
+
+	image_slot *slot = &table->slots[table->count];
+
+	slot->name = strdup(name);
+	DIE(!slot->name, "strdup name");
+
+	//  alloc image data and initilize it
+	slot->image = malloc(sizeof(my_image));
+	DIE(!slot->image, "malloc slot->image");
+	init_image_data(slot->image);
+
+	return table->count++;
+}
+
+//  gets the image the commands of the session work on
+my_image *slot_current(void)
+{
+	slot_table *table = &session_get()->slots;
+
+	if (table->current < 0)
+		table->current = add_slot(table, DEFAULT_SLOT);
+
+	return table->slots[table->current].image;
+}
+
+//  makes the named slot current (creating it if asked),
+//  returns its image or NULL if it doesn't exist
+my_image *slot_use(char *name, bool create)
+{
+	slot_table *table = &session_get()->slots;
+	int slot = find_slot(table, name);
+
+	if (slot < 0) {
+		if (!create)
+			return NULL;
+
+		slot = add_slot(table, name);
+	}
+
+	table->current = slot;
+	return table->slots[slot].image;
+}
+
+//  frees every slot of the session and its image
+void slots_free(void)
+{
+	slot_table *table = &session_get()->slots;
+
+	for (int i = 0; i < table->count; ++i) {
+		free_image_data(table->slots[i].image);
+		free(table->slots[i].image);
+		free(table->slots[i].name);
+	}
+
+	free(table->slots);
+	table->slots = NULL;
+	table->count = 0;
+	table->current = -1;
+}
@@ -0,0 +1,30 @@
+#ifndef SLOT_UTTILS_
+#define SLOT_UTTILS_
+
+#include <stdbool.h>
+#include "image_utils.h"
+
+//  name of the slot used before any named LOAD
+#define DEFAULT_SLOT "default"
+
+//  named image the commands can work on
+typedef struct {
+	char *name;
+	my_image *image;
+} image_slot;
+
+//  slots of a session and the one its commands work on
+typedef struct {
+	image_slot *slots;
+	int count;
+	//  -1 until the first command
+	int current;
+} slot_table;
+
+my_image *slot_current(void);
+
+my_image *slot_use(char *name, bool create);
+
+void slots_free(void);
+
+#endif /* SLOT_UTTILS_ */
@@ -0,0 +1,262 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "snapshot_utils.h"
+#include "matrix_utils.h"
+#include "bitmap_utils.h"
+#include "memory_utils.h"
+#include "utils.h"
+
+//  header of a snapshot file, in the byte order of the machine that wrote
+//  it (snapshots resume a session, they are not meant to be exchanged)
+typedef struct {
+	char magic[8];
+	int32_t file_type;
+	int32_t img_type;
+	int32_t width;
+	int32_t height;
+	int32_t pixel_value;
+	//  selection
+	int32_t x1;
+	int32_t y1;
+	int32_t x2;
+	int32_t y2;
+	int32_t planes;
+	//  every plane's block (row pointers, then rows) is stored as in memory,
+	//  MEM_HEADER_SIZE bytes after its aligned offset, which are left for
+	//  the header of the mapped block
+	uint64_t offset[3];
+	uint64_t size[3];
+} snapshot_header;
+
+//  a file isn't opened for writing while another thread maps it
+static pthread_mutex_t mapping_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//  rounds a file offset up to the planes' alignment
+static uint64_t align_offset(uint64_t offset)
+{
+	return (offset + SNAPSHOT_ALIGN - 1) & ~(uint64_t)(SNAPSHOT_ALIGN - 1);
+}
+
+//  bytes of the block of every plane of an image of the given type
+static size_t block_size(int img_type, int height, int width)
+{
+	if (img_type == BLACK_WHITE)
+		return bitmap_block_size(height, width);
+
+	return matrix_block_size(height, width);
+}
+
+//  gets the blocks of the image's planes, returns their number
+static int plane_blocks(my_image *image, void *blocks[3])
+{
+	if (image->img_type == BLACK_WHITE) {
+		blocks[0] = ((bit_img *)image->img)->rows;
+		return 1;
+	}
+
+	double **planes[3];
+	int channels = image_planes(image, planes);
+
+	for (int c = 0; c < channels; ++c)
+		blocks[c] = planes[c];
+
+	return channels;
+}
+
+//  writes the image to a snapshot file: the header, then the blocks of its
+//  planes at aligned offsets; the file is written under another name then
+//  renamed, so images restored from the old one keep their pages,
+//  returns false if the file can't be written
+bool save_snapshot(char *path, my_image *image)
+{
+	snapshot_header header;
+	void *blocks[3];
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.file_type = image->file_type;
+	header.img_type = image->img_type;
+	header.width = image->width;
+	header.height = image->height;
+	header.pixel_value = image->pixel_value;
+	header.x1 = image->select->x1;
+	header.y1 = image->select->y1;
+	header.x2 = image->select->x2;
+	header.y2 = image->select->y2;
+	header.planes = plane_blocks(image, blocks);
+
+	size_t size = block_size(image->img_type, image->height, image->width);
+	uint64_t offset = align_offset(sizeof(header));
+
+	for (int i = 0; i < header.planes; ++i) {
+		header.offset[i] = offset;
+		header.size[i] = size;
+		offset = align_offset(offset + MEM_HEADER_SIZE + size);
+	}
+
+	char *temp = malloc(strlen(path) + sizeof(".tmp"));
+	DIE(!temp, "malloc temp");
+	sprintf(temp, "%s.tmp", path);
+
+	FILE *file = open_output(temp, "wb");
+	if (!file) {
+		free(temp);
+		return false;
+	}
+
+	//  the gaps between the planes are left as holes
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+	for (int i = 0; i < header.planes && written; ++i)
+		written = !fseeko(file, header.offset[i] + MEM_HEADER_SIZE,
+						  SEEK_SET) &&
+				  fwrite(blocks[i], 1, size, file) == size;
+
+	if (fclose(file))
+		written = false;
+
+	if (written && !rename(temp, path)) {
+		free(temp);
+		return true;
+	}
+
+	remove(temp);
+	free(temp);
+	return false;
+}
+
+//  reads the header of a snapshot and checks it matches the file
+static bool read_header(int fd, snapshot_header *header)
+{
+	struct stat st;
+
+	if (pread(fd, header, sizeof(*header), 0) != sizeof(*header) ||
+		memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) ||
+		fstat(fd, &st))
+		return false;
+
+	if (header->width <= 0 || header->height <= 0 ||
+		header->pixel_value <= 0 ||
+		(header->file_type != TEXT && header->file_type != BINARY))
+		return false;
+
+	//  the selection is a non empty part of the image
+	if (header->x1 < 0 || header->y1 < 0 || header->x1 >= header->x2 ||
+		header->y1 >= header->y2 || header->x2 > header->width ||
+		header->y2 > header->height)
+		return false;
+
+	int planes = header->img_type == COLOR ? 3 :
+				 header->img_type == GRAYSCALE ||
+				 header->img_type == BLACK_WHITE ? 1 : 0;
+	if (!planes || header->planes != planes)
+		return false;
+
+	size_t size = block_size(header->img_type, header->height, header->width);
+	long page = sysconf(_SC_PAGESIZE);
+
+	//  pages past the end of the file can't be read
+	for (int i = 0; i < planes; ++i)
+		if (header->size[i] != size || header->offset[i] % page ||
+			header->offset[i] + MEM_HEADER_SIZE + size > (uint64_t)st.st_size)
+			return false;
+
+	return true;
+}
+
+//  replaces the image with the one of a snapshot file: its planes are
+//  mapped copy on write, so nothing is read until a pixel is touched
+enum load_status restore_snapshot(char *path, my_image *image)
+{
+	snapshot_header header;
+	void *blocks[3] = {NULL, NULL, NULL};
+	bool mapped = true;
+
+	pthread_mutex_lock(&mapping_lock);
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		pthread_mutex_unlock(&mapping_lock);
+		return LOAD_NO_FILE;
+	}
+
+	if (!read_header(fd, &header)) {
+		close(fd);
+		pthread_mutex_unlock(&mapping_lock);
+		return LOAD_NO_FILE;
+	}
+
+	int height = header.height, width = header.width;
+
+	for (int i = 0; i < header.planes && mapped; ++i) {
+		if (header.img_type == BLACK_WHITE)
+			blocks[i] = map_bitmap(fd, header.offset[i], height, width);
+		else
+			blocks[i] = map_matrix(fd, header.offset[i], height, width);
+
+		mapped = blocks[i];
+	}
+
+	//  the mappings outlive the descriptor
+	close(fd);
+	pthread_mutex_unlock(&mapping_lock);
+
+	image->file_type = header.file_type;
+	image->img_type = header.img_type;
+	image->width = width;
+	image->height = height;
+	image->pixel_value = header.pixel_value;
+	set_selection(image->select, header.x1, header.y1, header.x2, header.y2);
+
+	if (mapped) {
+		if (header.img_type == COLOR) {
+			color_img color = {blocks[0], blocks[1], blocks[2]};
+
+			mapped = set_pixel_matrix(image, &color, sizeof(color_img));
+		} else if (header.img_type == BLACK_WHITE) {
+			bit_img bits = {blocks[0]};
+
+			mapped = set_pixel_matrix(image, &bits, sizeof(bit_img));
+		} else {
+			basic_img basic = {blocks[0]};
+
+			mapped = set_pixel_matrix(image, &basic, sizeof(basic_img));
+		}
+	}
+
+	if (mapped)
+		return LOAD_OK;
+
+	for (int i = 0; i < header.planes; ++i)
+		mem_free(blocks[i]);
+
+	return LOAD_NO_MEMORY;
+}
+
+//  opens a file for writing with fopen's mode; a file whose pages back a
+//  restored image is unlinked first: truncated, the image's untouched
+//  pages would fault, and rewritten they would change. The image keeps
+//  the old file and the output goes to a new one. Returns NULL if the
+//  file can't be opened
+FILE *open_output(char *path, const char *mode)
+{
+	struct stat st;
+
+	pthread_mutex_lock(&mapping_lock);
+
+	if (!stat(path, &st) && mem_file_mapped(st.st_dev, st.st_ino))
+		unlink(path);
+
+	FILE *file = fopen(path, mode);
+
+	pthread_mutex_unlock(&mapping_lock);
+
+	return file;
+}
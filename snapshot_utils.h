@@ -0,0 +1,22 @@
+#ifndef SNAPSHOT_UTTILS_
+#define SNAPSHOT_UTTILS_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "image_utils.h"
+#include "cache_utils.h"
+
+//  first bytes of a snapshot file
+#define SNAPSHOT_MAGIC "IESNAP01"
+
+//  planes are stored at multiples of this offset, so they can be mapped
+//  with any page size up to it
+#define SNAPSHOT_ALIGN (64UL << 10)
+
+bool save_snapshot(char *path, my_image *image);
+
+enum load_status restore_snapshot(char *path, my_image *image);
+
+FILE *open_output(char *path, const char *mode);
+
+#endif /* SNAPSHOT_UTTILS_ */
@@ -4,6 +4,7 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdbool.h>
 
 //  macro for error handling
 #define DIE(assertion, des)												\
@@ -14,4 +15,32 @@
 		}																	\
 	} while (0)
 
+//  parses a decimal number: an optional minus, digits, then optionally a
+//  dot and more digits ("0x10", "1e1", "+90" or " 9" are not numbers)
+static inline bool parse_decimal(const char *string, double *number)
+{
+	const char *p = string + (*string == '-');
+	const char *digits = p;
+
+	while (*p >= '0' && *p <= '9')
+		p++;
+	if (p == digits)
+		return false;
+
+	if (*p == '.') {
+		digits = ++p;
+		while (*p >= '0' && *p <= '9')
+			p++;
+		if (p == digits)
+			return false;
+	}
+
+	if (*p)
+		return false;
+
+	errno = 0;
+	*number = strtod(string, NULL);
+	return errno != ERANGE;
+}
+
 #endif  //  UTILS_H_
@@ -0,0 +1,219 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include "worker_utils.h"
+#include "numa_utils.h"
+#include "utils.h"
+
+//  max number of threads working on the same job
+#define MAX_WORKERS 64
+
+//  job split in bands of rows, band i is done by worker i
+typedef struct {
+	worker_task task;
+	void *arg;
+	//  number of rows
+	int count;
+	//  number of bands
+	int bands;
+	//  bands not finished yet
+	int left;
+	//  changes every time a new job starts
+	unsigned long generation;
+} worker_job;
+
+static worker_job job;
+
+static int workers = 1;
+
+//  threads of the workers, worker 0 is the thread running the job
+static pthread_t threads[MAX_WORKERS];
+
+//  node every worker ran its last band on, -1 if unknown
+static int nodes[MAX_WORKERS];
+
+//  CPUs the process could run on when the workers started
+static cpu_set_t initial_cpus;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_started = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t job_done = PTHREAD_COND_INITIALIZER;
+static pthread_once_t started = PTHREAD_ONCE_INIT;
+
+//  only one job runs at a time, callers from other threads wait
+static pthread_mutex_t run_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//  runs the band of the given worker
+static void run_band(int worker)
+{
+	int begin = (int)((long long)job.count * worker / job.bands);
+	int end = (int)((long long)job.count * (worker + 1) / job.bands);
+
+	job.task(job.arg, begin, end, worker);
+
+	//  only asked for when there is more than a node to be on
+	if (numa_nodes() > 1) {
+		int node = numa_current_node();
+
+		pthread_mutex_lock(&lock);
+		nodes[worker] = node;
+		pthread_mutex_unlock(&lock);
+	}
+}
+
+//  waits for jobs and does its band of each of them
+static void *worker_thread(void *arg)
+{
+	int worker = (int)(long)arg;
+	unsigned long generation = 0;
+
+	pthread_mutex_lock(&lock);
+
+	while (true) {
+		while (job.generation == generation)
+			pthread_cond_wait(&job_started, &lock);
+		generation = job.generation;
+
+		//  the job is too small to have a band for this worker
+		if (worker >= job.bands)
+			continue;
+
+		pthread_mutex_unlock(&lock);
+		run_band(worker);
+		pthread_mutex_lock(&lock);
+
+		if (!--job.left)
+			pthread_cond_signal(&job_done);
+	}
+
+	return NULL;
+}
+
+//  starts a worker thread for every other online processor
+static void start_workers(void)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	workers = cpus < 1 ? 1 : cpus > MAX_WORKERS ? MAX_WORKERS : (int)cpus;
+
+	for (int i = 0; i < MAX_WORKERS; ++i)
+		nodes[i] = -1;
+
+	if (sched_getaffinity(0, sizeof(initial_cpus), &initial_cpus))
+		CPU_ZERO(&initial_cpus);
+
+	//  the calling thread is worker 0
+	for (int i = 1; i < workers; ++i) {
+		DIE(pthread_create(&threads[i], NULL, worker_thread,
+						   (void *)(long)i), "worker thread");
+		pthread_detach(threads[i]);
+	}
+}
+
+//  returns the number of threads a job is split between
+int workers_count(void)
+{
+	pthread_once(&started, start_workers);
+
+	return workers;
+}
+
+//  returns the NUMA node the worker ran its last band on, -1 if unknown
+//  (e.g. on machines with one node)
+int workers_node(int worker)
+{
+	pthread_mutex_lock(&lock);
+	int node = worker >= 0 && worker < MAX_WORKERS ? nodes[worker] : -1;
+	pthread_mutex_unlock(&lock);
+
+	return node;
+}
+
+//  sets the CPUs every worker thread may run on (see workers_pin)
+static bool set_affinity(int *cpus, int count)
+{
+	bool pinned = true;
+
+	//  CPUs the process may not run on
+	for (int k = 0; k < count; ++k)
+		if (cpus[k] >= CPU_SETSIZE || !CPU_ISSET(cpus[k], &initial_cpus))
+			return false;
+
+	for (int i = 1; i < workers; ++i) {
+		cpu_set_t set = initial_cpus;
+
+		if (count) {
+			CPU_ZERO(&set);
+			CPU_SET(cpus[i % count], &set);
+		}
+
+		if (pthread_setaffinity_np(threads[i], sizeof(set), &set))
+			pinned = false;
+	}
+
+	return pinned;
+}
+
+//  pins worker i to the CPU cpus[i % count], the first CPU is left to the
+//  threads running jobs (worker 0), which aren't pinned; with no CPUs the
+//  workers may run anywhere again, returns false if a CPU can't be used
+//  (the workers are unpinned then)
+bool workers_pin(int *cpus, int count)
+{
+	workers_count();
+
+	pthread_mutex_lock(&run_lock);
+
+	bool pinned = set_affinity(cpus, count);
+	if (!pinned && count)
+		set_affinity(NULL, 0);
+
+	pthread_mutex_unlock(&run_lock);
+
+	return pinned;
+}
+
+//  splits the rows [0, count) in bands and runs the task on each band
+//  in parallel, returns when all bands are done
+void workers_run(int count, worker_task task, void *arg)
+{
+	int bands = workers_count();
+
+	if (bands > count)
+		bands = count;
+
+	//  not worth waking up the workers
+	if (bands <= 1) {
+		if (count > 0)
+			task(arg, 0, count, 0);
+		return;
+	}
+
+	pthread_mutex_lock(&run_lock);
+	pthread_mutex_lock(&lock);
+
+	job.task = task;
+	job.arg = arg;
+	job.count = count;
+	job.bands = bands;
+	job.left = bands - 1;
+	job.generation++;
+
+	pthread_cond_broadcast(&job_started);
+	pthread_mutex_unlock(&lock);
+
+	//  do the first band while the workers do the others
+	run_band(0);
+
+	pthread_mutex_lock(&lock);
+
+	while (job.left)
+		pthread_cond_wait(&job_done, &lock);
+
+	pthread_mutex_unlock(&lock);
+	pthread_mutex_unlock(&run_lock);
+}
@@ -0,0 +1,17 @@
+#ifndef WORKER_UTTILS_
+#define WORKER_UTTILS_
+
+#include <stdbool.h>
+
+//  work done by one worker on the rows [begin, end) of a job
+typedef void (*worker_task)(void *arg, int begin, int end, int worker);
+
+int workers_count(void);
+
+void workers_run(int count, worker_task task, void *arg);
+
+int workers_node(int worker);
+
+bool workers_pin(int *cpus, int count);
+
+#endif /* WORKER_UTTILS_ */
@@ -0,0 +1,255 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "writer_utils.h"
+#include "cache_utils.h"
+#include "patch_utils.h"
+#include "memory_utils.h"
+#include "session_utils.h"
+#include "utils.h"
+
+//  max number of SAVEs waiting for the writer thread
+#define WRITER_DEPTH 4
+
+//  bytes copied at once from a file an earlier SAVE wrote
+#define COPY_BUFFER_SIZE (1 << 20)
+
+//  SAVE handed to the writer thread
+typedef struct save_job {
+	//  output file name
+	char *path;
+	//  output file, already opened by the editor
+	FILE *file;
+	//  device and inode of the output file, and of the source (if it
+	//  exists): paths can name the same file in many ways
+	dev_t dev;
+	ino_t ino;
+	bool has_source_id;
+	dev_t source_dev;
+	ino_t source_ino;
+	//  frozen copy of the image at the time of the SAVE, NULL if the file
+	//  is a copy of another one
+	my_image *image;
+	//  file written by an earlier SAVE of the same pixels, or NULL
+	char *source;
+	//  format of the output file
+	enum save_format format;
+	//  session of the SAVE, told if it fails
+	session *owner;
+	struct save_job *next;
+} save_job;
+
+//  pending SAVEs, the first one is being written
+static save_job *head;
+static save_job *tail;
+static int pending;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changed = PTHREAD_COND_INITIALIZER;
+static pthread_once_t started = PTHREAD_ONCE_INIT;
+
+//  copies a file written by an earlier job to the opened file
+static bool copy_file(char *source, FILE *file)
+{
+	FILE *input = fopen(source, "rb");
+	if (!input)
+		return false;
+
+	char *buffer = mem_alloc(COPY_BUFFER_SIZE, MEM_IO);
+	bool copied = buffer;
+	size_t length;
+
+	while (copied && (length = fread(buffer, 1, COPY_BUFFER_SIZE, input)))
+		copied = fwrite(buffer, 1, length, file) == length;
+
+	if (ferror(input))
+		copied = false;
+
+	mem_free(buffer);
+	fclose(input);
+
+	return copied;
+}
+
+//  encodes and writes the queued images in order
+static void *writer_thread(void *arg)
+{
+	(void)arg;
+
+	pthread_mutex_lock(&lock);
+
+	while (true) {
+		while (!head)
+			pthread_cond_wait(&changed, &lock);
+
+		//  leave the job queued while writing it, so waiters see it
+		save_job *job = head;
+		pthread_mutex_unlock(&lock);
+
+		bool saved = job->image ?
+					 save_image(job->file, job->image, job->format) :
+					 copy_file(job->source, job->file);
+
+		if (ferror(job->file))
+			saved = false;
+
+		//  a binary SAVE's record now describes the file; the buffered
+		//  rows are flushed first, which can still fail
+		if (saved)
+			stamp_save(job->file);
+
+		if (ferror(job->file))
+			saved = false;
+
+		if (fclose(job->file))
+			saved = false;
+
+		//  the file changed, its decoded image can't be reused
+		cache_invalidate(job->path);
+
+		//  the SAVE was already reported, its session is told of the failure
+		if (!saved)
+			session_save_failed(job->owner, job->path);
+
+		if (job->image) {
+			free_image_data(job->image);
+			free(job->image);
+		}
+
+		pthread_mutex_lock(&lock);
+
+		//  waiters compare paths under the lock until the job is dequeued
+		head = job->next;
+		if (!head)
+			tail = NULL;
+		pending--;
+		free(job->path);
+		free(job->source);
+		free(job);
+
+		pthread_cond_broadcast(&changed);
+	}
+
+	return NULL;
+}
+
+//  starts the writer thread
+static void start_writer(void)
+{
+	pthread_t writer;
+
+	DIE(pthread_create(&writer, NULL, writer_thread, NULL), "writer thread");
+	pthread_detach(writer);
+}
+
+//  queues a job for the writer thread
+static void queue_job(FILE *file, char *path, my_image *image,
+					  enum save_format format, char *source)
+{
+	pthread_once(&started, start_writer);
+
+	save_job *job = malloc(sizeof(save_job));
+	DIE(!job, "malloc job");
+
+	job->path = strdup(path);
+	DIE(!job->path, "strdup path");
+	job->file = file;
+	job->image = image;
+	job->format = format;
+	job->source = NULL;
+	job->owner = session_get();
+	job->next = NULL;
+
+	struct stat st;
+	DIE(fstat(fileno(file), &st), "fstat output");
+	job->dev = st.st_dev;
+	job->ino = st.st_ino;
+	job->has_source_id = false;
+
+	if (source) {
+		job->source = strdup(source);
+		DIE(!job->source, "strdup source");
+
+		if (!stat(source, &st)) {
+			job->has_source_id = true;
+			job->source_dev = st.st_dev;
+			job->source_ino = st.st_ino;
+		}
+	}
+
+	pthread_mutex_lock(&lock);
+
+	//  don't let snapshots pile up faster than the disk writes them
+	while (pending == WRITER_DEPTH)
+		pthread_cond_wait(&changed, &lock);
+
+	if (tail)
+		tail->next = job;
+	else
+		head = job;
+	tail = job;
+	pending++;
+
+	pthread_cond_broadcast(&changed);
+	pthread_mutex_unlock(&lock);
+}
+
+//  queues the image to be written to the opened file in the background,
+//  the writer owns both the file and the image from now on
+void writer_submit(FILE *file, char *path, my_image *image,
+				   enum save_format format)
+{
+	queue_job(file, path, image, format, NULL);
+}
+
+//  queues a copy of the file an earlier SAVE writes (or wrote) to the
+//  opened file, the writer owns the file from now on
+void writer_submit_copy(FILE *file, char *path, char *source)
+{
+	queue_job(file, path, NULL, SAVE_BINARY, source);
+}
+
+//  checks if a SAVE to (or copying) the given file is still pending
+//  (lock held)
+static bool is_pending(struct stat *st)
+{
+	for (save_job *job = head; job; job = job->next)
+		if ((job->dev == st->st_dev && job->ino == st->st_ino) ||
+			(job->has_source_id && job->source_dev == st->st_dev &&
+			 job->source_ino == st->st_ino))
+			return true;
+
+	return false;
+}
+
+//  waits until every pending SAVE to (or copying) the given file is done,
+//  whatever path names it; a path that names no file has nothing pending
+void writer_wait_path(char *path)
+{
+	struct stat st;
+
+	if (stat(path, &st))
+		return;
+
+	pthread_mutex_lock(&lock);
+
+	while (is_pending(&st))
+		pthread_cond_wait(&changed, &lock);
+
+	pthread_mutex_unlock(&lock);
+}
+
+//  waits until every pending SAVE is written
+void writer_wait_all(void)
+{
+	pthread_mutex_lock(&lock);
+
+	while (head)
+		pthread_cond_wait(&changed, &lock);
+
+	pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,17 @@
+#ifndef WRITER_UTTILS_
+#define WRITER_UTTILS_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "image_utils.h"
+
+void writer_submit(FILE *file, char *path, my_image *image,
+				   enum save_format format);
+
+void writer_submit_copy(FILE *file, char *path, char *source);
+
+void writer_wait_path(char *path);
+
+void writer_wait_all(void);
+
+#endif /* WRITER_UTTILS_ */